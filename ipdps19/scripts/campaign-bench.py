@@ -0,0 +1,208 @@
+#!/usr/bin/env python3.6
+
+import os
+import sys
+import argparse
+import subprocess
+import time
+import re
+import json
+import glob
+import numpy as np
+
+import data
+import fi_tools
+import sched
+import sequential
+
+# End-to-end campaign throughput benchmark: a small fixed campaign per app on the local node,
+# driving the same scripts as a full campaign (srun.py, run.py, generate-fi-samples.py) and
+# reporting trials per core-hour with the time broken down to:
+#   orchestration   script overhead, core time not spent inside trials
+#   startup         process launch to libinject init (loading, relocation, constructors)
+#   pre-target      init to injection, instrumented execution
+#   post-target     injection to exit, detached execution
+#   classification  parsing outputs and classifying outcomes
+# Needs libinject with FI_TIMING support and the test inputs of data.py. With libinject built with
+# FI_STATS=ON the hook accounting of fi-stats.json is aggregated too:
+#   counting        init to the first block reaching a target, blocks counted by selMBB
+#   stepping        first target block to the last injection, instructions stepped by selInst
+#   post-detach     first detach to fini, residue of blocks calling selMBB after detaching
+#   hook-time       seconds inside the hooks, from the TSC cycles
+
+try:
+    homedir = os.environ['HOME']
+except:
+    print('Env variable HOME is missing')
+    sys.exit(1)
+
+try:
+    scriptdir = os.environ['SCRIPTDIR']
+except:
+    print('Env variable SCRIPTDIR is missing')
+    sys.exit(1)
+
+def read_times(trialdir):
+    ts = {}
+    try:
+        with open(trialdir + '/timestamps.txt', 'r') as f:
+            m = re.match('launch=([\d\.]+), exit=([\d\.]+)', f.read())
+            ts['launch'], ts['exit'] = float(m[1]), float(m[2])
+    except FileNotFoundError:
+        return None
+    # XXX: crashes before injection leave no fi-timing.txt, the whole trial counts as startup
+    try:
+        with open(trialdir + '/fi-timing.txt', 'r') as f:
+            m = re.match('init=([\d\.]+), inject=([\d\.]+), fini=([\d\.]+)', f.read())
+            ts['init'], ts['inject'], ts['fini'] = float(m[1]), float(m[2]), float(m[3])
+    except FileNotFoundError:
+        ts['init'] = ts['exit']
+        ts['inject'] = 0
+    return ts
+
+# Sum the hook accounting of fi-stats.json (<rank>.fi-stats.json with MPI) over the trials, None without
+def hook_stats(trialdirs):
+    h = { 'trials': 0, 'selMBB': 0, 'selInst': 0, 'doInject': 0, 'hook-time': 0.0, 'counting': 0.0, 'stepping': 0.0, 'post-detach': 0.0 }
+    for trialdir in trialdirs:
+        # XXX: crashing trials never run fini and leave no record
+        for fname in glob.glob(trialdir + '/fi-stats.json') + glob.glob(trialdir + '/*.fi-stats.json'):
+            with open(fname, 'r') as f:
+                st = json.load(f)
+            h['trials'] += 1
+            elapsed = st['fini'] - st['init']
+            hz = ( st['tsc_fini'] - st['tsc_init'] ) / elapsed if elapsed > 0 else 0
+            for t in st['threads']:
+                for k in [ 'selMBB', 'selInst', 'doInject' ]:
+                    h[k] += t[k]
+                if hz > 0:
+                    h['hook-time'] += t['cycles'] / hz
+            reached = [ t['reached'] for t in st['threads'] if t['reached'] > 0 ]
+            injected = [ t['injected'] for t in st['threads'] if t['injected'] > 0 ]
+            detached = [ t['detached'] for t in st['threads'] if t['detached'] > 0 ]
+            h['counting'] += ( min(reached) if reached else st['fini'] ) - st['init']
+            if reached and injected:
+                h['stepping'] += max(injected) - min(reached)
+            if detached:
+                h['post-detach'] += st['fini'] - min(detached)
+    return h if h['trials'] > 0 else None
+
+# Break down the trial time: startup, pre-target, post-target (seconds)
+def breakdown(trialdirs):
+    b = { 'trials': 0.0, 'startup': 0.0, 'pre-target': 0.0, 'post-target': 0.0 }
+    for trialdir in trialdirs:
+        ts = read_times(trialdir)
+        if not ts:
+            continue
+        b['trials'] += ts['exit'] - ts['launch']
+        b['startup'] += ts['init'] - ts['launch']
+        if ts['inject'] > 0:
+            b['pre-target'] += ts['inject'] - ts['init']
+            b['post-target'] += ts['exit'] - ts['inject']
+        else:
+            b['pre-target'] += ts['exit'] - ts['init']
+    return b
+
+def srun(exps, ntasks, env):
+    runlist = []
+    for e in exps:
+        # XXX: sched.check quotes exelist and cleanstr for the moab shell script, strip them
+        runlist += [ '-r', e[0], e[1], e[2].strip('"'), e[3].strip('"') ]
+    subprocess.check_call( [ scriptdir + '/srun.py', '-N', '1', '-p', 'local', '-n', str(ntasks) ] + env + runlist, stdout=subprocess.DEVNULL )
+
+def campaign(args, app, env):
+    config, wait, instrument, nthreads, inputsize = 'serial', '', '', '', 'test'
+    basedir = '%s/%s/%s/%s/%s'%( args.resdir, args.tool, config, wait, app )
+    res = { 'app': app }
+
+    # profiling
+    start = time.time()
+    exps = sched.check(args.appdir, args.resdir, args.tool, config, wait, [app], 'profile', instrument, nthreads, inputsize, 1, args.nprofile, True)
+    srun(exps, args.tasks, env)
+    res['profile'] = time.time() - start
+    profdirs = [ '%s/profile/%s/%s/%s/%d'%( basedir, instrument, nthreads, inputsize, t ) for t in range(1, args.nprofile+1) ]
+
+    # sampling
+    start = time.time()
+    subprocess.check_call( [ scriptdir + '/generate-fi-samples.py', '-r', args.resdir, '-o', 'fi', '-t', args.tool, '-a', app, '-c', config,
+        '-i', inputsize, '-ps', '1', '-pe', str(args.nprofile), '-g', '-n', str(args.ntrials), '-w', wait ], stdout=subprocess.DEVNULL )
+    res['sampling'] = time.time() - start
+
+    # injection
+    start = time.time()
+    exps = sched.check(args.appdir, args.resdir, args.tool, config, wait, [app], 'fi', instrument, nthreads, inputsize, 1, args.ntrials, False)
+    srun(exps, args.tasks, env)
+    res['injection'] = time.time() - start
+    fidirs = [ '%s/fi/%s/%s/%s/%d'%( basedir, instrument, nthreads, inputsize, t ) for t in range(1, args.ntrials+1) ]
+
+    # classification, the first profiling run is the golden output
+    start = time.time()
+    verify_list = sequential.golden_verify_list(profdirs[0] + '/output.txt', config, app, inputsize)
+    outcomes = dict.fromkeys(sequential.outcomes + ['missing'], 0)
+    for trialdir in fidirs:
+        o = sequential.classify(trialdir, args.tool, config, app, inputsize, verify_list)
+        if o:
+            outcomes[o] += 1
+    res['classification'] = time.time() - start
+    res['outcomes'] = outcomes
+
+    # XXX: trials run on args.tasks cores, orchestration is the core time left over from the trials
+    wall = res['profile'] + res['sampling'] + res['injection'] + res['classification']
+    bp = breakdown(profdirs)
+    bi = breakdown(fidirs)
+    res['wall'] = wall
+    res['core_hours'] = wall * args.tasks / 3600.0
+    res['trials_per_core_hour'] = args.ntrials / res['core_hours']
+    res['startup'] = bp['startup'] + bi['startup']
+    res['pre-target'] = bi['pre-target']
+    res['post-target'] = bi['post-target']
+    res['profile-run'] = bp['pre-target']
+    res['orchestration'] = ( res['profile'] + res['injection'] ) * args.tasks - bp['trials'] - bi['trials'] + res['sampling']
+    res['hooks-profile'] = hook_stats(profdirs)
+    res['hooks-fi'] = hook_stats(fidirs)
+    return res
+
+def main():
+    parser = argparse.ArgumentParser('End-to-end FI campaign throughput benchmark')
+    parser.add_argument('-d', '--appdir', help='applications root directory', required=True)
+    parser.add_argument('-r', '--resdir', help='scratch results directory', required=True)
+    parser.add_argument('-t', '--tool', help='tool to run', choices=['safire', 'refine'], default='safire')
+    parser.add_argument('-a', '--apps', help='applications to run ( ' + ' | '.join(data.apps) + ' | ALL ) ', nargs='+', default=['ALL'])
+    parser.add_argument('-np', '--nprofile', help='number of profiling runs', type=int, default=3)
+    parser.add_argument('-n', '--ntrials', help='number of FI trials per app', type=int, default=20)
+    parser.add_argument('-j', '--tasks', help='concurrent trials', type=int, default=1)
+    parser.add_argument('-o', '--output', help='JSON output file', default='campaign-bench.json')
+    args = parser.parse_args()
+
+    assert os.path.isdir(args.appdir), 'Applications directory: ' + args.appdir + 'does not exist'
+    assert args.nprofile > 0 and args.ntrials > 0 and args.tasks > 0, 'nprofile, ntrials, tasks must be > 0'
+    if args.apps == ['ALL']:
+        args.apps = data.apps
+    for a in args.apps:
+        assert a in data.apps, 'Application: ' + a + ' is invalid'
+    assert not os.path.exists(args.resdir), 'Results directory ' + args.resdir + ' exists, the benchmark needs a fresh one'
+
+    env = [ '-e', 'FI_TIMING', '1', '-e', 'LD_LIBRARY_PATH', homedir + '/usr/local/lib' ]
+
+    results = []
+    print('%-10s %8s %10s %8s %8s %8s %8s %8s'%( 'app', 'wall', 'trials/ch', 'orch', 'startup', 'pre', 'post', 'class' ))
+    for app in args.apps:
+        res = campaign(args, app, env)
+        results.append(res)
+        print('%-10s %8.2f %10.1f %8.2f %8.2f %8.2f %8.2f %8.2f'%( app, res['wall'], res['trials_per_core_hour'], res['orchestration'],
+            res['startup'], res['pre-target'], res['post-target'], res['classification'] ))
+        h = res['hooks-fi']
+        if h:
+            print('%-10s hooks: selMBB %d, selInst %d, doInject %d, %.2f s in hooks, counting %.2f s, stepping %.4f s, post-detach %.2f s'%(
+                '', h['selMBB'], h['selInst'], h['doInject'], h['hook-time'], h['counting'], h['stepping'], h['post-detach'] ))
+
+    total_core_hours = sum( r['core_hours'] for r in results )
+    total_trials = args.ntrials * len(results)
+    print('Total: %d trials, %.4f core-hours, %.1f trials per core-hour'%( total_trials, total_core_hours, total_trials / total_core_hours ))
+
+    with open(args.output, 'w') as f:
+        json.dump( { 'tool': args.tool, 'nprofile': args.nprofile, 'ntrials': args.ntrials, 'tasks': args.tasks,
+            'trials_per_core_hour': total_trials / total_core_hours, 'results': results }, f, indent=2 )
+    print('Wrote ' + args.output)
+
+if __name__ == "__main__":
+    main()
@@ -5,6 +5,8 @@ import argparse
 import re
 import random
 import glob
+import os
+import subprocess
 
 parser = argparse.ArgumentParser('Create a FI target')
 parser.add_argument('-e', '--execmode', help='Execution model (serial | omp | mpi | mpi+omp)', required=True)
@@ -12,6 +14,16 @@ args = parser.parse_args()
 
 assert args.execmode in ['serial', 'omp', 'mpi', 'mpi+omp'], 'Valid execmodes are serial | omp | mpi | mpi+omp'
 
+# XXX: ranks profiled with FI_INSCOUNT_FORMAT=binary write a single aggregated file, sample from it
+# with fi-sample (libinject) instead of parsing per-rank text files
+if args.execmode in ['mpi', 'mpi+omp'] and os.path.isfile('fi-inscount.bin'):
+    print(args.execmode + ' (binary)')
+    subprocess.check_call(['fi-sample', '-e', args.execmode, '-o', 'fi-target.txt', 'fi-inscount.bin'])
+    with open('fi-target.txt', 'r') as f:
+        print(f.read())
+    print('Done!')
+    sys.exit(0)
+
 # parse inscount and create fi-target.txt
 if args.execmode == 'serial':
     print('serial')
@@ -32,9 +32,9 @@ files = {
             'target':'pin.target.txt',
             },
         'safire': {
-            'inscount':'refine-inscount.txt',
-            'injection':'refine-inject.txt',
-            'target':'refine-target.txt'
+            'inscount':'fi-inscount.txt',
+            'injection':'fi-inject.txt',
+            'target':'fi-target.txt'
         },
         'refine': {
             'inscount':'refine-inscount.txt',
@@ -81,3 +81,16 @@ exelist = {
         }
     },
 }
+
+# safire per DSO domains (FI_DOMAINS of libinject): the safire build instruments both the app and libomp,
+# one profiling run of 'all' counts each domain in fi-domains.txt and trials select theirs at run time
+domains = {
+        'all':'all',
+        'app':'app',
+        'omplib':'libomp'
+    }
+
+def profile_instrument(tool, instrument):
+    if tool == 'safire' and instrument in domains:
+        return 'all'
+    return instrument
@@ -0,0 +1,56 @@
+import os
+import re
+import numpy as np
+
+# Resource footprint of trials for packing concurrent trials on a node.
+# run.py writes the getrusage of every trial to rusage.txt, generate-fi-samples.py aggregates the
+# profiling trials of an app to footprint.txt in the FI experiment directory, next to the trials
+
+rusage_fname = 'rusage.txt'
+footprint_fname = 'footprint.txt'
+
+# maxrss in KB, utime and stime in seconds
+def write_rusage(trialdir, ru):
+    with open(trialdir + '/' + rusage_fname, 'w') as f:
+        f.write('maxrss=%d, utime=%.2f, stime=%.2f\n'%( ru.ru_maxrss, ru.ru_utime, ru.ru_stime ) )
+
+def read_rusage(trialdir):
+    fname = trialdir + '/' + rusage_fname
+    if not os.path.isfile(fname):
+        return None
+    with open(fname, 'r') as f:
+        m = re.match('maxrss=(\d+), utime=([\d\.]+), stime=([\d\.]+)', f.read())
+    return { 'maxrss': int(m[1]), 'utime': float(m[2]), 'stime': float(m[3]) }
+
+# Footprint of the profiling trials: peak RSS (MB) is the max, CPU (cores busy) is the mean
+# (utime+stime)/wall. Bandwidth (GB/s) is not visible to getrusage, it is given by the user,
+# e.g., measured with likwid or perf uncore counters, 0 means unknown
+def profile(profiledir, start, end, bw):
+    maxrss = []
+    cpu = []
+    for trial in range(start, end+1):
+        trialdir = '%s/%s/'%(profiledir, trial)
+        ru = read_rusage(trialdir)
+        if not ru:
+            continue
+        with open(trialdir + 'time.txt', 'r') as f:
+            xtime = float( f.read() )
+        maxrss.append( ru['maxrss'] / 1024.0 )
+        cpu.append( ( ru['utime'] + ru['stime'] ) / max(xtime, 0.01) )
+
+    if not maxrss:
+        return None
+    return { 'maxrss': max(maxrss), 'cpu': np.mean(cpu), 'bw': bw }
+
+def write(dirname, fp):
+    with open(dirname + '/' + footprint_fname, 'w') as f:
+        f.write('maxrss=%.2f, cpu=%.2f, bw=%.2f\n'%( fp['maxrss'], fp['cpu'], fp['bw'] ) )
+
+# Footprint of a trial, read from its experiment directory
+def read(trialdir):
+    fname = os.path.normpath(trialdir + '/..') + '/' + footprint_fname
+    if not os.path.isfile(fname):
+        return None
+    with open(fname, 'r') as f:
+        m = re.match('maxrss=([\d\.]+), cpu=([\d\.]+), bw=([\d\.]+)', f.read())
+    return { 'maxrss': float(m[1]), 'cpu': float(m[2]), 'bw': float(m[3]) }
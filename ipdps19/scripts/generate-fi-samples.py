@@ -13,9 +13,23 @@ import itertools
 
 import data
 import fi_tools
+import footprint
+
+# Sum the per domain counts of fi-domains.txt over the domains selected by FI_DOMAINS sel. The MPI
+# runtimes write <rank>.fi-domains.txt, read the file of rank
+def parse_domains(trialdir, sel, rank=None):
+    fname = trialdir + ( '%d.'%( rank ) if rank is not None else '' ) + 'fi-domains.txt'
+    counts = {}
+    with open(fname, 'r') as f:
+        for m in re.finditer('thread=(\d+), domain=([^,]+), fi_index=(\d+)', f.read()):
+            thread = int(m[1])
+            counts.setdefault(thread, 0)
+            if sel == 'all' or m[2].startswith(sel):
+                counts[thread] += int(m[3])
+    return counts
 
 # Parse profiling data to get stats
-def parse_profile(basedir, tool, config, nthreads, input_size, start, end):
+def parse_profile(basedir, tool, config, nthreads, input_size, start, end, domain=None):
     inscount = []
     if config == 'omp':
         thread_inscount = {}
@@ -31,14 +45,20 @@ def parse_profile(basedir, tool, config, nthreads, input_size, start, end):
         with open(fname, 'r') as f:
             fdata = f.read()
             #print(data)
-            if config == 'omp':
-                m = re.findall('thread=(\d+), fi_index=(\d+)', fdata)
-                for i in m:
-                    thread_inscount[ int(i[0]) ].append( int(i[1]) )
+            if domain:
+                counts = parse_domains(trialdir, domain)
+                for thread in thread_inscount:
+                    thread_inscount[thread].append( counts.get(thread, 0) )
+                inscount.append( sum( counts.values() ) )
+            else:
+                if config == 'omp':
+                    m = re.findall('thread=(\d+), fi_index=(\d+)', fdata)
+                    for i in m:
+                        thread_inscount[ int(i[0]) ].append( int(i[1]) )
 
-            # XXX: ^ and re.MULTILINE to handle omp instcount (serial works too)
-            m = re.search( '^fi_index=(\d+)', fdata, re.MULTILINE )
-            inscount.append( int(m[1]) )
+                # XXX: ^ and re.MULTILINE to handle omp instcount (serial works too)
+                m = re.search( '^fi_index=(\d+)', fdata, re.MULTILINE )
+                inscount.append( int(m[1]) )
         
         # read execution time
         fname = trialdir + 'time.txt'
@@ -68,12 +88,41 @@ def parse_profile(basedir, tool, config, nthreads, input_size, start, end):
 
     return m_time, m_inscount, s_inscount, m_thread_inscount
 
+# Mean wall and CPU (utime+stime) time of the golden profiling runs, CPU is None without rusage.txt
+def parse_golden_time(goldendir, start, end):
+    xtime = []
+    cpu = []
+    for trial in range(start, end+1):
+        trialdir = '%s/%s/'%(goldendir, trial)
+        with open(trialdir + 'time.txt', 'r') as f:
+            xtime.append( float(f.read()) )
+        ru = footprint.read_rusage(trialdir)
+        if ru:
+            cpu.append( ru['utime'] + ru['stime'] )
+    return np.mean(xtime), ( np.mean(cpu) if len(cpu) == len(xtime) else None )
+
+# Time targets, libinject fires a CPU timer of the thread at time=S and injects at its next block
+def write_time_files(basedir, tool, config, samples):
+    for trial, (thread, time) in enumerate(samples, 1):
+        trialdir = '/%s/%s/'%(basedir, trial)
+        fname = trialdir + fi_tools.files[tool]['target']
+        if not os.path.exists(trialdir):
+            os.makedirs(trialdir)
+        if not os.path.isfile(fname):
+            print('GENERATED file')
+            with open(fname, 'w') as f:
+                if config == 'omp':
+                    f.write( 'thread=%d, time=%.6f\n'%( thread, time ) )
+                else:
+                    f.write( 'time=%.6f\n'%( time ) )
+
 def write_fi_files(basedir, tool, config, samples, m_thread_inscount):
     # XXX: used for omp plotting check
     fi_threads = []
     nthreads = len(m_thread_inscount)
 
-    for trial, target in enumerate(samples, 1):
+    # XXX: each trial has a list of targets, more than one for multi-fault campaigns (-k)
+    for trial, targets in enumerate(samples, 1):
         #print('target %d'%(target)) # ggout
         trialdir = '/%s/%s/'%(basedir, trial)
         #print(trialdir)
@@ -86,24 +135,28 @@ def write_fi_files(basedir, tool, config, samples, m_thread_inscount):
             # order instructions from 0...n thread
             print('GENERATED file')
             if config == 'omp':
-                sum_inscount = 0
-                # iterate over threads
-                for thread, inscount in m_thread_inscount:
-                    if target <= ( sum_inscount + inscount ):
-                        fi_index = target - sum_inscount
-                        fi_threads.append(thread)
-                        break
+                lines = []
+                for target in sorted(targets):
+                    sum_inscount = 0
+                    # iterate over threads
+                    for thread, inscount in m_thread_inscount:
+                        if target <= ( sum_inscount + inscount ):
+                            fi_index = target - sum_inscount
+                            fi_threads.append(thread)
+                            break
 
-                    sum_inscount += inscount
+                        sum_inscount += inscount
 
-                #print('target=%d'%(target) )
-                #print('thread=%d, fi_index=%d\n'%( thread, fi_index ))
-                #input('press key to continue...')
+                    #print('target=%d'%(target) )
+                    #print('thread=%d, fi_index=%d\n'%( thread, fi_index ))
+                    #input('press key to continue...')
+                    lines.append('thread=%d, fi_index=%d\n'%( thread, fi_index ))
                 with open(fname, 'w') as f:
-                    f.write('thread=%d, fi_index=%d\n'%( thread, fi_index ))
+                    f.writelines(lines)
             else:
                 with open(fname, 'w') as f:
-                    f.write( 'fi_index=%d\n'%(target) )
+                    for target in sorted(targets):
+                        f.write( 'fi_index=%d\n'%(target) )
     
     #if fi_threads:
     #    print(Counter(fi_threads).keys())
@@ -124,7 +177,11 @@ def main():
     parser.add_argument('-g', '--generate', help='generate FI samples', action='store_true')
     parser.add_argument('-n', '--nsamples', help='number of FI samples', type=int, required=True)
     parser.add_argument('-tt', '--targetthreads', help='threads to target', type=int, nargs='+')
+    parser.add_argument('-k', '--faults', help='faults per trial, multi-fault campaigns (safire only)', type=int, default=1)
     parser.add_argument('-w', '--wait', help='wait policy', choices=['passive', 'active', ''], required=True)
+    parser.add_argument('-bw', '--bandwidth', help='memory bandwidth per trial (GB/s) for packing trials, measured externally', type=float, default=0.0)
+    parser.add_argument('-T', '--time', help='time targets from the golden profiling runs, no instrumented profiling (safire -fi-ff only)', action='store_true')
+    parser.add_argument('-ts', '--time-scale', help='slowdown of the instrumented binary before the target, scales the time targets', type=float, default=1.0)
     args = parser.parse_args()
 
     # Error checking
@@ -158,13 +215,45 @@ def main():
     if args.targetthreads and not config == 'omp':
         parser_error('targetthreads can be used only in omp configuration')
     assert args.nsamples > 0, 'Number of FI samples must be > 0'
+    assert args.faults > 0, 'Number of faults per trial must be > 0'
+    assert args.faults <= 64, 'Number of faults per trial must be <= 64, MAX_FAULTS of libinject'
+    assert args.faults == 1 or args.tool == 'safire', 'Multiple faults per trial are supported only by safire'
+    assert not args.time or args.tool == 'safire', 'Time targets are supported only by safire'
+    assert not args.time or args.faults == 1, 'Time targets support a single fault per trial'
+    assert args.time_scale > 0, 'Time scale must be > 0'
 
     # Generate random samples and fi files
     for app in args.apps:
         print('==== ' + app + ' ====')
-        profiledir = '%s/%s/%s/%s/%s/%s/%s/%s/%s'%(args.resdir, args.tool, config, args.wait, app, 'profile', instrument, nthreads, args.input)
+        # XXX: safire omp configurations share the profile of 'all', counts of the selected domains
+        profinstrument = fi_tools.profile_instrument(args.tool, instrument)
+        profiledir = '%s/%s/%s/%s/%s/%s/%s/%s/%s'%(args.resdir, args.tool, config, args.wait, app, 'profile', profinstrument, nthreads, args.input)
+        domain = fi_tools.domains[instrument] if profinstrument != instrument else None
+
+        # XXX: Time targets need only the golden profile. The timer counts the CPU time of the target
+        # thread, uniform over the CPU time of the serial run or the wall time of a thread in omp
+        if args.time:
+            goldendir = '%s/%s/%s/%s/%s/%s/%s/%s'%(args.resdir, 'golden', config, args.wait, app, 'profile', nthreads, args.input)
+            m_time, m_cpu = parse_golden_time(goldendir, args.pstart, args.pend)
+            span = ( m_cpu if config == 'serial' and m_cpu else m_time ) * args.time_scale
+            print('mean time %.2f span %.2f'%(m_time, span) )
+            # sched.py sets the timeout of FI trials from mean_time.txt of the profile
+            if not os.path.exists(profiledir):
+                os.makedirs(profiledir)
+            with open(profiledir + '/mean_time.txt', 'w') as f:
+                f.write( '%.2f\n'%(m_time * args.time_scale) )
+            if args.generate:
+                threads = args.targetthreads if args.targetthreads else range( int(nthreads) if nthreads else 1 )
+                samples = [ ( random.choice(threads), max( 1e-6, random.uniform(0, span) ) ) for i in range(args.nsamples) ]
+                fidir = '%s/%s/%s/%s/%s/%s/%s/%s/%s'%(args.resdir, args.tool, config, args.wait, app, args.outdir, instrument, nthreads, args.input)
+                write_time_files(fidir, args.tool, config, samples)
+                fp = footprint.profile(goldendir, args.pstart, args.pend, args.bandwidth)
+                if fp:
+                    footprint.write(fidir, fp)
+            print('==== END ' + app + ' ====')
+            continue
 
-        m_time, m_inscount, s_inscount, m_thread_inscount = parse_profile(profiledir, args.tool, config, nthreads, args.input, args.pstart, args.pend)
+        m_time, m_inscount, s_inscount, m_thread_inscount = parse_profile(profiledir, args.tool, config, nthreads, args.input, args.pstart, args.pend, domain)
         if m_thread_inscount:
             print('mean inst. per thread')
             print(m_thread_inscount)
@@ -185,7 +274,7 @@ def main():
                         sum_inscount += inscount
                     all_sum_inscount += inscount
 
-                samples = random.sample( range(1, sum_inscount+1), args.nsamples)
+                samples = random.sample( range(1, sum_inscount+1), args.nsamples * args.faults)
                 # re-map samples to original order
                 for i, s in enumerate( samples ):
                     for first, last, offset in mapping:
@@ -193,13 +282,22 @@ def main():
                             samples[i] = s + offset
                             break
             else:
-                samples = random.sample(range(1, m_inscount+1), args.nsamples)
+                samples = random.sample(range(1, m_inscount+1), args.nsamples * args.faults)
+
+            # Distinct targets across the campaign, args.faults per trial
+            samples = [ samples[i:i+args.faults] for i in range(0, len(samples), args.faults) ]
 
             fidir = '%s/%s/%s/%s/%s/%s/%s/%s/%s'%(args.resdir, args.tool, config, args.wait, app, args.outdir, instrument, nthreads, args.input)
             
             write_fi_files(fidir, args.tool, config, samples, m_thread_inscount)
 
-            samples = [n/m_inscount for n in samples]
+            # Resource footprint of the trials for srun.py packing
+            fp = footprint.profile(profiledir, args.pstart, args.pend, args.bandwidth)
+            if fp:
+                print('footprint maxrss %.2f MB cpu %.2f bw %.2f GB/s'%( fp['maxrss'], fp['cpu'], fp['bw'] ) )
+                footprint.write(fidir, fp)
+
+            samples = [n/m_inscount for t in samples for n in t]
             #plot_hist(samples, title='Target distro', bincount=100, xlab=True)
         print('==== END ' + app + ' ====')
 
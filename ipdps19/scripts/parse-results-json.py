@@ -10,6 +10,7 @@ import scipy.stats as stats
 
 import data
 import fi_tools
+import verifier
 # Parse profiling files
 def parse_profiles(resdir, tool, config, wait, app, instrument, nthreads, inputsize, start, end):
     inscount = []
@@ -141,14 +142,11 @@ def parse_fi(resdir, tool, config, wait, app, action, instrument, nthreads, inpu
     # TODO: check whether outputs with omp may differ but still valid
     trialdir = profiledir + '1/'
 
-    verify_list = []
+    # XXX: matches per pattern, compared in order as the streaming verifier does
     with open(trialdir + 'output.txt', 'r') as f:
-        for v in data.programs[config][app]['verify'][inputsize]:
-            #print(v)
-            m = re.findall(v, f.read())
-            verify_list += m
+        verify_list = verifier.matches(f.read(), data.programs[config][app]['verify'][inputsize])
     #print(verify_list)
-    assert verify_list, 'verify_list cannot be empty file: ' + trialdir + 'output.txt' + ', verify:' + ' '.join(data.programs[config][app]['verify'][inputsize])
+    assert any(verify_list), 'verify_list cannot be empty file: ' + trialdir + 'output.txt' + ', verify:' + ' '.join(data.programs[config][app]['verify'][inputsize])
 
     basedir = '%s/%s/%s/%s/%s/%s/%s/%s/%s/'%(resdir, tool, config, wait, app, action, instrument, nthreads, inputsize)
 
@@ -170,22 +168,24 @@ def parse_fi(resdir, tool, config, wait, app, action, instrument, nthreads, inpu
                 res = res.strip().split(',')
                 if res[0] == 'timeout':
                     timeout += 1
+                # XXX: the target was not reached, some of multiple faults may have been injected
+                elif res[0] == 'unreachable':
+                    missing += 1
                 elif res[0] == 'crash':
                     crash += 1
                 elif res[0] == 'error':
                     crash += 1
+                elif res[0] == 'sdc':
+                    soc += 1
+                elif res[0] == 'exit' and verifier.outcome(trialdir) == 'benign':
+                    benign += 1
+                elif res[0] == 'exit' and verifier.outcome(trialdir) == 'sdc':
+                    soc += 1
                 elif res[0] == 'exit':
                     with open(trialdir + '/' + 'output.txt', 'r') as f:
                         #print('open: ' + trialdir +'/' + 'output.txt')
-                        verify_out = []
-                        for v in data.programs[config][app]['verify'][inputsize]:
-                            m = re.findall(v, f.read())
-                            verify_out += m
-                        verified = True
-                        for out in verify_list:
-                            if not out in verify_out:
-                                verified = False
-                                break
+                        verify_out = verifier.matches(f.read(), data.programs[config][app]['verify'][inputsize])
+                        verified = verifier.verify(verify_list, verify_out)
                         if verbose:
                             print('*** verify ***')
                             print(verify_list)
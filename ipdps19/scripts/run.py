@@ -8,8 +8,11 @@ import time
 import multiprocessing as mp
 import traceback
 import argparse
+import threading
 
 import data
+import footprint
+import verifier
 
 try:
     SLURM_PROCID = os.environ['SLURM_PROCID']
@@ -21,8 +24,12 @@ parser = argparse.ArgumentParser('Run a list of experiment tuples')
 # tuple of 3: (trialdir, exelist str)
 parser.add_argument('-e', '--env', help='environment variables to set', nargs=2, action='append')
 parser.add_argument('-r', '--runlist', help='list to run', nargs=5, action='append', required=True)
+parser.add_argument('-cg', '--cgroup', help='run each trial in a cgroup scope limiting memory to <factor> x the profiled peak RSS', type=float)
 args = parser.parse_args()
 
+# Exit status of a trial that did not reach its FI target, FI_EXIT_UNREACHABLE of libinject/fi_thread.h
+FI_EXIT_UNREACHABLE = 99
+
 def run(e):
     trialdir= e[0]
     timeout = float( e[1] )
@@ -44,6 +51,9 @@ def run(e):
     err_file = open(trialdir + '/error.txt', 'w')
     ret = 0
     timed_out = False
+    # Streaming verification if the campaign has golden matches, sched.py -sv
+    golden = verifier.read(trialdir)
+    sdc_line = 0
 
     #print('==== before run ====')
     #print(exelist)
@@ -55,17 +65,53 @@ def run(e):
         for e in args.env:
             runenv[e[0]] = e[1]
             #print('setting %s=%s'%(e[0], e[1]) ) # ggout
+    # XXX: cgroup v2 memory limit, a fault causing runaway allocation must not take the node's other trials down
+    if args.cgroup:
+        fp = footprint.read(trialdir)
+        if fp:
+            memlimit = int( args.cgroup * fp['maxrss'] ) + 1
+            exelist = [ 'systemd-run', '--user', '--scope', '--quiet', '-p', 'MemoryMax=%dM'%( memlimit ), '-p', 'MemorySwapMax=0' ] + exelist
+
     start = time.perf_counter()
-    try:
-        #exelist = ['env']
-        p = subprocess.Popen(exelist, stdout=out_file, stderr=err_file, env=runenv, cwd=trialdir)
-        p.wait(timeout)
-        #p = subprocess.run(exelist, stdout=out_file, stderr=err_file, timeout=timeout)
-        #p = subprocess.run(exelist, stdout=out_file, stderr=subprocess.DEVNULL, timeout=timeout)
-        ret = p.returncode
-    except subprocess.TimeoutExpired:
+    launch = time.time()
+    #exelist = ['env']
+    p = subprocess.Popen(exelist, stdout=( subprocess.PIPE if golden else out_file ), stderr=err_file, env=runenv, cwd=trialdir)
+    # XXX: wait4 instead of p.wait to get the rusage of the trial, a timer kills it on timeout
+    def kill():
+        nonlocal timed_out
         timed_out = True
+        p.kill()
+    timer = None
+    if timeout:
+        timer = threading.Timer(timeout, kill)
+        timer.start()
+    # XXX: the trial's stdout is a pipe, hence block buffered, divergence is seen per flushed block
+    verified = None
+    if golden:
+        sv = verifier.StreamVerifier(golden)
+        for line in p.stdout:
+            line = line.decode(errors='replace')
+            out_file.write(line)
+            if not sv.feed(line):
+                sdc_line = sv.lineno
+                p.kill()
+                break
+        p.stdout.close()
+        if not sdc_line:
+            verified = sv.finish()
+    __, status, ru = os.wait4(p.pid, 0)
+    if os.WIFSIGNALED(status):
+        ret = -os.WTERMSIG(status)
+    else:
+        ret = os.WEXITSTATUS(status)
+    # XXX: wait4 reaped the trial, tell the Popen so a late kill() from the timer or the verifier does not
+    # signal a reused pid, and wait() returns the status
+    p.returncode = ret
+    p.wait()
+    if timer:
+        timer.cancel()
     xtime = time.perf_counter() - start
+    exit_time = time.time()
 
     out_file.close()
     err_file.close()
@@ -77,21 +123,38 @@ def run(e):
 
     #print('RET: ' + str(ret))
     ret_file = open(trialdir + '/ret.txt', 'w')
-    if timed_out:
+    if sdc_line:
+        ret_file.write('sdc, ' + str(sdc_line) + '\n')
+    elif timed_out:
         ret_file.write('timeout\n')
         #print('Process timed out!')
     elif ret < 0:
         ret_file.write('crash, ' + str(ret) + '\n')
+    elif ret == FI_EXIT_UNREACHABLE and os.path.isfile(trialdir + '/fi-unreachable.txt'):
+        ret_file.write('unreachable, ' + str(ret) + '\n')
     elif ret > 0:
         ret_file.write('error, ' + str(ret) + '\n')
     else:
         ret_file.write('exit, ' + str(ret) + '\n')
     ret_file.close()
 
+    # XXX: benign trials need no output, SDC trials keep it for inspection
+    if not sdc_line and not timed_out and ret == 0 and verified is not None:
+        with open(trialdir + '/' + verifier.outcome_fname, 'w') as f:
+            f.write( 'benign\n' if verified else 'sdc, eof\n' )
+        if verified:
+            os.remove(trialdir + '/output.txt')
+
     #print('time: %.2f'%(xtime))
     with open(trialdir + '/time.txt', 'w') as f:
         f.write('%.2f'%(xtime) + '\n')
 
+    footprint.write_rusage(trialdir, ru)
+
+    # XXX: wall clock, same as libinject's fi-timing.txt (FI_TIMING=1) to break down the trial time
+    with open(trialdir + '/timestamps.txt', 'w') as f:
+        f.write('launch=%.6f, exit=%.6f\n'%( launch, exit_time ))
+
     #print('Profiling ' + ' '.join(e) + ' done')
 
 
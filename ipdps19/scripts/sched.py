@@ -7,6 +7,7 @@ import fi_tools
 import sys
 import itertools
 import config
+import verifier
 
 try:
     homedir = os.environ['HOME']
@@ -14,19 +15,23 @@ except:
     print('Env variable HOME is missing')
     sys.exit(1)
 
-def check(appdir, resdir, tool, config, wait, apps, action, instrument, nthreads, inputsize, start, end, generate):
+def check(appdir, resdir, tool, config, wait, apps, action, instrument, nthreads, inputsize, start, end, generate, stream_verify=False):
     exps=[]
     # Create fault injection experiment tuples
     for app in apps:
         basedir = '%s/%s/%s/%s/%s/%s/%s/%s/%s/'%(resdir, tool, config, wait, app, action, instrument, nthreads, inputsize)
         if action == 'fi' or action == 'fi-0' or action == 'fi-1-15':
-            # get timeout
-            profiledir = '%s/%s/%s/%s/%s/%s/%s/%s/%s'%(resdir, tool, config, wait, app, 'profile', instrument, nthreads, inputsize)
+            # get timeout, safire domains share the profile of 'all'
+            profiledir = '%s/%s/%s/%s/%s/%s/%s/%s/%s'%(resdir, tool, config, wait, app, 'profile', fi_tools.profile_instrument(tool, instrument), nthreads, inputsize)
             fname = '/%s/mean_time.txt'%(profiledir)
             with open(fname, 'r') as f:
                 proftime = float( f.read() )
             #print('Read mean profiling time: %.2f, setting timeout 10x:  %.2f'%(timeout, timeout*20) )
             timeout = round(3 * proftime, 2)
+            # golden matches from the output of the first golden profiling trial, same as analysis.py
+            if stream_verify and generate:
+                goldendir = '%s/%s/%s/%s/%s/profile/%s/%s/1/'%(resdir, 'golden', config, wait, app, nthreads, inputsize)
+                verifier.capture(goldendir + 'output.txt', data.programs[config][app]['verify'][inputsize], basedir)
         else: # profile, look opportunistically for previous runs
             # get timeout
             profiledir = '%s/%s/%s/%s/%s/%s/%s/%s/%s/1/'%(resdir, tool, config, wait, app, 'profile', instrument, nthreads, inputsize)
@@ -72,10 +77,8 @@ def check(appdir, resdir, tool, config, wait, apps, action, instrument, nthreads
             if tool == 'pinfi' or tool == 'golden' or tool == 'pinfi-detach':
                 compiled = 'golden'
             elif tool == 'safire':
-                if instrument == 'omplib':
-                    compiled = 'golden'
-                else:
-                    compiled = 'safire'
+                # XXX: FI_DOMAINS selects app or omplib at run time
+                compiled = 'safire'
             elif tool == 'refine':
                 if instrument == 'omplib':
                     compiled = 'golden'
@@ -171,10 +174,9 @@ def generate_jobs(nodes, partition, timelimit, exps, config, wait, tool, action,
         #env += [ '-e', 'OMP_NUM_THREADS', nthreads, '-e', 'OMP_PROC_BIND', 'close', '-e', 'OMP_WAIT_POLICY', 'passive', '-e', 'KMP_AFFINITY', 'verbose' ]
         env += [ '-e', 'OMP_NUM_THREADS', nthreads, '-e', 'OMP_PROC_BIND', 'close', '-e', 'OMP_WAIT_POLICY', wait ]
     if tool == 'safire':
-        if instrument == 'all' or instrument == 'omplib':
-            env += [ '-e', 'LD_LIBRARY_PATH', homedir + '/usr/local/safire/lib:' + homedir + '/usr/local/lib' ]
-        else:
-            env += [ '-e', 'LD_LIBRARY_PATH', homedir + '/usr/local/lib' ]
+        env += [ '-e', 'LD_LIBRARY_PATH', homedir + '/usr/local/safire/lib:' + homedir + '/usr/local/lib' ]
+        if instrument in fi_tools.domains:
+            env += [ '-e', 'FI_DOMAINS', fi_tools.domains[instrument] ]
     if tool == 'refine':
         if instrument == 'all' or instrument == 'omplib':
             env += [ '-e', 'LD_LIBRARY_PATH', homedir + '/usr/local/refine/lib:' + homedir + '/usr/local/lib' ]
@@ -260,6 +262,7 @@ def main():
     parser.add_argument('-g', '--generate', help='generate moab jobscripts', default=False, action='store_true')
     parser.add_argument('-p', '--partition', help='partition to run experiments', choices=['echo', 'local', 'debug', 'batch' ], required=True)
     parser.add_argument('-w', '--wait', help='wait policy', choices=['passive', 'active'] )
+    parser.add_argument('-sv', '--stream-verify', help='verify FI trials against the golden output while they run, kill them on divergence', default=False, action='store_true')
     args = parser.parse_args()
 
     # Error checking
@@ -280,7 +283,7 @@ def main():
                 for i in config.data[t][c]['inputs']:
                     for ins in config.data[t][c]['instrument']:
                         for n in config.data[t][c][i][ins]['nthreads']:
-                            exps = check(args.appdir, args.resdir, t, c, w, args.apps, args.action, ins, n, i, args.start, args.end, args.generate)
+                            exps = check(args.appdir, args.resdir, t, c, w, args.apps, args.action, ins, n, i, args.start, args.end, args.generate, args.stream_verify)
                             if exps:
                                 print('==== EXPERIMENT ====')
                                 print( 'Experiment: %s %s %s %s %s %s %s %s %s [%s]'%( t, args.action, 
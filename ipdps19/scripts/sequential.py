@@ -0,0 +1,109 @@
+import os
+import re
+import numpy as np
+import scipy.stats as stats
+
+import data
+import fi_tools
+import verifier
+
+# Outcome classes of a FI trial, missing trials (no injection happened) are not samples
+outcomes = [ 'timeout', 'crash', 'soc', 'benign' ]
+
+# Wilson score interval for k successes in n trials
+def wilson(k, n, ci):
+    z = stats.norm.ppf(1-(1-ci)/2.0)
+    p = k / n
+    denom = 1 + z**2 / n
+    center = ( p + z**2 / ( 2 * n ) ) / denom
+    half = ( z * np.sqrt( p * ( 1 - p ) / n + z**2 / ( 4 * n**2 ) ) ) / denom
+    return max(0.0, center - half), min(1.0, center + half)
+
+# Clopper-Pearson (exact) interval for k successes in n trials
+def clopper_pearson(k, n, ci):
+    alpha = 1 - ci
+    lo = stats.beta.ppf(alpha/2.0, k, n - k + 1) if k > 0 else 0.0
+    hi = stats.beta.ppf(1 - alpha/2.0, k + 1, n - k) if k < n else 1.0
+    return lo, hi
+
+intervals = { 'wilson': wilson, 'clopper-pearson': clopper_pearson }
+
+# Verification strings of the golden output, same as analysis.py
+def golden_verify_list(goldenout, config, app, inputsize):
+    with open(goldenout, 'r') as f:
+        out = f.read()
+    verify_list = verifier.matches(out, data.programs[config][app]['verify'][inputsize])
+    assert any(verify_list), 'verify_list cannot be empty file: ' + goldenout + ', verify:' + ' '.join(data.programs[config][app]['verify'][inputsize])
+    return verify_list
+
+# Classify a finished trial, same as analysis.py. Returns None for a pending trial
+def classify(trialdir, tool, config, app, inputsize, verify_list):
+    if not os.path.isfile(trialdir + '/ret.txt'):
+        return None
+    with open(trialdir + '/ret.txt', 'r') as f:
+        res = f.read().strip().split(',')
+    # XXX: unreachable trials may have injected some of multiple faults
+    if not os.path.isfile(trialdir + '/' + fi_tools.files[tool]['injection']) or res[0] == 'unreachable':
+        return 'missing'
+    if res[0] == 'timeout':
+        return 'timeout'
+    elif res[0] == 'crash' or res[0] == 'error':
+        return 'crash'
+    elif res[0] == 'sdc':
+        return 'soc'
+    elif res[0] == 'exit' and verifier.outcome(trialdir):
+        # streaming verification, benign trials have no output.txt
+        return 'benign' if verifier.outcome(trialdir) == 'benign' else 'soc'
+    elif res[0] == 'exit':
+        with open(trialdir + '/output.txt', 'r') as f:
+            out = f.read()
+        verify_out = verifier.matches(out, data.programs[config][app]['verify'][inputsize])
+        return 'benign' if verifier.verify(verify_list, verify_out) else 'soc'
+    else:
+        print('Invalid result ' + tool + ' ' + app + ' ' + trialdir + ' :' + str(res[0]))
+        return None
+
+# Sequential sampling: stop once the CI margin of every outcome class is below the error
+class Sequential:
+    def __init__(self, error, ci, method, tool, config, app, inputsize, goldenout):
+        assert (error > 0) and (error < 1), 'Margin of error must be within (0...1)'
+        assert (ci > 0) and (ci < 1), 'CI must be within (0...1)'
+        self.error = error
+        self.ci = ci
+        self.interval = intervals[method]
+        self.tool = tool
+        self.config = config
+        self.app = app
+        self.inputsize = inputsize
+        self.verify_list = golden_verify_list(goldenout, config, app, inputsize)
+        self.counts = dict.fromkeys(outcomes + ['missing'], 0)
+
+    def update(self, trialdir):
+        outcome = classify(trialdir, self.tool, self.config, self.app, self.inputsize, self.verify_list)
+        if outcome:
+            self.counts[outcome] += 1
+
+    def nsamples(self):
+        return sum(self.counts[o] for o in outcomes)
+
+    def margins(self):
+        n = self.nsamples()
+        m = {}
+        for o in outcomes:
+            lo, hi = self.interval(self.counts[o], n, self.ci)
+            m[o] = (hi - lo) / 2.0
+        return m
+
+    def converged(self):
+        if self.nsamples() == 0:
+            return False
+        return all(m < self.error for m in self.margins().values())
+
+    def report(self, total, dispatched):
+        n = self.nsamples()
+        print('Sequential %s CI %.2f error %.4f: %d samples, %d missing'%( self.interval.__name__, self.ci, self.error, n, self.counts['missing'] ) )
+        if n > 0:
+            margins = self.margins()
+            for o in outcomes:
+                print('\t%-8s %5d (%3.2f%% +/- %3.2f%%)'%( o, self.counts[o], self.counts[o]*100.0/n, margins[o]*100.0 ) )
+        print('Trials saved %d / %d (%3.2f%%)'%( total - dispatched, total, ( total - dispatched )*100.0/total ) )
@@ -11,6 +11,8 @@ import time
 
 import data
 import fi_tools
+import sequential
+import footprint
 
 try:
     homedir = os.environ['HOME']
@@ -25,11 +27,13 @@ except:
     sys.exit(1)
 
 
-def srun(partition, ntasks, env, chunk):
+def srun(partition, ntasks, env, cgroup, chunk):
     runargs = []
     if env:
         for e in env:
             runargs += [ '-e', e[0], e[1] ]
+    if cgroup:
+        runargs += [ '-cg', str(cgroup) ]
     
     # XXX: cycle tasks (corresponding to SLURM_PROCID) to max utilization
     task = 0
@@ -77,24 +81,41 @@ def progress(t, total, completed, rate, unit, start, end):
 
     sys.stdout.flush()
 
-def get_chunk(it, chunksize):
+# Resource-aware packing: first fit of pending trials into a node until ntasks or any of the
+# memory (MB), bandwidth (GB/s), cpu (cores) budgets is full. Without budgets, the first ntasks trials
+def get_chunk(pending, chunksize, budget):
     chunk = []
-    for j in range(0, chunksize):
-        e = next(it, None)
-        if(e):
-            chunk.append(e)
+    used = { 'maxrss': 0.0, 'bw': 0.0, 'cpu': 0.0 }
+    i = 0
+    while i < len(pending) and len(chunk) < chunksize:
+        e = pending[i]
+        if budget:
+            fp = footprint.read(e[0])
+            # XXX: trials without a profiled footprint are packed as zero cost
+            if fp:
+                fits = all( ( budget[k] == None ) or ( used[k] + fp[k] <= budget[k] ) for k in used )
+                # XXX: a trial larger than the budget runs alone
+                if not fits and chunk:
+                    i += 1
+                    continue
+                for k in used:
+                    used[k] += fp[k]
+        chunk.append( pending.pop(i) )
     return chunk
 
-def run_batch(nodes, partition, ntasks, env, exps):
+def run_batch(nodes, partition, ntasks, env, cgroup, budget, exps, seq):
     jobs = []
-    it = iter(exps)
+    pending = list(exps)
     total = len(exps)
+    dispatched = 0
     completed = 0
+    converged = False
     for i in range(0, nodes):
-        chunk = get_chunk(it, ntasks)
+        chunk = get_chunk(pending, ntasks, budget)
         if chunk:
-            # append process and its chunksize to track progress
-            jobs.append( (srun(partition, ntasks, env, chunk), len(chunk)) )
+            # append process and its chunk to track progress
+            jobs.append( (srun(partition, ntasks, env, cgroup, chunk), chunk) )
+            dispatched += len(chunk)
             
     t = 1
     avg_rate = 0
@@ -106,18 +127,29 @@ def run_batch(nodes, partition, ntasks, env, exps):
             #print(jobs)
             #print('completed %s total %s'%(completed, total) )
             newjobs = []
-            for p, n in jobs:
+            for p, c in jobs:
                 ret = p.poll()
                 #print('ret %s'%(ret) )
                 if ret != None:
                     if ret != 0:
                         print('Error %s'%(ret) )
-                    completed += n
-                    chunk = get_chunk(it, ntasks)
+                    completed += len(c)
+                    # XXX: sequential sampling, stop dispatching once the outcome CIs converge
+                    if seq:
+                        for e in c:
+                            seq.update(e[0])
+                        if not converged and seq.converged():
+                            converged = True
+                            total = dispatched
+                            print('\nSequential sampling converged after %d trials'%( completed ) )
+                    if converged:
+                        continue
+                    chunk = get_chunk(pending, ntasks, budget)
                     if chunk:
-                        newjobs.append( (srun(partition, ntasks, env, chunk), len(chunk)) )
+                        newjobs.append( (srun(partition, ntasks, env, cgroup, chunk), chunk) )
+                        dispatched += len(chunk)
                 else:
-                    newjobs.append( (p, n) )
+                    newjobs.append( (p, c) )
 
             jobs = newjobs
 
@@ -136,18 +168,21 @@ def run_batch(nodes, partition, ntasks, env, exps):
                 avg_rate = 0.5 * ( ( completed - last_completed ) / win_t ) + 0.5 * avg_rate
                 last_completed = completed
     except KeyboardInterrupt:
-        for p, n in jobs:
+        for p, c in jobs:
             p.terminate()
             p.wait()
         sys.exit(1)
 
     progress(t, total, completed, (completed*60) / t, 'min', '', '\n')
     
-    for p, n in jobs:
+    for p, c in jobs:
         ret = p.wait()
         if ret != 0:
             print( 'Error %s in job'%(ret) )
 
+    if seq:
+        seq.report(len(exps), dispatched)
+
 
 def main():
     parser = argparse.ArgumentParser('Srun new script')
@@ -157,11 +192,29 @@ def main():
     parser.add_argument('-v', '--verbose', help='verbose', default=False, action='store_true') 
     parser.add_argument('-e', '--env', help='environment variables to set', nargs=2, action='append')
     parser.add_argument('-r', '--runlist', help='list to run', nargs=4, action='append', required=True)
+    parser.add_argument('-mb', '--membudget', help='pack trials per node within a memory budget (MB), uses footprint.txt', type=float)
+    parser.add_argument('-bb', '--bwbudget', help='pack trials per node within a memory bandwidth budget (GB/s), uses footprint.txt', type=float)
+    parser.add_argument('-cb', '--cpubudget', help='pack trials per node within a cpu budget (cores), uses footprint.txt', type=float)
+    parser.add_argument('-cg', '--cgroup', help='run each trial in a cgroup limiting memory to <factor> x its profiled peak RSS', type=float)
+    parser.add_argument('-sq', '--sequential', help='sequential sampling, stop when the CI margin of every outcome is < error: <error> <ci>', nargs=2, type=float)
+    parser.add_argument('-sm', '--seqmethod', help='CI method for sequential sampling', choices=['wilson', 'clopper-pearson'], default='wilson')
+    parser.add_argument('-sv', '--seqverify', help='classify trials for sequential sampling: <tool> <serial | omp> <app> <input> <golden output.txt>', nargs=5)
     args = parser.parse_args()
 
     # Error checking
     assert args.nodes > 0, 'Nodes arg must be > 0'
     assert args.tasks >= 0, 'Number of tasks must be >= 0'
+    if args.sequential:
+        assert args.seqverify, 'Sequential sampling needs --seqverify to classify trials'
+
+    budget = None
+    if args.membudget or args.bwbudget or args.cpubudget:
+        budget = { 'maxrss': args.membudget, 'bw': args.bwbudget, 'cpu': args.cpubudget }
+
+    seq = None
+    if args.sequential:
+        tool, config, app, inputsize, goldenout = args.seqverify
+        seq = sequential.Sequential(args.sequential[0], args.sequential[1], args.seqmethod, tool, config, app, inputsize, goldenout)
 
     exps = args.runlist
     #print("==== experiments ====")
@@ -169,7 +222,7 @@ def main():
     #print("==== end experiments ====")
     print('Nof exps: %d'%( len(exps) ) )
     if(exps):
-        run_batch(args.nodes, args.partition, args.tasks, args.env, exps)
+        run_batch(args.nodes, args.partition, args.tasks, args.env, args.cgroup, budget, exps, seq)
 
     print('\nExiting bye-bye')
     print('==== END EXPERIMENT ====')
@@ -0,0 +1,206 @@
+#!/usr/bin/env python3.6
+
+import os
+import sys
+import argparse
+import re
+import random
+import numpy as np
+import scipy.stats as stats
+
+import fi_tools
+import sequential
+
+# Stratified FI target sampling. Binaries compiled with -fi-ff -fi-sites write the static site map
+# <module>-fi-sites.txt at compile time and, profiled with FI_SITES=1, the dynamic site profile
+# fi-sites.txt, <rank>.fi-sites.txt per rank with the MPI runtimes, per thread with the OpenMP ones.
+# A target is the occurrence-th execution of instruction inst of site by a thread of a rank, the
+# runtime resolves it to the concrete fi_index, written to fi-inject.txt for reproduction
+
+# Parse the static site maps: site=0x..., inst=N, func=F, class=C, width=W, opcode=O, loc=L
+def parse_sites(fnames):
+    insts = []
+    for fname in fnames:
+        with open(fname, 'r') as f:
+            for l in f:
+                m = re.match('site=(0x[0-9a-fA-F]+), inst=(\d+), func=(.*), class=(\w+), width=(\d+), opcode=(\w+)', l)
+                assert m, 'Invalid site map line: ' + l
+                insts.append( { 'site': int(m[1], 16), 'inst': int(m[2]), 'func': m[3], 'class': m[4], 'width': m[5], 'opcode': m[6] } )
+    return insts
+
+# Parse the dynamic site profiles: [thread=T, ]site=0x..., insts=N, execs=N. The rank of
+# <rank>.fi-sites.txt, None for fi-sites.txt, the thread None without thread=,
+# execs: site -> { (rank, thread): execs }
+def parse_profile(fnames):
+    execs = {}
+    for fname in fnames:
+        m = re.match('(\d+)\.fi-sites\.txt$', os.path.basename(fname))
+        rank = int(m[1]) if m else None
+        with open(fname, 'r') as f:
+            for l in f:
+                m = re.match('(?:thread=(\d+), )?site=(0x[0-9a-fA-F]+), insts=(\d+), execs=(\d+)', l)
+                assert m, 'Invalid site profile line: ' + l
+                thread = int(m[1]) if m[1] else None
+                execs.setdefault( int(m[2], 16), {} )[ (rank, thread) ] = int(m[4])
+    ranks = { r for s in execs.values() for r, __ in s }
+    assert not ( None in ranks and len(ranks) > 1 ), 'Mixed ranked and unranked site profiles'
+    return execs
+
+def nonesort(key):
+    return tuple( -1 if k is None else k for k in key )
+
+# Build strata: key -> list of ((rank, thread), site, inst, execs), each static instruction executes
+# execs times in the thread
+def build_strata(insts, execs, by):
+    strata = {}
+    for i in insts:
+        for rt, n in sorted( execs.get(i['site'], {}).items(), key=lambda x: nonesort(x[0]) ):
+            if n == 0:
+                continue
+            strata.setdefault(i[by], []).append( ( rt, i['site'], i['inst'], n ) )
+    return strata
+
+# Split nsamples among strata, largest remainder rounding, at least 1 sample per stratum
+def allocate(weights, nsamples, alloc):
+    keys = sorted(weights)
+    assert nsamples >= len(keys), 'nsamples %d < number of strata %d'%( nsamples, len(keys) )
+    if alloc == 'equal':
+        quota = { k: nsamples / len(keys) for k in keys }
+    else: # proportional
+        quota = { k: nsamples * weights[k] for k in keys }
+    n = { k: max(1, int(quota[k])) for k in keys }
+    rem = sorted(keys, key=lambda k: quota[k] - int(quota[k]), reverse=True)
+    i = 0
+    while sum(n.values()) < nsamples:
+        n[ rem[i % len(rem)] ] += 1
+        i += 1
+    # XXX: the minimum of 1 may overshoot, take back from the largest strata
+    while sum(n.values()) > nsamples:
+        k = max(keys, key=lambda k: n[k])
+        n[k] -= 1
+    return n
+
+# Uniform over the dynamic instances of a stratum: pick a static instruction weighted by its
+# executions, then one of its executions
+def draw(stratum):
+    rt, site, inst, n = random.choices(stratum, weights=[ x[3] for x in stratum ])[0]
+    return rt, site, inst, random.randint(1, n)
+
+def sample(args):
+    insts = parse_sites(args.sites)
+    execs = parse_profile(args.profile)
+    strata = build_strata(insts, execs, args.by)
+    assert strata, 'No executed sites, check the site maps and the profile'
+
+    unmapped = [ s for s in execs if not s in { i['site'] for i in insts } ]
+    if unmapped:
+        print('WARNING: %d profiled sites missing from the site maps'%( len(unmapped) ))
+
+    counts = { k: sum( x[3] for x in v ) for k, v in strata.items() }
+    total = sum(counts.values())
+    weights = { k: counts[k] / total for k in counts }
+    n = allocate(weights, args.nsamples, args.alloc)
+    print('num_insts %d strata %d'%( total, len(strata) ))
+
+    if not os.path.exists(args.outdir):
+        os.makedirs(args.outdir)
+    with open(args.outdir + '/strata.txt', 'w') as f:
+        for k in sorted(strata):
+            print('\t%-24s weight %.6f nsamples %d'%( k, weights[k], n[k] ))
+            f.write('stratum=%s, weight=%.17g, nsamples=%d\n'%( k, weights[k], n[k] ))
+
+    trial = args.start
+    for k in sorted(strata):
+        for __ in range(0, n[k]):
+            trialdir = '%s/%d/'%( args.outdir, trial )
+            if not os.path.exists(trialdir):
+                os.makedirs(trialdir)
+            (rank, thread), site, inst, occurrence = draw(strata[k])
+            with open(trialdir + fi_tools.files[args.tool]['target'], 'w') as f:
+                prefix = ( 'rank=%d, '%( rank ) if rank is not None else '' )
+                prefix += ( 'thread=%d, '%( thread ) if thread is not None else '' )
+                f.write(prefix + 'site=0x%016x, inst=%d, occurrence=%d\n'%( site, inst, occurrence ))
+            with open(trialdir + 'stratum.txt', 'w') as f:
+                f.write('%s\n'%( k ))
+            trial += 1
+
+    print('Generated trials %d...%d'%( args.start, trial - 1 ))
+
+# Re-weight the per stratum outcome proportions with the stratum weights
+def estimate(args):
+    weights = {}
+    with open(args.outdir + '/strata.txt', 'r') as f:
+        for l in f:
+            m = re.match('stratum=(.*), weight=([^,]+), nsamples=(\d+)', l)
+            weights[ m[1] ] = float(m[2])
+
+    tool, config, app, inputsize, goldenout = args.seqverify
+    verify_list = sequential.golden_verify_list(goldenout, config, app, inputsize)
+
+    counts = { k: dict.fromkeys(sequential.outcomes + ['missing'], 0) for k in weights }
+    for d in os.listdir(args.outdir):
+        trialdir = args.outdir + '/' + d
+        if not os.path.isfile(trialdir + '/stratum.txt'):
+            continue
+        with open(trialdir + '/stratum.txt', 'r') as f:
+            k = f.read().strip()
+        outcome = sequential.classify(trialdir, tool, config, app, inputsize, verify_list)
+        if outcome:
+            counts[k][outcome] += 1
+
+    z = stats.norm.ppf(1 - (1 - args.ci) / 2.0)
+    covered = sum( weights[k] for k in weights if sum( counts[k][o] for o in sequential.outcomes ) > 0 )
+    if covered < 1.0:
+        print('WARNING: strata without samples, weight %.4f is not covered'%( 1.0 - covered ))
+
+    print('%-24s %8s '%( 'stratum', 'weight' ) + ' '.join( '%8s'%( o ) for o in sequential.outcomes ))
+    for k in sorted(weights):
+        n = sum( counts[k][o] for o in sequential.outcomes )
+        if n > 0:
+            print('%-24s %8.4f '%( k, weights[k] ) + ' '.join( '%7.2f%%'%( counts[k][o] * 100.0 / n ) for o in sequential.outcomes ))
+
+    print('Stratified estimate CI %.2f'%( args.ci ))
+    for o in sequential.outcomes:
+        p = 0.0
+        var = 0.0
+        for k in weights:
+            n = sum( counts[k][o2] for o2 in sequential.outcomes )
+            if n == 0:
+                continue
+            p_h = counts[k][o] / n
+            # XXX: re-normalize on the covered weight
+            w_h = weights[k] / covered
+            p += w_h * p_h
+            var += w_h**2 * p_h * ( 1 - p_h ) / n
+        print('\t%-8s %3.2f%% +/- %3.2f%%'%( o, p * 100.0, z * np.sqrt(var) * 100.0 ))
+
+def main():
+    parser = argparse.ArgumentParser('Stratified FI target sampling by static site')
+    subparsers = parser.add_subparsers(dest='action')
+    parser_sample = subparsers.add_parser('sample', help='generate stratified FI targets')
+    parser_sample.add_argument('-t', '--tool', help='tool to run', choices=['safire', 'refine'], required=True)
+    parser_sample.add_argument('-s', '--sites', help='static site maps, <module>-fi-sites.txt', nargs='+', required=True)
+    parser_sample.add_argument('-p', '--profile', help='site profiles, fi-sites.txt or <rank>.fi-sites.txt of every rank', nargs='+', required=True)
+    parser_sample.add_argument('-b', '--by', help='stratify by', choices=['func', 'class', 'width', 'opcode'], required=True)
+    parser_sample.add_argument('-n', '--nsamples', help='number of FI samples', type=int, required=True)
+    parser_sample.add_argument('-al', '--alloc', help='allocation of samples to strata', choices=['proportional', 'equal'], default='proportional')
+    parser_sample.add_argument('-o', '--outdir', help='output directory of trials', required=True)
+    parser_sample.add_argument('-st', '--start', help='first trial number', type=int, default=1)
+    parser_estimate = subparsers.add_parser('estimate', help='re-weight outcomes of stratified trials')
+    parser_estimate.add_argument('-o', '--outdir', help='directory of trials', required=True)
+    parser_estimate.add_argument('-ci', '--ci', help='confidence interval', type=float, default=0.95)
+    parser_estimate.add_argument('-sv', '--seqverify', help='classify trials: <tool> <serial | omp> <app> <input> <golden output.txt>', nargs=5, required=True)
+    args = parser.parse_args()
+
+    if args.action == 'sample':
+        assert args.nsamples > 0, 'Number of FI samples must be > 0'
+        sample(args)
+    elif args.action == 'estimate':
+        assert (args.ci > 0) and (args.ci < 1), 'CI must be within (0...1)'
+        estimate(args)
+    else:
+        parser.print_help()
+        sys.exit(1)
+
+if __name__ == "__main__":
+    main()
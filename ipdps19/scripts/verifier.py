@@ -0,0 +1,114 @@
+import os
+import re
+import json
+
+# Verification of FI trials against the golden matches of the verify patterns (data.py). The k-th match
+# of each pattern must equal the k-th golden match, extra matches of a trial are ignored. Values that
+# parse as numbers are compared as numbers, 1.0e-3 equals 0.001, others as text. analysis.py and the
+# other result scripts use matches() and verify() after the trial, run.py pipes the trial's stdout
+# through a StreamVerifier with the same rules and kills the trial on the first line that diverges.
+# Patterns may span up to two lines, a match is checked once the line after its end is read (or at
+# EOF) since the latest line may still extend it, e.g., trailing \s+ or FLOAT digits
+
+fname = 'verify.json'
+outcome_fname = 'verify.txt'
+
+def _value(m):
+    # same as re.findall
+    if m.re.groups == 0:
+        return m.group(0)
+    if m.re.groups == 1:
+        return m.group(1)
+    return list(m.groups())
+
+def _same(a, b):
+    if isinstance(a, list):
+        return isinstance(b, list) and len(a) == len(b) and all( _same(x, y) for x, y in zip(a, b) )
+    try:
+        return float(a) == float(b)
+    except ValueError:
+        return a == b
+
+# Matches of each pattern in text, a list per pattern
+def matches(text, patterns):
+    return [ [ _value(m) for m in re.finditer(p, text) ] for p in patterns ]
+
+# True if the matches of a trial verify against the golden matches
+def verify(golden, out):
+    return all( len(o) >= len(g) and all( _same(x, y) for x, y in zip(g, o) ) for g, o in zip(golden, out) )
+
+# Capture the golden matches of a golden output into <basedir>/verify.json, once per campaign
+def capture(golden_output, patterns, basedir):
+    vfname = '%s/%s'%(basedir, fname)
+    if os.path.isfile(vfname):
+        return
+    with open(golden_output, 'r') as f:
+        text = f.read()
+    golden = [ [ p, g ] for p, g in zip(patterns, matches(text, patterns)) ]
+    assert any( g for p, g in golden ), 'No golden match in ' + golden_output + ', verify:' + ' '.join(patterns)
+    if not os.path.exists(basedir):
+        os.makedirs(basedir)
+    with open(vfname, 'w') as f:
+        json.dump(golden, f)
+
+# The golden matches of a trial's campaign, None without streaming verification
+def read(trialdir):
+    vfname = '%s/../%s'%(trialdir, fname)
+    if not os.path.isfile(vfname):
+        return None
+    with open(vfname, 'r') as f:
+        return json.load(f)
+
+class StreamVerifier:
+    def __init__(self, golden):
+        self.patterns = [ re.compile(p) for p, g in golden ]
+        self.golden = [ g for p, g in golden ]
+        self.count = [0] * len(golden)
+        # scan offsets per pattern, absolute in the stream, buf starts at base
+        self.pos = [0] * len(golden)
+        self.buf = ''
+        self.base = 0
+        # start offsets of the previous and the latest line
+        self.starts = [0, 0]
+        self.lineno = 0
+
+    # Returns False if the output diverged from golden
+    def feed(self, line):
+        self.lineno += 1
+        self.starts = [ self.starts[1], self.base + len(self.buf) ]
+        self.buf += line
+        return self._scan(self.starts[1], self.starts[0])
+
+    # At EOF, returns False if the output diverged or misses golden matches
+    def finish(self):
+        end = self.base + len(self.buf)
+        if not self._scan(end, end):
+            return False
+        return all( c >= len(g) for c, g in zip(self.count, self.golden) )
+
+    # Check the matches ending before limit, keep scanning from the line starting at keep
+    def _scan(self, limit, keep):
+        for i, r in enumerate(self.patterns):
+            for m in r.finditer(self.buf, self.pos[i] - self.base):
+                if self.base + m.end() > limit:
+                    break
+                c = self.count[i]
+                if c < len(self.golden[i]) and not _same(self.golden[i][c], _value(m)):
+                    return False
+                self.count[i] += 1
+                self.pos[i] = self.base + m.end()
+            self.pos[i] = max(self.pos[i], keep)
+
+        drop = min(self.pos) - self.base
+        if drop > 0:
+            self.buf = self.buf[drop:]
+            self.base += drop
+        return True
+
+# Outcome of a trial that exited under streaming verification: benign or sdc, None if not verified
+def outcome(trialdir):
+    try:
+        with open(trialdir + '/' + outcome_fname, 'r') as f:
+            return f.read().strip().split(',')[0]
+    except FileNotFoundError:
+        return None
@@ -0,0 +1,161 @@
+#define _GNU_SOURCE
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <inttypes.h>
+#include <string.h>
+#include <assert.h>
+#include <link.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include "fi_domains.h"
+
+// XXX: Domains are only appended, readers scan the first ndomains entries without the lock
+static struct {
+    uintptr_t lo, hi;
+    char name[64];
+    int selected;
+} domains[FI_MAX_DOMAINS];
+static atomic_int ndomains = 0;
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+
+#define FI_MAX_SELECT 16
+static char select_names[FI_MAX_SELECT][64];
+static int nselect = 0;
+static int select_all = 0;
+
+// Per thread cache of the last domain, consecutive blocks are mostly in the same DSO
+static __thread uintptr_t cache_lo = 0, cache_hi = 0;
+static __thread int cache_d = -1;
+
+struct find_arg {
+    uintptr_t addr;
+    uintptr_t lo, hi;
+    const char *name;
+};
+
+// Find the executable PT_LOAD segment holding addr
+static int find_segment(struct dl_phdr_info *info, size_t size, void *data)
+{
+    (void)size;
+    struct find_arg *arg = data;
+    int i;
+    for(i = 0; i < info->dlpi_phnum; i++) {
+        const ElfW(Phdr) *ph = &info->dlpi_phdr[i];
+        if(ph->p_type != PT_LOAD || !( ph->p_flags & PF_X ))
+            continue;
+        uintptr_t lo = info->dlpi_addr + ph->p_vaddr;
+        uintptr_t hi = lo + ph->p_memsz;
+        if(arg->addr >= lo && arg->addr < hi) {
+            arg->lo = lo;
+            arg->hi = hi;
+            arg->name = info->dlpi_name;
+            return 1;
+        }
+    }
+    return 0;
+}
+
+int fi_domains_init(void)
+{
+    const char *s = getenv("FI_DOMAINS");
+    if(s == NULL)
+        return 0;
+
+    char buf[1024];
+    strncpy(buf, s, sizeof(buf) - 1);
+    buf[sizeof(buf) - 1] = '\0';
+    char *save, *tok;
+    for(tok = strtok_r(buf, ",", &save); tok; tok = strtok_r(NULL, ",", &save)) {
+        if(strcmp(tok, "all") == 0) {
+            select_all = 1;
+            continue;
+        }
+        assert(nselect < FI_MAX_SELECT && "Too many FI_DOMAINS names\n");
+        strncpy(select_names[nselect], tok, sizeof(select_names[0]) - 1);
+        nselect++;
+    }
+    assert( ( select_all || nselect > 0 ) && "FI_DOMAINS selects no domain\n");
+    return 1;
+}
+
+static int is_selected(const char *name)
+{
+    if(select_all)
+        return 1;
+    int i;
+    for(i = 0; i < nselect; i++)
+        if(strncmp(name, select_names[i], strlen(select_names[i])) == 0)
+            return 1;
+    return 0;
+}
+
+static int search(uintptr_t addr, int n)
+{
+    int d;
+    for(d = 0; d < n; d++)
+        if(addr >= domains[d].lo && addr < domains[d].hi)
+            return d;
+    return -1;
+}
+
+int fi_domain_lookup(const void *addr)
+{
+    uintptr_t a = (uintptr_t)addr;
+    if(a >= cache_lo && a < cache_hi)
+        return cache_d;
+
+    int d = search(a, atomic_load_explicit(&ndomains, memory_order_acquire));
+    if(d < 0) {
+        pthread_mutex_lock(&lock);
+        int n = atomic_load_explicit(&ndomains, memory_order_relaxed);
+        d = search(a, n);
+        if(d < 0) {
+            struct find_arg arg = { a, 0, 0, NULL };
+            int found = dl_iterate_phdr(find_segment, &arg);
+            assert(found && "selMBB called from outside any DSO\n");
+            assert(n < FI_MAX_DOMAINS && "Too many domains, FI_MAX_DOMAINS\n");
+
+            // XXX: the executable has an empty name
+            const char *name = "app";
+            if(arg.name && arg.name[0]) {
+                const char *base = strrchr(arg.name, '/');
+                name = base ? base + 1 : arg.name;
+            }
+            d = n;
+            domains[d].lo = arg.lo;
+            domains[d].hi = arg.hi;
+            strncpy(domains[d].name, name, sizeof(domains[d].name) - 1);
+            domains[d].selected = is_selected(domains[d].name);
+            atomic_store_explicit(&ndomains, n + 1, memory_order_release);
+        }
+        pthread_mutex_unlock(&lock);
+    }
+
+    cache_lo = domains[d].lo;
+    cache_hi = domains[d].hi;
+    cache_d = d;
+    return d;
+}
+
+int fi_domain_selected(int d)
+{
+    return domains[d].selected;
+}
+
+void fi_domains_write(int rank, int nthreads, const uint64_t *count, unsigned stride)
+{
+    char fname[64];
+    if(rank >= 0)
+        snprintf(fname, sizeof(fname), "%d.%s", rank, FI_DOMAINS_FNAME);
+    else
+        snprintf(fname, sizeof(fname), "%s", FI_DOMAINS_FNAME);
+    FILE *fp = fopen(fname, "w");
+    assert(fp != NULL && "Error opening domains file\n");
+    int n = atomic_load(&ndomains);
+    int t, d;
+    for(t = 0; t < nthreads; t++)
+        for(d = 0; d < n; d++)
+            fprintf(fp, "thread=%d, domain=%s, fi_index=%"PRIu64"\n", t, domains[d].name, count[t * stride + d]);
+    fclose(fp);
+}
@@ -0,0 +1,27 @@
+#ifndef _FI_DOMAINS_H
+#define _FI_DOMAINS_H
+
+#include <stdint.h>
+
+/* Per DSO counter domains. Every instrumented DSO is a domain, named by the basename of its file,
+ * "app" for the executable. A DSO registers its domain on the first selMBB call from its text,
+ * found by the return address. FI_DOMAINS=<name,...> restricts counting and FI to a union of
+ * domains, a name selects the domains it prefixes (e.g., libomp), "all" selects all. Profiling with
+ * FI_DOMAINS writes the per (thread, domain) counts of every domain to FI_DOMAINS_FNAME */
+#define FI_DOMAINS_FNAME "fi-domains.txt"
+#define FI_MAX_DOMAINS 16
+
+/* returns non-zero if FI_DOMAINS is set, parses the selection */
+int fi_domains_init(void);
+
+/* returns the domain of the DSO holding addr, registers it on first use */
+int fi_domain_lookup(const void *addr);
+
+/* returns non-zero if domain d is selected by FI_DOMAINS */
+int fi_domain_selected(int d);
+
+/* writes thread=<t>, domain=<name>, fi_index=<n> lines, count[t * stride + d] for nthreads threads.
+ * A rank >= 0 writes <rank>.FI_DOMAINS_FNAME, as the per rank fi-inscount.txt */
+void fi_domains_write(int rank, int nthreads, const uint64_t *count, unsigned stride);
+
+#endif
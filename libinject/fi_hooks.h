@@ -0,0 +1,23 @@
+#ifndef _FI_HOOKS_H
+#define _FI_HOOKS_H
+
+#include <stdint.h>
+
+/* Hook ABI v2 of the SAFIRE instrumentation. Decisions are returned in RAX, the caller tests them in
+ * registers. site is the static site ID of the MBB (FF only, 0 otherwise), inst the index of the target
+ * instruction in the MBB from 1, the site=, inst= of the -fi-sites map. size points to a static table of
+ * the op sizes in bytes. Instrumented code references safire_hook_abi_v2, every v2 runtime defines it, so
+ * a v2 binary fails at link or load time against a runtime of the earlier ABI */
+#define FI_HOOK_ABI_VERSION 2
+
+// XXX: No need to __attribute__((preserve_all )) caller site saves needed registers
+/* returns INSTRUMENT_BB, INSTRUMENT_INST or INSTRUMENT_DETACH */
+uint64_t selMBB(uint64_t num_insts, uint64_t site);
+/* returns 1 to inject after the instruction, 0 otherwise */
+uint64_t selInst(uint64_t site, uint64_t inst);
+/* fills bitmask, returns the op to inject, 0..num_ops-1 */
+uint64_t doInject(uint64_t num_ops, const uint64_t *size, uint8_t *bitmask);
+
+extern const int safire_hook_abi_v2;
+
+#endif
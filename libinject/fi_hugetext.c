@@ -0,0 +1,181 @@
+#define _GNU_SOURCE
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <assert.h>
+#include <link.h>
+#include <sys/mman.h>
+#include "fi_hugetext.h"
+
+#define FI_MAX_SEGMENTS 16
+#define ALIGN_DOWN(x) ( (x) & ~( FI_HUGE_PAGE_SIZE - 1 ) )
+#define ALIGN_UP(x) ALIGN_DOWN( (x) + FI_HUGE_PAGE_SIZE - 1 )
+
+static struct {
+    uintptr_t lo, hi;
+    char name[64];
+} segments[FI_MAX_SEGMENTS];
+static int nsegments = 0;
+
+#define FI_MAX_SELECT 16
+static char select_names[FI_MAX_SELECT][64];
+static int nselect = 0;
+static int select_all = 0;
+
+static int is_selected(const char *name)
+{
+    if(select_all)
+        return 1;
+    int i;
+    for(i = 0; i < nselect; i++)
+        if(strncmp(name, select_names[i], strlen(select_names[i])) == 0)
+            return 1;
+    return 0;
+}
+
+// Collect the readable, executable PT_LOAD segments of the selected modules
+static int find_text(struct dl_phdr_info *info, size_t size, void *data)
+{
+    (void)size;
+    (void)data;
+    // XXX: the executable has an empty name, as in fi_domains.c
+    const char *name = "app";
+    if(info->dlpi_name && info->dlpi_name[0]) {
+        const char *base = strrchr(info->dlpi_name, '/');
+        name = base ? base + 1 : info->dlpi_name;
+    }
+    // XXX: The vDSO is a kernel mapping, leave it alone
+    if(!is_selected(name) || strncmp(name, "linux-vdso", 10) == 0)
+        return 0;
+
+    int i;
+    for(i = 0; i < info->dlpi_phnum; i++) {
+        const ElfW(Phdr) *ph = &info->dlpi_phdr[i];
+        if(ph->p_type != PT_LOAD || !( ph->p_flags & PF_X ) || !( ph->p_flags & PF_R ))
+            continue;
+        assert(nsegments < FI_MAX_SEGMENTS && "Too many text segments, FI_MAX_SEGMENTS\n");
+        segments[nsegments].lo = info->dlpi_addr + ph->p_vaddr;
+        segments[nsegments].hi = segments[nsegments].lo + ph->p_memsz;
+        strncpy(segments[nsegments].name, name, sizeof(segments[0].name) - 1);
+        nsegments++;
+    }
+    return 0;
+}
+
+// THP in always or madvise mode, MADV_HUGEPAGE is a no-op with never
+static int thp_enabled(void)
+{
+    char buf[128] = "";
+    FILE *fp = fopen("/sys/kernel/mm/transparent_hugepage/enabled", "r");
+    if(!fp)
+        return 0;
+    if(!fgets(buf, sizeof(buf), fp))
+        buf[0] = '\0';
+    fclose(fp);
+    return strstr(buf, "[never]") == NULL && buf[0] != '\0';
+}
+
+// AnonHugePages of the mapping at start in kB, -1 if not found
+static long huge_kb(uintptr_t start)
+{
+    FILE *fp = fopen("/proc/self/smaps", "r");
+    if(!fp)
+        return -1;
+    char line[512], prefix[32];
+    snprintf(prefix, sizeof(prefix), "%lx-", (unsigned long)start);
+    long kb = -1;
+    int found = 0;
+    while(fgets(line, sizeof(line), fp)) {
+        if(!found)
+            found = ( strncmp(line, prefix, strlen(prefix)) == 0 );
+        else if(sscanf(line, "AnonHugePages: %ld kB", &kb) == 1)
+            break;
+    }
+    fclose(fp);
+    return kb;
+}
+
+// Copy [start, start+len) to a 2 MB aligned anonymous mapping advised for huge pages and move it over
+// the original text. mremap replaces the text atomically, code running in it, including this
+// function when linked statically, sees the same instructions at the same addresses. Returns 0 or errno
+static int remap(uintptr_t start, size_t len)
+{
+    char *raw = mmap(NULL, len + FI_HUGE_PAGE_SIZE, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if(raw == MAP_FAILED)
+        return errno;
+    // XXX: aligned so the pages fault in huge and mremap moves whole PMDs
+    char *tmp = (char *)ALIGN_UP((uintptr_t)raw);
+    if(tmp > raw)
+        munmap(raw, tmp - raw);
+    if(raw + FI_HUGE_PAGE_SIZE > tmp)
+        munmap(tmp + len, raw + FI_HUGE_PAGE_SIZE - tmp);
+
+    int err = 0;
+    if(madvise(tmp, len, MADV_HUGEPAGE) != 0)
+        err = errno;
+    else {
+        memcpy(tmp, (void *)start, len);
+        if(mprotect(tmp, len, PROT_READ | PROT_EXEC) != 0)
+            err = errno;
+        else if(mremap(tmp, len, len, MREMAP_MAYMOVE | MREMAP_FIXED, (void *)start) == MAP_FAILED)
+            err = errno;
+        else
+            return 0;
+    }
+    munmap(tmp, len);
+    return err;
+}
+
+size_t fi_hugetext_init(void)
+{
+    const char *s = getenv("FI_HUGETEXT");
+    if(s == NULL)
+        return 0;
+
+    char buf[1024];
+    strncpy(buf, s, sizeof(buf) - 1);
+    buf[sizeof(buf) - 1] = '\0';
+    char *save, *tok;
+    for(tok = strtok_r(buf, ",", &save); tok; tok = strtok_r(NULL, ",", &save)) {
+        if(strcmp(tok, "all") == 0) {
+            select_all = 1;
+            continue;
+        }
+        assert(nselect < FI_MAX_SELECT && "Too many FI_HUGETEXT names\n");
+        strncpy(select_names[nselect], tok, sizeof(select_names[0]) - 1);
+        nselect++;
+    }
+
+    FILE *fp = fopen(FI_HUGETEXT_FNAME, "w");
+    assert(fp != NULL && "Error opening hugetext file\n");
+    if(!thp_enabled()) {
+        fprintf(fp, "thp=never\n");
+        fclose(fp);
+        return 0;
+    }
+
+    dl_iterate_phdr(find_text, NULL);
+    size_t total = 0;
+    int i;
+    for(i = 0; i < nsegments; i++) {
+        uintptr_t start = ALIGN_UP(segments[i].lo);
+        uintptr_t end = ALIGN_DOWN(segments[i].hi);
+        fprintf(fp, "module=%s, text=0x%lx-0x%lx, ", segments[i].name, (unsigned long)segments[i].lo, (unsigned long)segments[i].hi);
+        // XXX: No whole huge page inside the segment, too small or not aligned by the linker
+        if(end <= start) {
+            fprintf(fp, "remapped=0\n");
+            continue;
+        }
+        int err = remap(start, end - start);
+        if(err) {
+            fprintf(fp, "remapped=0, error=%s\n", strerror(err));
+            continue;
+        }
+        total += end - start;
+        fprintf(fp, "remapped=%lu, huge_kb=%ld\n", (unsigned long)( end - start ), huge_kb(start));
+    }
+    fclose(fp);
+    return total;
+}
@@ -0,0 +1,19 @@
+#ifndef _FI_HUGETEXT_H
+#define _FI_HUGETEXT_H
+
+#include <stddef.h>
+
+/* Huge page text. -fi-ff roughly triples the text (original, clone and per-instruction copies), which
+ * misses in the iTLB where golden binaries do not. FI_HUGETEXT=<name,...> remaps the text segments of
+ * the selected modules, named as FI_DOMAINS (app for the executable, a prefix of a DSO basename, all),
+ * onto anonymous memory advised for transparent huge pages. Only the 2 MB aligned part of a segment is
+ * remapped, link with -z max-page-size=0x200000 to align the start of the text. Text keeps its
+ * addresses and contents, the remap is skipped if THP is disabled or a step fails. Writes a line per
+ * segment to FI_HUGETEXT_FNAME */
+#define FI_HUGETEXT_FNAME "fi-hugetext.txt"
+#define FI_HUGE_PAGE_SIZE ( 2UL << 20 )
+
+/* remaps the selected text if FI_HUGETEXT is set, returns the bytes remapped */
+size_t fi_hugetext_init(void);
+
+#endif
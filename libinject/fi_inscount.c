@@ -0,0 +1,46 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <assert.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include "fi_inscount.h"
+
+int fi_inscount_binary(void)
+{
+    const char *fmt = getenv("FI_INSCOUNT_FORMAT");
+    return ( fmt != NULL && strcmp(fmt, "binary") == 0 );
+}
+
+void fi_inscount_write(int rank, int nranks, unsigned nthreads, const uint64_t *count, unsigned stride)
+{
+    fi_inscount_rec_t rec;
+    unsigned i;
+
+    assert(rank >= 0 && "rank < 0\n");
+    assert(nthreads <= FI_INSCOUNT_THREADS && "nthreads > FI_INSCOUNT_THREADS\n");
+
+    memset(&rec, 0, sizeof(rec));
+    rec.magic = FI_INSCOUNT_MAGIC;
+    rec.nthreads = nthreads;
+    // XXX: stride in uint64_t words, per-thread counters are padded to a cache line
+    for(i=0; i<nthreads; i++)
+        rec.count[i] = count[i*stride];
+
+    // XXX: No locking needed, every rank owns a disjoint range of the file. MPI-IO is not an option,
+    // fini() runs as a destructor after MPI_Finalize
+    int fd = open(FI_INSCOUNT_BIN_FNAME, O_WRONLY | O_CREAT, 0644);
+    assert(fd >= 0 && "Error opening binary inscount file\n");
+    ssize_t ret = pwrite(fd, &rec, sizeof(rec), (off_t)rank * sizeof(rec));
+    assert(ret == sizeof(rec) && "Error writing binary inscount record\n");
+    // XXX: Drop the records of an earlier profile with more ranks. Records of this run are below the size,
+    // the truncation keeps them whenever the other ranks write
+    if(rank == 0 && nranks > 0) {
+        int tret = ftruncate(fd, (off_t)nranks * sizeof(rec));
+        assert(tret == 0 && "Error sizing binary inscount file\n");
+        (void)tret;
+    }
+    close(fd);
+}
@@ -0,0 +1,27 @@
+#ifndef _FI_INSCOUNT_H
+#define _FI_INSCOUNT_H
+
+#include <stdint.h>
+
+/* Binary profile of multi-process runs: one fixed-size record per rank, stored at
+ * offset rank * sizeof(fi_inscount_rec_t) of a single shared file. Ranks that did
+ * not write their record leave a zero-filled hole, thus magic != FI_INSCOUNT_MAGIC */
+#define FI_INSCOUNT_MAGIC UINT32_C(0x46494943) /* "FIIC" */
+#define FI_INSCOUNT_THREADS 256
+
+#define FI_INSCOUNT_BIN_FNAME "fi-inscount.bin"
+
+typedef struct {
+    uint32_t magic;
+    uint32_t nthreads;
+    uint64_t count[FI_INSCOUNT_THREADS];
+} fi_inscount_rec_t;
+
+/* returns non-zero if the binary profile is requested, FI_INSCOUNT_FORMAT=binary */
+int fi_inscount_binary(void);
+
+/* writes the counts of nthreads threads as the record of rank. Rank 0 sizes the file to nranks
+ * records, nranks <= 0 if unknown */
+void fi_inscount_write(int rank, int nranks, unsigned nthreads, const uint64_t *count, unsigned stride);
+
+#endif
@@ -0,0 +1,1082 @@
+// FI runtime built from policies, one instantiation per libinject_*.so (see libinject.cpp and
+// CMakeLists.txt). A runtime is Threading x Launcher x Counting x Faults:
+//   Threading  Serial | OpenMP       thread of a target, logical IDs of fi_thread.h
+//   Launcher   Single | Mpi          rank of a target, prefix rank=R of the files
+//   Counting   Blocks | Insts        selMBB per MBB with -fi-ff, selInst per instruction without
+//   Faults     SingleFault | MultiFault | BitDistFault
+//   Stats      NoStats | HookStats   hook call counts, cycles and phase timestamps (FI_STATS)
+// Policy members are constexpr, the hooks are specialized at compile time. The action of the run
+// (profiling, random or reproduced injection) is encoded in the per-thread next target: profiling
+// never reaches FI_NEVER, a thread without pending targets has 0 and detaches
+//
+// File formats, per run directory:
+//   fi-target.txt    [rank=R, ][thread=T, ]fi_index=N, one line per fault
+//                    [rank=R, ][thread=T, ]site=<hex>, inst=I, occurrence=O, stratified target (Blocks)
+//                    [rank=R, ][thread=T, ]time=S, time target of CPU seconds of the thread (Blocks)
+//   fi-inject.txt    [rank=R, ][thread=T, ]fi_index=N, op=O, size=S, bitflip=B, in firing order
+//   fi-inscount.txt  [thread=T, fi_index=N lines, ]fi_index=SUM, <rank>.fi-inscount.txt with Mpi:
+//                    thread=T, fi_index=N lines with OpenMP, N alone without, or fi-inscount.bin
+//   fi-bitdist.txt   bit=B, weight=W, bit distribution of BitDistFault, uniform without it
+//   fi-stats.json    HookStats record written at fini, <rank>.fi-stats.json with Mpi
+//   fi-sites.txt, fi-domains.txt, fi-trace.<T>.bin
+//                    profiles of FI_SITES, FI_DOMAINS and FI_TRACE (Blocks), prefixed <rank>. with Mpi
+
+#ifndef _FI_RUNTIME_H
+#define _FI_RUNTIME_H
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstdint>
+#include <cinttypes>
+#include <cstring>
+#include <cassert>
+#include <ctime>
+#include <atomic>
+#include <pthread.h>
+#include <x86intrin.h>
+#include <csignal>
+#include <unistd.h>
+#include <sys/syscall.h>
+
+extern "C" {
+#include "mt64.h"
+#include "fi_hooks.h"
+#include "fi_domains.h"
+#include "fi_hugetext.h"
+#include "fi_inscount.h"
+#include "fi_sites.h"
+#include "fi_thread.h"
+#include "fi_trace.h"
+}
+
+namespace fi {
+
+enum : uint64_t {
+    INSTRUMENT_BB=0,
+    INSTRUMENT_INST=1,
+    INSTRUMENT_DETACH=2
+};
+
+enum Action {
+    DO_PROFILING,
+    DO_REPRODUCTION,
+    DO_RANDOM
+};
+
+// Next target of profiling runs, counted blocks never reach it
+static constexpr uint64_t FI_NEVER = UINT64_MAX;
+
+// CPU timer of a time target: armed on the first block of its thread, fired by the signal handler,
+// done once the next block of the thread sets the target to its next instruction
+enum Timer {
+    TIMER_NONE,
+    TIMER_PENDING,
+    TIMER_ARMED,
+    TIMER_FIRED,
+    TIMER_DONE
+};
+
+// XXX: glibc < 2.35 does not name the thread of SIGEV_THREAD_ID
+#if defined(SIGEV_THREAD_ID) && !defined(sigev_notify_thread_id)
+#define sigev_notify_thread_id _sigev_un._tid
+#endif
+
+// XXX: glibc reserves the first real-time signals, the OpenMP and MPI runtimes use none of these
+static inline int time_signal() { return SIGRTMIN + 4; }
+
+// Wall clock, the same as run.py's timestamps.txt
+static inline double now()
+{
+    struct timespec ts;
+    timespec_get(&ts, TIME_UTC);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+/* ================================================ Threading ================================================ */
+
+struct Serial {
+    static constexpr bool kThreaded = false;
+    static constexpr int kMaxThreads = 1;
+    static inline int id() { return 0; }
+    static inline int count() { return 1; }
+    static inline void on_thread_exit(void (*fn)(int)) { (void)fn; }
+};
+
+struct OpenMP {
+    static constexpr bool kThreaded = true;
+    static constexpr int kMaxThreads = FI_THREAD_MAX;
+    // XXX: -1 while the lookup runs blocks of an instrumented OpenMP runtime
+    static inline int id() { return fi_thread_id(); }
+    static inline int count() { return fi_thread_count(); }
+    static inline void on_thread_exit(void (*fn)(int)) { fi_thread_on_exit(fn); }
+};
+
+/* ================================================ Launcher ================================================= */
+
+struct Single {
+    static constexpr bool kRanked = false;
+    static inline int rank() { return 0; }
+    static inline int size() { return 1; }
+};
+
+struct Mpi {
+    static constexpr bool kRanked = true;
+    // XXX: The launcher exports the rank before main, MPI_Init has not run yet when init() is called.
+    // Try OpenMPI, PMIx (OpenMPI >= 5, PRRTE), PMI (MPICH, MVAPICH, Intel MPI), and finally Slurm's
+    // task id which stands in for the rank when running under srun without an MPI launcher
+    static int rank()
+    {
+        static const char *rank_envs[] = { "OMPI_COMM_WORLD_RANK", "PMIX_RANK", "PMI_RANK", "SLURM_PROCID", NULL };
+        for(int i=0; rank_envs[i] != NULL; i++) {
+            const char *rank_str = getenv(rank_envs[i]);
+            if(rank_str != NULL)
+                return atoi(rank_str);
+        }
+        return -1;
+    }
+
+    // Number of ranks from the same launchers, -1 if unknown
+    static int size()
+    {
+        static const char *size_envs[] = { "OMPI_COMM_WORLD_SIZE", "PMIX_SIZE", "PMI_SIZE", "SLURM_NTASKS", NULL };
+        for(int i=0; size_envs[i] != NULL; i++) {
+            const char *size_str = getenv(size_envs[i]);
+            if(size_str != NULL)
+                return atoi(size_str);
+        }
+        return -1;
+    }
+};
+
+/* ================================================ Counting ================================================= */
+
+// selMBB counts whole MBBs, selInst checks the target within the MBB (-fi-ff)
+struct Blocks {
+    static constexpr bool kFF = true;
+};
+
+// selInst counts every instruction (without -fi-ff)
+struct Insts {
+    static constexpr bool kFF = false;
+};
+
+/* =============================================== Fault models ============================================== */
+
+// One uniformly random bit of a uniformly random operand per target, kMaxFaults targets per run
+struct SingleFault {
+    static constexpr int kMaxFaults = 1;
+    static void init() {}
+    static unsigned bit(uint64_t size) { return genrand64_int64()%(8*size); }
+};
+
+// Multiple faults: fi-target.txt lists up to kMaxFaults targets, each thread's targets are a queue
+struct MultiFault {
+    static constexpr int kMaxFaults = 64;
+    static void init() {}
+    static unsigned bit(uint64_t size) { return genrand64_int64()%(8*size); }
+};
+
+// Multiple faults, the bit drawn from the weights of fi-bitdist.txt. Bits without a weight have 0,
+// the weights are renormalized over the bits of the operand, uniform if they are all 0
+struct BitDistFault {
+    static constexpr int kMaxFaults = 64;
+    static constexpr unsigned kMaxBits = 512;
+    static double weights[kMaxBits];
+
+    static void init()
+    {
+        FILE *fp = fopen("fi-bitdist.txt", "r");
+        if(!fp)
+            return;
+        unsigned b;
+        double w;
+        while( fscanf(fp, "bit=%u, weight=%lf\n", &b, &w) == 2 ) {
+            assert(b < kMaxBits && "bit >= kMaxBits in fi-bitdist.txt\n");
+            assert(w >= 0 && "weight < 0 in fi-bitdist.txt\n");
+            weights[b] = w;
+        }
+        fclose(fp);
+    }
+
+    static unsigned bit(uint64_t size)
+    {
+        unsigned nbits = 8*size;
+        assert(nbits <= kMaxBits && "Operand wider than kMaxBits\n");
+        double total = 0;
+        for(unsigned b=0; b<nbits; b++)
+            total += weights[b];
+        if(total == 0)
+            return genrand64_int64()%nbits;
+        // 53 random bits in [0, 1)
+        double r = ( genrand64_int64() >> 11 ) * ( 1.0 / 9007199254740992.0 ) * total;
+        for(unsigned b=0; b<nbits; b++) {
+            if(r < weights[b])
+                return b;
+            r -= weights[b];
+        }
+        // XXX: rounding, the last bit with a weight
+        for(unsigned b=nbits; b-- > 0; )
+            if(weights[b] > 0)
+                return b;
+        return nbits-1;
+    }
+};
+
+/* ================================================== Stats ================================================== */
+
+// No accounting, the hooks are the same as without the policy
+struct NoStats {
+    static inline uint64_t start() { return 0; }
+    static inline void mbb(int t, uint64_t ret, uint64_t c0) {}
+    static inline void inst(int t, uint64_t ret, uint64_t c0) {}
+    static inline void inject(int t, uint64_t c0) {}
+    static void init() {}
+    static void write(int rank, bool ranked, int nthreads) {}
+};
+
+// Per-thread hook calls, TSC cycles from entry to return of the hooks (not the call sequence and the
+// register saves of the instrumentation) and the wall clock of the first block reaching a target,
+// the first injection and the first detach. The TSC at init and fini converts cycles to seconds.
+// XXX: Written at fini, crashing trials leave no record
+struct HookStats {
+    struct counters {
+        uint64_t selMBB, selInst, doInject, cycles;
+        double reached, injected, detached;
+    };
+    // XXX: Padded, threads update their own counters
+    static union thread_stats { counters c; char pad[64]; } stats[FI_THREAD_MAX] __attribute__((aligned(64)));
+    static double t_init;
+    static uint64_t tsc_init;
+
+    static inline uint64_t start() { return __rdtsc(); }
+
+    static inline void mbb(int t, uint64_t ret, uint64_t c0)
+    {
+        counters *c = &stats[t].c;
+        c->selMBB++;
+        if(ret == INSTRUMENT_INST && c->reached == 0)
+            c->reached = now();
+        else if(ret == INSTRUMENT_DETACH && c->detached == 0)
+            c->detached = now();
+        c->cycles += __rdtsc() - c0;
+    }
+
+    // Without -fi-ff the target is reached when selInst returns 1
+    static inline void inst(int t, uint64_t ret, uint64_t c0)
+    {
+        counters *c = &stats[t].c;
+        c->selInst++;
+        if(ret && c->reached == 0)
+            c->reached = now();
+        c->cycles += __rdtsc() - c0;
+    }
+
+    static inline void inject(int t, uint64_t c0)
+    {
+        counters *c = &stats[t].c;
+        c->doInject++;
+        if(c->injected == 0)
+            c->injected = now();
+        c->cycles += __rdtsc() - c0;
+    }
+
+    static void init()
+    {
+        t_init = now();
+        tsc_init = __rdtsc();
+    }
+
+    static void write(int rank, bool ranked, int nthreads)
+    {
+        double t_fini = now();
+        uint64_t tsc_fini = __rdtsc();
+        char fname[64];
+        if(ranked)
+            snprintf(fname, sizeof(fname), "%d.%s", rank, "fi-stats.json");
+        else
+            snprintf(fname, sizeof(fname), "%s", "fi-stats.json");
+        FILE *fp = fopen(fname, "w");
+        assert(fp != NULL && "Error opening stats file\n");
+        fprintf(fp, "{\"rank\": %d, \"init\": %.6f, \"fini\": %.6f, \"tsc_init\": %" PRIu64 ", \"tsc_fini\": %" PRIu64 ", \"threads\": [", \
+                rank, t_init, t_fini, tsc_init, tsc_fini);
+        const char *sep = "";
+        for(int t=0; t<nthreads; t++) {
+            const counters *c = &stats[t].c;
+            // XXX: Foreign IDs are sparse
+            if(c->selMBB == 0 && c->selInst == 0)
+                continue;
+            fprintf(fp, "%s\n  {\"thread\": %d, \"selMBB\": %" PRIu64 ", \"selInst\": %" PRIu64 ", \"doInject\": %" PRIu64 ", \"cycles\": %" PRIu64 ", " \
+                    "\"reached\": %.6f, \"injected\": %.6f, \"detached\": %.6f}", sep, t, c->selMBB, c->selInst, c->doInject, c->cycles, \
+                    c->reached, c->injected, c->detached);
+            sep = ",";
+        }
+        fprintf(fp, "\n]}\n");
+        fclose(fp);
+    }
+};
+
+/* ================================================= Runtime ================================================= */
+
+template<class Threading, class Launcher, class Counting, class Faults, class Stats>
+class Runtime {
+    static constexpr int kMaxThreads = Threading::kMaxThreads;
+
+    struct fault {
+        int thread;
+        uint64_t fi_index;
+        uint64_t op;
+        uint64_t size;
+        unsigned bitflip;
+        double time;
+        bool done;
+    };
+
+    // A block stepped by selInst, from its count before the block (base) and its num_insts. fault is the
+    // next target inside the block
+    struct frame {
+        uint64_t site;
+        uint64_t base;
+        uint64_t num_insts;
+        int fault;
+    };
+
+    // per-thread variables, padded to a cache line
+    static union iterator { uint64_t v; char pad[64]; } fi_iterator[kMaxThreads] __attribute__((aligned(64)));
+    // fi_queue[tid].q.next is the next pending fi_index of the thread, 0 when none is left. A time
+    // target has next FI_NEVER until its timer fires, time is its offset in CPU seconds of the thread,
+    // timerid its CPU timer while armed
+    static union queue { struct { uint64_t next; int pos; int end; double time; volatile sig_atomic_t timer; timer_t timerid; } q; char pad[64]; } fi_queue[kMaxThreads] __attribute__((aligned(64)));
+    // Per DSO domains, FI_DOMAINS. Blocks of non-selected domains are not counted and detach in FI runs
+    static union domain_count { uint64_t v[FI_MAX_DOMAINS]; char pad[64]; } fi_domain_count[kMaxThreads] __attribute__((aligned(64)));
+    // Blocks stepped by selInst, innermost last. A call in a stepped block may step a block of the callee
+    // for a later target, each target is in a distinct frame so the depth is at most kMaxFaults
+    static __thread frame fi_frames[Faults::kMaxFaults];
+    static __thread int fi_nframes;
+    // Target selected by selInst, injected by doInject
+    static __thread int fi_fault;
+
+    static fault faults[Faults::kMaxFaults];
+    static int num_faults;
+    static Action action;
+    static int rank;
+
+    // Stratified target, the occurrence-th execution of inst in site by the thread of faults[0], resolved to
+    // fi_index at runtime. Only that thread reads them after init
+    static uint64_t fi_site, fi_site_inst, fi_site_occurrence, fi_site_iterator;
+
+    // Threads with a time target pending to arm or fired, keep do_extras on
+    static std::atomic<int> fi_time_pending;
+    // Deletes the timer of a thread that exits with it armed, the value is the thread id + 1
+    static pthread_key_t fi_timer_key;
+
+    // Domains, traces, site profiles, stratified and time targets, off the fast path. Set by the
+    // handler of time targets too
+    static volatile sig_atomic_t do_extras;
+    static bool do_domains, do_trace, do_sites;
+
+    static bool fi_dryrun;
+    static std::atomic<int> fi_injected;
+    static pthread_mutex_t inj_lock;
+    static FILE *inj_fp;
+
+    // Campaign timing, FI_TIMING=1 writes the wall clock of init, injection and fini to fi-timing.txt.
+    // run.py records the launch and exit of the trial in timestamps.txt, same clock
+    // Exit status of the app, pending targets are checked by the later of fini and the exit handler
+    static int exit_status;
+    static bool exit_known, fini_done;
+
+    static bool fi_timing;
+    static double t_init, t_inject;
+
+    // XXX: Written at injection too, a crashing trial never runs fini
+    static void write_timing(double t_fini)
+    {
+        FILE *fp = fopen("fi-timing.txt", "w");
+        assert(fp != NULL && "Error opening timing file\n");
+        fprintf(fp, "init=%.6f, inject=%.6f, fini=%.6f\n", t_init, t_inject, t_fini);
+        fclose(fp);
+    }
+
+    // Returns false if the MBB is not counted
+    static bool extras(int t, uint64_t num_insts, uint64_t site, const void *ra)
+    {
+        // XXX: the return address is in the text of the instrumented DSO calling selMBB
+        if(do_domains) {
+            int d = fi_domain_lookup(ra);
+            if(action == DO_PROFILING)
+                fi_domain_count[t].v[d] += num_insts;
+            if(!fi_domain_selected(d))
+                return false;
+        }
+
+        if(do_trace)
+            fi_trace_add(t, site);
+        if(do_sites)
+            fi_sites_add(t, site, num_insts);
+
+        // Resolve a stratified target to the concrete fi_index, occurrences of the target thread
+        if(t == faults[0].thread && fi_site && ( site == fi_site ) && ( ++fi_site_iterator == fi_site_occurrence ) ) {
+            assert( ( fi_site_inst <= num_insts ) && "fi_site_inst > num_insts of site\n");
+            faults[0].fi_index = fi_iterator[t].v + fi_site_inst;
+            fi_queue[t].q.next = faults[0].fi_index;
+            fi_site = 0;
+            do_extras = do_domains || do_trace || do_sites;
+            //printf("SITE 0x%"PRIx64" occurrence %"PRIu64" -> fi_index %"PRIu64"\n", site, fi_site_occurrence, fi_queue[t].q.next);
+        }
+
+        if(fi_time_pending)
+            time_target(t);
+        return true;
+    }
+
+    // Arms the timer of the thread on its first block, or sets the target to the first instruction of
+    // this block once the timer has fired
+    static void time_target(int t)
+    {
+        if(fi_queue[t].q.timer == TIMER_PENDING)
+            arm_timer(t);
+        else if(fi_queue[t].q.timer == TIMER_FIRED) {
+            fault *f = &faults[fi_queue[t].q.pos];
+            f->fi_index = fi_iterator[t].v + 1;
+            fi_queue[t].q.next = f->fi_index;
+            fi_queue[t].q.timer = TIMER_DONE;
+            delete_timer(t);
+            //printf("TIME thread %d time %.6f -> fi_index %"PRIu64"\n", t, fi_queue[t].q.time, f->fi_index);
+        }
+        else
+            return;
+        release_pending();
+    }
+
+    // The thread has no time target left to arm or resolve
+    static void release_pending()
+    {
+        if(--fi_time_pending == 0) {
+            do_extras = do_domains || do_trace || do_sites || fi_site;
+            // XXX: A timer of another thread may fire meanwhile, its handler increments first and then
+            // sets do_extras, re-read after the store so either side leaves it on
+            std::atomic_thread_fence(std::memory_order_seq_cst);
+            if(fi_time_pending)
+                do_extras = true;
+        }
+    }
+
+    // The CPU clock of the calling thread, the thread of the target
+    static void arm_timer(int t)
+    {
+#ifdef SIGEV_THREAD_ID
+        struct sigevent sev;
+        memset(&sev, 0, sizeof(sev));
+        sev.sigev_notify = SIGEV_THREAD_ID;
+        sev.sigev_signo = time_signal();
+        sev.sigev_value.sival_int = t;
+        sev.sigev_notify_thread_id = syscall(SYS_gettid);
+        int ret = timer_create(CLOCK_THREAD_CPUTIME_ID, &sev, &fi_queue[t].q.timerid);
+        assert(ret == 0 && "Error creating the CPU timer of a time target\n");
+        ret = pthread_setspecific(fi_timer_key, (void *)(intptr_t)( t + 1 ));
+        assert(ret == 0 && "Error setting the timer key of a time target\n");
+
+        struct itimerspec its;
+        memset(&its, 0, sizeof(its));
+        double time = fi_queue[t].q.time;
+        its.it_value.tv_sec = (time_t)time;
+        // XXX: a zero it_value disarms the timer
+        its.it_value.tv_nsec = (long)( ( time - its.it_value.tv_sec ) * 1e9 ) + 1;
+        fi_queue[t].q.timer = TIMER_ARMED;
+        ret = timer_settime(fi_queue[t].q.timerid, 0, &its, NULL);
+        assert(ret == 0 && "Error arming the CPU timer of a time target\n");
+        (void)ret;
+#else
+        (void)t;
+        assert(false && "Time targets need SIGEV_THREAD_ID\n");
+#endif
+    }
+
+    // Deletes the timer of thread t once it fired or its thread ends, a later signal is ignored
+    static void delete_timer(int t)
+    {
+        pthread_setspecific(fi_timer_key, NULL);
+        timer_delete(fi_queue[t].q.timerid);
+    }
+
+    // XXX: TLS destructor, the timer of an exiting thread would count the CPU time of no thread. Its
+    // target stays FI_NEVER and is reported unreachable by fini
+    static void exit_timer(void *key)
+    {
+        int t = (int)(intptr_t)key - 1;
+        bool fired = ( fi_queue[t].q.timer == TIMER_FIRED );
+        if(fi_queue[t].q.timer == TIMER_ARMED || fired) {
+            fi_queue[t].q.timer = TIMER_DONE;
+            timer_delete(fi_queue[t].q.timerid);
+        }
+        if(fired)
+            release_pending();
+    }
+
+    // XXX: Runs on the thread of the target. selMBB may be interrupted between reading and updating the
+    // count, so the next block resolves the target, not the handler
+    static void on_timer(int sig, siginfo_t *si, void *uc)
+    {
+        int t = si->si_value.sival_int;
+        if(t < 0 || t >= kMaxThreads || fi_queue[t].q.timer != TIMER_ARMED)
+            return;
+        fi_queue[t].q.timer = TIMER_FIRED;
+        fi_time_pending++;
+        do_extras = true;
+    }
+
+    // One time target per thread, next is FI_NEVER until it fires. The initial thread is armed here
+    static void init_timers()
+    {
+        assert(Counting::kFF && "Time targets need -fi-ff, selMBB resolves them\n");
+        for(int i=0; i<num_faults; i++) {
+            assert(faults[i].time > 0 && "Mixed fi_index and time targets\n");
+            int t = faults[i].thread;
+            assert( ( fi_queue[t].q.end - fi_queue[t].q.pos == 1 ) && "More than one time target for thread\n");
+            fi_queue[t].q.next = FI_NEVER;
+            fi_queue[t].q.time = faults[i].time;
+            fi_queue[t].q.timer = TIMER_PENDING;
+            fi_time_pending++;
+        }
+
+        int ret = pthread_key_create(&fi_timer_key, exit_timer);
+        assert(ret == 0 && "Error creating the timer key of time targets\n");
+
+        struct sigaction sa;
+        memset(&sa, 0, sizeof(sa));
+        sa.sa_sigaction = on_timer;
+        sa.sa_flags = SA_SIGINFO | SA_RESTART;
+        sigemptyset(&sa.sa_mask);
+        ret = sigaction(time_signal(), &sa, NULL);
+        assert(ret == 0 && "Error installing the handler of time targets\n");
+        (void)ret;
+
+        int t = Threading::id();
+        if(t >= 0 && fi_queue[t].q.timer == TIMER_PENDING) {
+            arm_timer(t);
+            fi_time_pending--;
+        }
+    }
+
+    // Reports the pending target of thread t, fi_index 0 for a time target whose timer never fired.
+    // Returns false if there is none, does not return if status is 0
+    static bool unreachable(int t, int status)
+    {
+        if(!fi_queue[t].q.next)
+            return false;
+        fi_thread_unreachable(t, ( fi_queue[t].q.next == FI_NEVER ? 0 : fi_queue[t].q.next ), fi_iterator[t].v, status);
+        return true;
+    }
+
+    // XXX: A foreign thread ended before its target, no later thread takes its ID, so stop the trial now
+    // instead of running it to completion
+    static void thread_exit(int t)
+    {
+        if(t >= 0 && t < kMaxThreads)
+            unreachable(t, 0);
+    }
+
+    // Targets left pending, the trial ran to completion without reaching them. With a non-zero status
+    // the first is recorded and the app keeps its status
+    static void check_pending()
+    {
+        for(int t=0; t<kMaxThreads; t++)
+            if(unreachable(t, exit_status))
+                break;
+    }
+
+    // XXX: Destructors of a shared library run before the exit handlers it registered, of a static
+    // binary after, so the later of the two checks
+    static void app_exit(int status, void *arg)
+    {
+        (void)arg;
+        exit_status = status;
+        exit_known = true;
+        if(fini_done)
+            check_pending();
+    }
+
+    // Prefix of the lines of fi-target.txt and fi-inject.txt, returns the length parsed, 0 on error
+    static int scan_prefix(const char *line, int *r, int *t)
+    {
+        int n = 0, len = 0;
+        *r = rank;
+        *t = 0;
+        if(Launcher::kRanked) {
+            if(sscanf(line, "rank=%d, %n", r, &n) != 1 || n == 0)
+                return 0;
+            len += n;
+        }
+        if(Threading::kThreaded) {
+            n = 0;
+            if(sscanf(line + len, "thread=%d, %n", t, &n) != 1 || n == 0)
+                return 0;
+            len += n;
+        }
+        return ( len ? len : -1 );
+    }
+
+    static void print_prefix(FILE *fp, int t)
+    {
+        if(Launcher::kRanked)
+            fprintf(fp, "rank=%d, ", rank);
+        if(Threading::kThreaded)
+            fprintf(fp, "thread=%d, ", t);
+    }
+
+    // Reads the faults of this rank, with op, size and bitflip if reproducing. Returns the lines parsed
+    static int read_faults(FILE *fp, bool reproduce)
+    {
+        char line[256];
+        int lines = 0;
+        while( fgets(line, sizeof(line), fp) ) {
+            int r, t;
+            int len = scan_prefix(line, &r, &t);
+            if(len == 0)
+                break;
+            len = ( len < 0 ? 0 : len );
+            fault f = { t, 0, 0, 0, 0, 0, false };
+            if(reproduce) {
+                if(sscanf(line + len, "fi_index=%" SCNu64 ", op=%" SCNu64 ", size=%" SCNu64 ", bitflip=%u", \
+                            &f.fi_index, &f.op, &f.size, &f.bitflip) != 4)
+                    break;
+                assert(f.size > 0 && "op_size <=0!\n");
+            }
+            // Time target, fi_index is the count of the thread when its timer fires
+            else if(sscanf(line + len, "fi_index=%" SCNu64, &f.fi_index) != 1) {
+                if(sscanf(line + len, "time=%lf", &f.time) != 1)
+                    break;
+                assert(f.time > 0 && "time <= 0!\n");
+            }
+            lines++;
+            assert(r >= 0 && "fi_rank < 0\n");
+            assert( ( t >= 0 && t < kMaxThreads ) && "fi_thread out of range\n");
+            assert( ( f.fi_index > 0 || f.time > 0 ) && "fi_index <= 0!\n");
+            if(r != rank)
+                continue;
+            assert(num_faults < Faults::kMaxFaults && "Too many faults, kMaxFaults\n");
+            faults[num_faults++] = f;
+        }
+        return lines;
+    }
+
+    // Reads a [rank=R, ][thread=T, ]site=S, inst=I, occurrence=O target, other ranks run without a target
+    static void read_site_target(FILE *fp)
+    {
+        char line[256];
+        int r, t;
+        int len = ( fgets(line, sizeof(line), fp) ? scan_prefix(line, &r, &t) : 0 );
+        assert(len != 0 && "fscanf failed to parse input\n");
+        len = ( len < 0 ? 0 : len );
+        uint64_t site, inst, occurrence;
+        int ret = sscanf(line + len, "site=%" SCNx64 ", inst=%" SCNu64 ", occurrence=%" SCNu64, &site, &inst, &occurrence);
+        assert(ret == 3 && "fscanf failed to parse input\n");
+        (void)ret;
+        assert(site != 0 && "fi_site == 0\n");
+        assert(inst > 0 && "fi_site_inst <= 0\n");
+        assert(occurrence > 0 && "fi_site_occurrence <= 0\n");
+        assert( ( t >= 0 && t < kMaxThreads ) && "fi_thread out of range\n");
+        if(r != rank)
+            return;
+        fi_site = site;
+        fi_site_inst = inst;
+        fi_site_occurrence = occurrence;
+        faults[0].thread = t;
+        num_faults = 1;
+        fi_queue[t].q.pos = 0;
+        fi_queue[t].q.end = 1;
+        fi_queue[t].q.next = FI_NEVER;
+    }
+
+    // Sort the targets by thread and fi_index, each thread's queue is a contiguous range of faults
+    static void init_queues()
+    {
+        // XXX: Folded for a single fault, -Warray-bounds does not know num_faults <= 1
+        for(int i=1; Faults::kMaxFaults > 1 && i<num_faults; i++) {
+            fault f = faults[i];
+            int j = i;
+            for(; j > 0 && ( faults[j-1].thread > f.thread || ( faults[j-1].thread == f.thread && faults[j-1].fi_index > f.fi_index ) ); j--)
+                faults[j] = faults[j-1];
+            faults[j] = f;
+        }
+        for(int i=0; i<num_faults; i++) {
+            int t = faults[i].thread;
+            if(i == 0 || faults[i-1].thread != t) {
+                fi_queue[t].q.pos = i;
+                fi_queue[t].q.next = faults[i].fi_index;
+            }
+            else if(Faults::kMaxFaults > 1)
+                assert( ( faults[i-1].fi_index < faults[i].fi_index ) && "Duplicate fi_index in targets\n");
+            fi_queue[t].q.end = i+1;
+        }
+    }
+
+    static void seed()
+    {
+        uint64_t seed;
+        FILE *fp = fopen("/dev/urandom", "r");
+        assert(fp != NULL && "Error opening /dev/urandom\n");
+        size_t ret = fread(&seed, sizeof(seed), 1, fp);
+        assert(ret == 1 && ferror(fp) == 0 && "Error reading /dev/urandom\n");
+        (void)ret;
+        init_genrand64(seed);
+        fclose(fp);
+    }
+
+    static void write_inscount(int nthreads)
+    {
+        char inscount_fname[64];
+        if(Launcher::kRanked)
+            snprintf(inscount_fname, sizeof(inscount_fname), "%d.%s", rank, "fi-inscount.txt");
+        else
+            snprintf(inscount_fname, sizeof(inscount_fname), "%s", "fi-inscount.txt");
+        FILE *ins_fp = fopen(inscount_fname, "w");
+        assert(ins_fp != NULL && "Error opening inscount file\n");
+
+        // XXX: faultinject.py parses thread=X, fi_index=N, the sum without ranks, the count alone with
+        uint64_t sum = 0;
+        for(int i=0; i < nthreads; i++) {
+            sum += fi_iterator[i].v;
+            // XXX: Foreign IDs are sparse
+            if(!Threading::kThreaded || ( i >= FI_THREAD_FOREIGN && fi_iterator[i].v == 0 ))
+                continue;
+            fprintf(ins_fp, "thread=%d, fi_index=%" PRIu64 "\n", i, fi_iterator[i].v);
+        }
+        if(!Launcher::kRanked)
+            fprintf(ins_fp, "fi_index=%" PRIu64 "\n", sum);
+        else if(!Threading::kThreaded)
+            fprintf(ins_fp, "%" PRIu64 "\n", sum);
+        fclose(ins_fp);
+    }
+
+    // Counts, then the domains, site profiles and traces of the run
+    static void write_profile()
+    {
+        int nthreads = Threading::count();
+
+        // Aggregated binary profile, a single shared file for all ranks
+        if(Launcher::kRanked && fi_inscount_binary())
+            fi_inscount_write(rank, Launcher::size(), nthreads, &fi_iterator[0].v, sizeof(fi_iterator[0])/sizeof(uint64_t));
+        else
+            write_inscount(nthreads);
+
+        // XXX: All ranks share the trial directory, ranked runtimes prefix the files with <rank>.
+        if(do_domains)
+            fi_domains_write(( Launcher::kRanked ? rank : -1 ), nthreads, &fi_domain_count[0].v[0], sizeof(fi_domain_count[0]) / sizeof(uint64_t));
+        if(do_sites)
+            fi_sites_write(( Launcher::kRanked ? rank : -1 ), Threading::kThreaded);
+        if(do_trace)
+            fi_trace_fini();
+    }
+
+public:
+    // XXX: site IDs are listed in the site map of binaries compiled with -fi-sites
+    static inline uint64_t selMBB(uint64_t num_insts, uint64_t site, const void *ra)
+    {
+        uint64_t c0 = Stats::start();
+        int t = Threading::id();
+        // XXX: Blocks run by the ID lookup are not counted, they are not part of the program
+        if(Threading::kThreaded && t < 0)
+            return ( action == DO_PROFILING ? INSTRUMENT_BB : INSTRUMENT_DETACH );
+
+        uint64_t ret = sel_mbb(t, num_insts, site, ra);
+        Stats::mbb(t, ret, c0);
+        return ret;
+    }
+
+    // Blocks: inst is the position in the MBB stepped by the innermost frame of the thread.
+    // Insts: site is 0 and inst the position in the MBB, count every call
+    static inline uint64_t selInst(uint64_t site, uint64_t inst)
+    {
+        uint64_t c0 = Stats::start();
+        int t = Threading::id();
+        if(!Counting::kFF && Threading::kThreaded && t < 0)
+            return 0;
+
+        uint64_t ret = sel_inst(t, site, inst);
+        Stats::inst(t, ret, c0);
+        return ret;
+    }
+
+    static uint64_t doInject(uint64_t num_ops, const uint64_t *size, uint8_t *bitmask)
+    {
+        uint64_t c0 = Stats::start();
+        int t = Threading::id();
+        uint64_t op = do_inject(t, num_ops, size, bitmask);
+        Stats::inject(t, c0);
+        return op;
+    }
+
+private:
+    static inline uint64_t sel_mbb(int t, uint64_t num_insts, uint64_t site, const void *ra)
+    {
+        if(__builtin_expect(do_extras, 0) && !extras(t, num_insts, site, ra))
+            return ( action == DO_PROFILING ? INSTRUMENT_BB : INSTRUMENT_DETACH );
+
+        // XXX: O(1), compare only against the thread's next pending target
+        uint64_t it = fi_iterator[t].v;
+        uint64_t next = fi_queue[t].q.next;
+        if(next <= it) {
+            // XXX: A passed target is pending in a block stepping below on the stack, this block runs from
+            // one of its calls and counts for the targets after it
+            if(Faults::kMaxFaults > 1 && next != 0 && fi_nframes > 0)
+                return sel_nested(t, it, num_insts, site);
+            //printf("DETACH thread %d fi_index %"PRIu64" fi_iterator %"PRIu64"\n", t, next, it);
+            return INSTRUMENT_DETACH;
+        }
+        fi_iterator[t].v = it + num_insts;
+        if(next <= it + num_insts) {
+            push_frame(site, it, num_insts, fi_queue[t].q.pos);
+            return INSTRUMENT_INST;
+        }
+        return INSTRUMENT_BB;
+    }
+
+    // The first target of the thread past its count, detach if none is left
+    static uint64_t sel_nested(int t, uint64_t it, uint64_t num_insts, uint64_t site)
+    {
+        int i = fi_queue[t].q.pos;
+        while(i < fi_queue[t].q.end && ( faults[i].done || faults[i].fi_index <= it ))
+            i++;
+        if(i == fi_queue[t].q.end)
+            return INSTRUMENT_DETACH;
+        fi_iterator[t].v = it + num_insts;
+        if(faults[i].fi_index <= it + num_insts) {
+            push_frame(site, it, num_insts, i);
+            return INSTRUMENT_INST;
+        }
+        return INSTRUMENT_BB;
+    }
+
+    static inline void push_frame(uint64_t site, uint64_t base, uint64_t num_insts, int fault)
+    {
+        assert(fi_nframes < Faults::kMaxFaults && "Too many stepped blocks, kMaxFaults\n");
+        fi_frames[fi_nframes++] = frame{ site, base, num_insts, fault };
+    }
+
+    static inline uint64_t sel_inst(int t, uint64_t site, uint64_t inst)
+    {
+        if(Counting::kFF) {
+            // XXX: Frames of blocks left without their last selInst, e.g., by a longjmp, are not of this site.
+            // Folded for a single fault, -Warray-bounds does not know fi_nframes <= 1
+            while(Faults::kMaxFaults > 1 && fi_nframes > 1 && fi_frames[fi_nframes-1].site != site)
+                fi_nframes--;
+            assert(fi_nframes > 0 && "selInst without a stepped block\n");
+            frame *fr = &fi_frames[fi_nframes-1];
+            fi_fault = fr->fault;
+            bool hit = ( fr->fault < fi_queue[t].q.end && fr->base + inst == faults[fr->fault].fi_index );
+            //printf("INJECT thread=%d, fi_index=%"PRIu64", site=0x%"PRIx64", inst=%"PRIu64"\n", t, faults[fr->fault].fi_index, site, inst);
+            // Several targets of a block are consecutive in the queue, callee targets follow them
+            if(hit)
+                fr->fault++;
+            if(inst == fr->num_insts)
+                fi_nframes--;
+            return hit;
+        }
+        fi_fault = fi_queue[t].q.pos;
+        return ( ++fi_iterator[t].v == fi_queue[t].q.next );
+    }
+
+    static uint64_t do_inject(int t, uint64_t num_ops, const uint64_t *size, uint8_t *bitmask)
+    {
+        uint64_t op;
+        assert( ( ( action == DO_REPRODUCTION ) || ( action == DO_RANDOM ) ) && "action is neither DO_REPRODUCTION nor DO_RANDOM!\n");
+        assert( ( fi_fault >= fi_queue[t].q.pos && fi_fault < fi_queue[t].q.end && !faults[fi_fault].done ) && "No pending fault for thread!\n");
+        fault *f = &faults[fi_fault];
+        // Reproduce FI
+        if(action == DO_REPRODUCTION) {
+            op = f->op;
+        }
+        // Random operands and bit pos FI
+        else {
+            // XXX: mt64 state is shared, threads inject under the lock
+            if(Threading::kThreaded)
+                pthread_mutex_lock(&inj_lock);
+            op = genrand64_int64()%num_ops;
+            // XXX: size is in bytes, the fault model picks one of 8*size bits
+            f->bitflip = Faults::bit(size[op]);
+            f->op = op;
+            f->size = size[op];
+
+            // XXX: one line per fault in firing order, flushed since a later fault may crash the trial
+            if(!inj_fp)
+                inj_fp = fopen("fi-inject.txt", "w");
+            assert(inj_fp != NULL && "Error opening inject file\n");
+            print_prefix(inj_fp, t);
+            fprintf(inj_fp, "fi_index=%" PRIu64 ", op=%" PRIu64 ", size=%" PRIu64 ", bitflip=%u\n", \
+                    f->fi_index, f->op, f->size, f->bitflip);
+            fflush(inj_fp);
+            if(Threading::kThreaded)
+                pthread_mutex_unlock(&inj_lock);
+        }
+
+        //printf("op_size %llu size[op] %llu\n", f->size, size[op]);
+        assert( ( f->size == size[op] ) && "op_size != size[op]");
+
+        for(unsigned i=0; i<f->size; i++)
+            bitmask[i] = 0;
+
+        unsigned bit_i = f->bitflip/8;
+        unsigned bit_j = f->bitflip%8;
+
+        // XXX: FI_DRYRUN takes the injection path with an empty bitmask, used to measure overhead
+        bitmask[bit_i] = ( fi_dryrun ? 0 : (1U << bit_j) );
+
+        // Time of the first injection, execution diverges from there
+        if(fi_injected.fetch_add(1) == 0 && fi_timing) {
+            t_inject = now();
+            write_timing(0);
+        }
+
+        /*printf("INJECTING FAULT: thread=%d, fi_index=%"PRIu64", op=%"PRIu64", size=%"PRIu64", bitflip=%u\n", \
+                t, f->fi_index, f->op, f->size, f->bitflip);*/
+        fflush(stdout);
+
+        // Next target of the thread, 0 after its last one. A target in a callee fires before the pending
+        // ones of the caller's block, the queue head moves past injected targets only
+        f->done = true;
+        while(fi_queue[t].q.pos < fi_queue[t].q.end && faults[fi_queue[t].q.pos].done)
+            fi_queue[t].q.pos++;
+        fi_queue[t].q.next = ( fi_queue[t].q.pos < fi_queue[t].q.end ) ? faults[fi_queue[t].q.pos].fi_index : 0;
+
+        return op;
+    }
+
+public:
+    static void init()
+    {
+        Stats::init();
+        // Huge page text, FI_HUGETEXT
+        fi_hugetext_init();
+        fi_dryrun = ( getenv("FI_DRYRUN") != NULL );
+        fi_timing = ( getenv("FI_TIMING") != NULL );
+        if(fi_timing)
+            t_init = now();
+        if(Counting::kFF)
+            do_domains = fi_domains_init();
+
+        rank = Launcher::rank();
+        assert(rank >= 0 && "rank < 0, cannot read env variable for MPI rank\n");
+
+        FILE *fp;
+        // XXX: First try to reproduce a specific injection, next try to read a target instruction for FI. If netheir holds, do a profiling run
+        // This is specific injection, including operands, produced after a FI experiment
+        if( ( fp = fopen("fi-inject.txt", "r") ) ) {
+            int lines = read_faults(fp, true);
+            assert(lines > 0 && "fscanf failed to parse input\n");
+            (void)lines;
+            fclose(fp);
+            init_queues();
+
+            action = DO_REPRODUCTION;
+        }
+        // This is targeted injection, selecting the instruction to run a random experiment
+        else if( ( fp = fopen("fi-target.txt", "r") ) ) {
+            int lines = read_faults(fp, false);
+            if(lines > 0) {
+                init_queues();
+                if(faults[0].time > 0)
+                    init_timers();
+            }
+            // Stratified target (stratified.py), fi_index is unknown until the site executes
+            else {
+                assert(Counting::kFF && "fscanf failed to parse input\n");
+                rewind(fp);
+                read_site_target(fp);
+            }
+            fclose(fp);
+
+            action = DO_RANDOM;
+
+            // Initialize the random generator
+            seed();
+            Faults::init();
+        }
+        // This is a profiling run to get the number of target instructions
+        else {
+            action = DO_PROFILING;
+            for(int t=0; t<kMaxThreads; t++)
+                fi_queue[t].q.next = FI_NEVER;
+            if(Counting::kFF) {
+                do_sites = fi_sites_enabled();
+                do_trace = fi_trace_enabled();
+                if(do_trace)
+                    fi_trace_init(Launcher::kRanked ? rank : -1);
+            }
+        }
+
+        do_extras = do_domains || do_trace || do_sites || fi_site || fi_time_pending;
+
+        if(action != DO_PROFILING) {
+            int ret = on_exit(app_exit, NULL);
+            assert(ret == 0 && "Error registering the exit handler\n");
+            (void)ret;
+            Threading::on_thread_exit(thread_exit);
+        }
+    }
+
+    static void fini()
+    {
+        if(fi_timing)
+            write_timing(now());
+
+        if(inj_fp)
+            fclose(inj_fp);
+
+        Stats::write(rank, Launcher::kRanked, Threading::count());
+
+        // Targets left pending are checked once the exit status of the app is known
+        if(action != DO_PROFILING) {
+            // XXX: Timers of threads still running, the initial thread runs no TLS destructor
+            for(int t=0; t<kMaxThreads; t++)
+                exit_timer((void *)(intptr_t)( t + 1 ));
+            fini_done = true;
+            if(exit_known)
+                check_pending();
+        }
+        // XXX: This is a profiling run
+        else
+            write_profile();
+    }
+};
+
+#define FI_RUNTIME_TEMPLATE template<class Threading, class Launcher, class Counting, class Faults, class Stats>
+#define FI_RUNTIME Runtime<Threading, Launcher, Counting, Faults, Stats>
+
+FI_RUNTIME_TEMPLATE typename FI_RUNTIME::iterator FI_RUNTIME::fi_iterator[FI_RUNTIME::kMaxThreads];
+FI_RUNTIME_TEMPLATE typename FI_RUNTIME::queue FI_RUNTIME::fi_queue[FI_RUNTIME::kMaxThreads];
+FI_RUNTIME_TEMPLATE typename FI_RUNTIME::domain_count FI_RUNTIME::fi_domain_count[FI_RUNTIME::kMaxThreads];
+FI_RUNTIME_TEMPLATE __thread typename FI_RUNTIME::frame FI_RUNTIME::fi_frames[Faults::kMaxFaults];
+FI_RUNTIME_TEMPLATE __thread int FI_RUNTIME::fi_nframes = 0;
+FI_RUNTIME_TEMPLATE __thread int FI_RUNTIME::fi_fault = 0;
+FI_RUNTIME_TEMPLATE typename FI_RUNTIME::fault FI_RUNTIME::faults[Faults::kMaxFaults];
+FI_RUNTIME_TEMPLATE int FI_RUNTIME::num_faults = 0;
+FI_RUNTIME_TEMPLATE Action FI_RUNTIME::action = DO_PROFILING;
+FI_RUNTIME_TEMPLATE int FI_RUNTIME::rank = 0;
+FI_RUNTIME_TEMPLATE uint64_t FI_RUNTIME::fi_site = 0;
+FI_RUNTIME_TEMPLATE uint64_t FI_RUNTIME::fi_site_inst = 0;
+FI_RUNTIME_TEMPLATE uint64_t FI_RUNTIME::fi_site_occurrence = 0;
+FI_RUNTIME_TEMPLATE uint64_t FI_RUNTIME::fi_site_iterator = 0;
+FI_RUNTIME_TEMPLATE std::atomic<int> FI_RUNTIME::fi_time_pending(0);
+FI_RUNTIME_TEMPLATE pthread_key_t FI_RUNTIME::fi_timer_key;
+FI_RUNTIME_TEMPLATE volatile sig_atomic_t FI_RUNTIME::do_extras = false;
+FI_RUNTIME_TEMPLATE bool FI_RUNTIME::do_domains = false;
+FI_RUNTIME_TEMPLATE bool FI_RUNTIME::do_trace = false;
+FI_RUNTIME_TEMPLATE bool FI_RUNTIME::do_sites = false;
+FI_RUNTIME_TEMPLATE bool FI_RUNTIME::fi_dryrun = false;
+FI_RUNTIME_TEMPLATE std::atomic<int> FI_RUNTIME::fi_injected(0);
+FI_RUNTIME_TEMPLATE pthread_mutex_t FI_RUNTIME::inj_lock = PTHREAD_MUTEX_INITIALIZER;
+FI_RUNTIME_TEMPLATE FILE *FI_RUNTIME::inj_fp = NULL;
+FI_RUNTIME_TEMPLATE int FI_RUNTIME::exit_status = 0;
+FI_RUNTIME_TEMPLATE bool FI_RUNTIME::exit_known = false;
+FI_RUNTIME_TEMPLATE bool FI_RUNTIME::fini_done = false;
+FI_RUNTIME_TEMPLATE bool FI_RUNTIME::fi_timing = false;
+FI_RUNTIME_TEMPLATE double FI_RUNTIME::t_init = 0;
+FI_RUNTIME_TEMPLATE double FI_RUNTIME::t_inject = 0;
+
+#undef FI_RUNTIME
+#undef FI_RUNTIME_TEMPLATE
+
+} // namespace fi
+
+#endif
@@ -0,0 +1,149 @@
+// Draws FI targets from the aggregated binary profile (fi-inscount.bin) of a multi-process run.
+// The file is mmap'ed, the per (rank, thread) counts are linearized into prefix sums once, and
+// each target is a binary search over them, O(log(ranks * threads)) per sample.
+//
+// usage: fi-sample -e <mpi | mpi+omp> [-n nsamples] [-s seed] [-o fi-target.txt] [-v] [fi-inscount.bin]
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstdint>
+#include <cinttypes>
+#include <cstring>
+#include <cassert>
+#include <vector>
+#include <random>
+#include <algorithm>
+#include <string>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+extern "C" {
+#include "fi_inscount.h"
+}
+
+struct Target {
+    int rank;
+    int thread;
+    uint64_t fi_index;
+};
+
+class TargetSampler {
+    public:
+        TargetSampler(const fi_inscount_rec_t *recs, size_t nrecs) {
+            uint64_t sum = 0;
+            for(size_t r = 0; r < nrecs; r++) {
+                // XXX: skip holes of ranks that did not write a record
+                if(recs[r].magic != FI_INSCOUNT_MAGIC)
+                    continue;
+                for(unsigned t = 0; t < recs[r].nthreads; t++) {
+                    if(recs[r].count[t] == 0)
+                        continue;
+                    sum += recs[r].count[t];
+                    prefix.push_back(sum);
+                    owner.push_back(std::make_pair((int)r, (int)t));
+                }
+            }
+        }
+
+        uint64_t total() const { return prefix.empty() ? 0 : prefix.back(); }
+
+        // target is in [1, total()]
+        Target lookup(uint64_t target) const {
+            assert(target >= 1 && target <= total() && "target out of range");
+            // first linearized thread whose cumulative count reaches the target
+            size_t i = std::lower_bound(prefix.begin(), prefix.end(), target) - prefix.begin();
+            uint64_t base = ( i > 0 ? prefix[i-1] : 0 );
+            return Target{ owner[i].first, owner[i].second, target - base };
+        }
+
+    private:
+        std::vector<uint64_t> prefix;
+        std::vector< std::pair<int, int> > owner;
+};
+
+static void usage(const char *prog)
+{
+    fprintf(stderr, "usage: %s -e <mpi | mpi+omp> [-n nsamples] [-s seed] [-o output] [-v] [%s]\n", prog, FI_INSCOUNT_BIN_FNAME);
+    exit(1);
+}
+
+int main(int argc, char *argv[])
+{
+    std::string execmode;
+    std::string fname = FI_INSCOUNT_BIN_FNAME;
+    const char *outfname = nullptr;
+    unsigned long nsamples = 1;
+    uint64_t seed = std::random_device()();
+    bool verbose = false;
+
+    int opt;
+    while( ( opt = getopt(argc, argv, "e:n:s:o:v") ) != -1 ) {
+        switch(opt) {
+            case 'e': execmode = optarg; break;
+            case 'n': nsamples = strtoul(optarg, nullptr, 10); break;
+            case 's': seed = strtoull(optarg, nullptr, 10); break;
+            case 'o': outfname = optarg; break;
+            case 'v': verbose = true; break;
+            default: usage(argv[0]);
+        }
+    }
+    if(optind < argc)
+        fname = argv[optind];
+
+    if(execmode != "mpi" && execmode != "mpi+omp")
+        usage(argv[0]);
+
+    int fd = open(fname.c_str(), O_RDONLY);
+    if(fd < 0) {
+        perror(fname.c_str());
+        return 1;
+    }
+    struct stat st;
+    fstat(fd, &st);
+    size_t nrecs = st.st_size / sizeof(fi_inscount_rec_t);
+    if(nrecs == 0 || st.st_size % sizeof(fi_inscount_rec_t) != 0) {
+        fprintf(stderr, "Invalid binary inscount file %s, size %lld\n", fname.c_str(), (long long)st.st_size);
+        return 1;
+    }
+
+    void *addr = mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if(addr == MAP_FAILED) {
+        perror("mmap");
+        return 1;
+    }
+
+    TargetSampler sampler(static_cast<const fi_inscount_rec_t *>(addr), nrecs);
+    munmap(addr, st.st_size);
+    close(fd);
+
+    uint64_t num_insts = sampler.total();
+    if(num_insts == 0) {
+        fprintf(stderr, "No target instructions in %s\n", fname.c_str());
+        return 1;
+    }
+    if(verbose)
+        fprintf(stderr, "ranks %zu num_insts %" PRIu64 "\n", nrecs, num_insts);
+
+    FILE *out = stdout;
+    if(outfname) {
+        out = fopen(outfname, "w");
+        assert(out != NULL && "Error opening output file\n");
+    }
+
+    std::mt19937_64 gen(seed);
+    std::uniform_int_distribution<uint64_t> dist(1, num_insts);
+    for(unsigned long i = 0; i < nsamples; i++) {
+        Target t = sampler.lookup(dist(gen));
+        if(execmode == "mpi")
+            fprintf(out, "rank=%d, fi_index=%" PRIu64 "\n", t.rank, t.fi_index);
+        else
+            fprintf(out, "rank=%d, thread=%d, fi_index=%" PRIu64 "\n", t.rank, t.thread, t.fi_index);
+    }
+
+    if(outfname)
+        fclose(out);
+
+    return 0;
+}
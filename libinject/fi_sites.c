@@ -0,0 +1,111 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <inttypes.h>
+#include <string.h>
+#include <assert.h>
+#include "fi_sites.h"
+
+// XXX: Open addressing, linear probing. Site IDs are never 0, 0 marks an empty slot
+typedef struct {
+    uint64_t site;
+    uint64_t insts;
+    uint64_t execs;
+} fi_site_t;
+
+// Per thread tables, padded to a cache line, merged into one file at fini
+typedef union {
+    struct {
+        fi_site_t *sites;
+        uint64_t nslots;
+        uint64_t nsites;
+    } t;
+    char pad[64];
+} fi_site_table_t;
+
+static fi_site_table_t tables[FI_SITES_THREADS] __attribute__((aligned(64)));
+
+static inline uint64_t hash(uint64_t site)
+{
+    // XXX: low bits are a per function counter, mix in the function hash of the high bits
+    site ^= site >> 33;
+    site *= UINT64_C(0xff51afd7ed558ccd);
+    site ^= site >> 33;
+    return site;
+}
+
+static fi_site_t *lookup(fi_site_t *table, uint64_t size, uint64_t site)
+{
+    uint64_t i = hash(site) & (size - 1);
+    while(table[i].site != 0 && table[i].site != site)
+        i = (i + 1) & (size - 1);
+    return &table[i];
+}
+
+static void grow(fi_site_table_t *table)
+{
+    uint64_t nslots = table->t.nslots;
+    fi_site_t *sites = table->t.sites;
+    uint64_t new_nslots = ( nslots ? 2*nslots : 4096 );
+    fi_site_t *new_sites = calloc(new_nslots, sizeof(fi_site_t));
+    assert(new_sites != NULL && "Error allocating the site table\n");
+
+    uint64_t i;
+    for(i=0; i<nslots; i++)
+        if(sites[i].site != 0)
+            *lookup(new_sites, new_nslots, sites[i].site) = sites[i];
+
+    free(sites);
+    table->t.sites = new_sites;
+    table->t.nslots = new_nslots;
+}
+
+int fi_sites_enabled(void)
+{
+    const char *s = getenv("FI_SITES");
+    return ( s != NULL && strcmp(s, "1") == 0 );
+}
+
+void fi_sites_add(int tid, uint64_t site, uint64_t num_insts)
+{
+    assert(site != 0 && "site ID is 0, binary not compiled with -fi-sites?\n");
+    assert( ( tid >= 0 && tid < FI_SITES_THREADS ) && "tid out of range\n");
+
+    fi_site_table_t *table = &tables[tid];
+    // Keep the load factor <= 1/2
+    if(2*(table->t.nsites+1) > table->t.nslots)
+        grow(table);
+
+    fi_site_t *s = lookup(table->t.sites, table->t.nslots, site);
+    if(s->site == 0) {
+        s->site = site;
+        s->insts = num_insts;
+        table->t.nsites++;
+    }
+    assert(s->insts == num_insts && "site with different number of target instructions\n");
+    s->execs++;
+}
+
+void fi_sites_write(int rank, int threaded)
+{
+    char fname[64];
+    if(rank >= 0)
+        snprintf(fname, sizeof(fname), "%d.%s", rank, FI_SITES_FNAME);
+    else
+        snprintf(fname, sizeof(fname), "%s", FI_SITES_FNAME);
+    FILE *fp = fopen(fname, "w");
+    assert(fp != NULL && "Error opening sites file\n");
+    int t;
+    uint64_t i;
+    for(t=0; t<FI_SITES_THREADS; t++) {
+        const fi_site_t *sites = tables[t].t.sites;
+        for(i=0; i<tables[t].t.nslots; i++) {
+            if(sites[i].site == 0)
+                continue;
+            if(threaded)
+                fprintf(fp, "thread=%d, ", t);
+            fprintf(fp, "site=0x%016"PRIx64", insts=%"PRIu64", execs=%"PRIu64"\n", sites[i].site, sites[i].insts, sites[i].execs);
+        }
+    }
+    fclose(fp);
+}
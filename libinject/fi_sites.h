@@ -0,0 +1,23 @@
+#ifndef _FI_SITES_H
+#define _FI_SITES_H
+
+#include <stdint.h>
+
+/* Per static site profile for stratified sampling. Binaries built with -fi-ff pass the site ID of
+ * every instrumented MBB as the 2nd argument of selMBB, -fi-sites saves the map of the IDs. The
+ * profile counts the executions of each site per thread, the dynamic count of a site is execs * insts */
+#define FI_SITES_FNAME "fi-sites.txt"
+#define FI_SITES_THREADS 256
+
+/* returns non-zero if the per site profile is requested, FI_SITES=1 */
+int fi_sites_enabled(void);
+
+/* counts one execution of site by thread tid, an MBB with num_insts target instructions. Called only
+ * by that thread */
+void fi_sites_add(int tid, uint64_t site, uint64_t num_insts);
+
+/* writes the site=<id>, insts=<n>, execs=<n> lines of all threads to FI_SITES_FNAME, <rank>.FI_SITES_FNAME
+ * if rank >= 0. Lines start with thread=<t>, if threaded */
+void fi_sites_write(int rank, int threaded);
+
+#endif
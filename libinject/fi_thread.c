@@ -0,0 +1,235 @@
+#define _GNU_SOURCE
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <inttypes.h>
+#include <assert.h>
+#include <unistd.h>
+#include <sys/syscall.h>
+#include <stdatomic.h>
+#include <pthread.h>
+#include <omp.h>
+#include "fi_thread.h"
+
+// XXX: Weak, resolved to the OpenMP runtime of the app, which may be an instrumented libomp, so the
+// library links none itself. The serial runtimes link this file for fi_thread_unreachable, and a
+// process without OpenMP, e.g., a helper the library is preloaded into, runs as the initial thread
+#pragma weak omp_get_level
+#pragma weak omp_get_thread_num
+#pragma weak omp_get_ancestor_thread_num
+#pragma weak omp_get_team_size
+
+__thread int fi_thread_cur = -1;
+// The implicit task callbacks keep fi_thread_cur
+static int ompt_active = 0;
+
+// Per thread cache of the ID without OMPT, valid while the thread stays at the same level and thread number
+static __thread int cache_id = -1, cache_level = -1, cache_num = -1;
+// Set during the lookup, omp_get_*() may run instrumented blocks calling back into selMBB
+static __thread int in_lookup = 0;
+// ID of a thread not created by OpenMP, kept across its parallel regions
+static __thread int foreign = -1;
+
+static atomic_int max_id = 0;
+static atomic_int foreign_id = FI_THREAD_FOREIGN;
+
+// Called with the ID of an exiting foreign thread, fi_thread_on_exit
+static void (*exit_fn)(int id) = NULL;
+static pthread_key_t exit_key;
+
+static void thread_exit(void *key)
+{
+    exit_fn((int)(intptr_t)key - 1);
+}
+
+static void update_max(int id)
+{
+    int m = atomic_load(&max_id);
+    while(id + 1 > m && !atomic_compare_exchange_weak(&max_id, &m, id + 1))
+        ;
+}
+
+// ID of a thread outside the teams of the OpenMP runtime, the initial thread or a foreign one
+static int own_id(void)
+{
+    // XXX: The initial thread has the TID of the process, anything else at level 0 is foreign, so are the
+    // workers of an instrumented OpenMP runtime running its blocks outside of a team
+    if(syscall(SYS_gettid) == getpid())
+        return 0;
+    if(foreign < 0) {
+        foreign = atomic_fetch_add(&foreign_id, 1);
+        if(exit_fn)
+            pthread_setspecific(exit_key, (void *)(intptr_t)( foreign + 1 ));
+    }
+    assert(foreign < FI_THREAD_MAX && "Too many foreign threads, FI_THREAD_MAX\n");
+    return foreign;
+}
+
+#if FI_OMP
+// XXX: The OMPT 5.0 interface used here, GCC ships no omp-tools.h. libomp finds the tool by the
+// ompt_start_tool symbol of the process, a tool of the app is not chained. The serial runtimes
+// define no tool
+typedef union {
+    uint64_t value;
+    void *ptr;
+} ompt_data_t;
+
+typedef void (*ompt_interface_fn_t)(void);
+typedef ompt_interface_fn_t (*ompt_function_lookup_t)(const char *name);
+typedef void (*ompt_callback_t)(void);
+typedef int (*ompt_set_callback_t)(int event, ompt_callback_t callback);
+typedef int (*ompt_initialize_t)(ompt_function_lookup_t lookup, int initial_device_num, ompt_data_t *tool_data);
+typedef void (*ompt_finalize_t)(ompt_data_t *tool_data);
+
+typedef struct {
+    ompt_initialize_t initialize;
+    ompt_finalize_t finalize;
+    ompt_data_t tool_data;
+} ompt_start_tool_result_t;
+
+enum {
+    ompt_callback_parallel_begin = 3,
+    ompt_callback_implicit_task = 7,
+    ompt_set_always = 5,
+    ompt_scope_begin = 1,
+    ompt_task_initial = 0x1
+};
+
+// Product of the team sizes of the enclosing levels, the radix of the next level
+static __thread unsigned cur_radix = 1;
+
+static inline uint64_t pack(int id, unsigned radix)
+{
+    return ( (uint64_t)radix << 32 ) | (uint32_t)id;
+}
+
+// The encountering thread passes its ID and radix to the implicit tasks of the team
+static void on_parallel_begin(ompt_data_t *encountering_task_data, const void *encountering_task_frame,
+        ompt_data_t *parallel_data, unsigned requested_parallelism, int flags, const void *codeptr_ra)
+{
+    int id = fi_thread_cur;
+    parallel_data->value = pack(( id >= 0 ? id : own_id() ), cur_radix);
+}
+
+// Mixed radix ID of the thread of index in the team, restored at the end of the implicit task. The end
+// has no parallel_data, the task keeps the ID the thread had before
+static void on_implicit_task(int endpoint, ompt_data_t *parallel_data, ompt_data_t *task_data,
+        unsigned actual_parallelism, unsigned index, int flags)
+{
+    if(endpoint != ompt_scope_begin) {
+        fi_thread_cur = (int)(uint32_t)task_data->value;
+        cur_radix = (unsigned)( task_data->value >> 32 );
+        return;
+    }
+
+    task_data->value = pack(fi_thread_cur, cur_radix);
+    int id;
+    unsigned radix;
+    if(flags & ompt_task_initial) {
+        id = own_id();
+        radix = 1;
+    }
+    else {
+        int parent = (int)(uint32_t)parallel_data->value;
+        unsigned parent_radix = (unsigned)( parallel_data->value >> 32 );
+        id = parent + (int)( parent_radix * index );
+        radix = parent_radix * actual_parallelism;
+        assert(id < FI_THREAD_FOREIGN && "Logical thread ID out of range, FI_THREAD_FOREIGN\n");
+    }
+    update_max(id);
+    cur_radix = radix;
+    fi_thread_cur = id;
+}
+
+static int ompt_init(ompt_function_lookup_t lookup, int initial_device_num, ompt_data_t *tool_data)
+{
+    ompt_set_callback_t set_callback = (ompt_set_callback_t)lookup("ompt_set_callback");
+    ompt_active = ( set_callback != NULL &&
+            set_callback(ompt_callback_parallel_begin, (ompt_callback_t)on_parallel_begin) == ompt_set_always &&
+            set_callback(ompt_callback_implicit_task, (ompt_callback_t)on_implicit_task) == ompt_set_always );
+    // XXX: 0 deactivates the tool, the lookup stays with omp_get_*()
+    return ompt_active;
+}
+
+static void ompt_fini(ompt_data_t *tool_data)
+{
+}
+
+// XXX: Default visibility, the static runtimes are compiled with -fvisibility=hidden
+__attribute__((visibility("default")))
+ompt_start_tool_result_t *ompt_start_tool(unsigned int omp_version, const char *runtime_version)
+{
+    static ompt_start_tool_result_t result = { ompt_init, ompt_fini, { 0 } };
+    return &result;
+}
+#endif
+
+int fi_thread_lookup(void)
+{
+    if(in_lookup)
+        return -1;
+
+    // No OpenMP runtime, or a thread outside its teams with OMPT, the ID is kept until a team begins
+    if(omp_get_level == NULL || ompt_active) {
+        int id = ( omp_get_level == NULL ? 0 : own_id() );
+        update_max(id);
+        fi_thread_cur = id;
+        return id;
+    }
+
+    in_lookup = 1;
+    int level = omp_get_level();
+    int num = omp_get_thread_num();
+    if(level == cache_level && num == cache_num) {
+        in_lookup = 0;
+        return cache_id;
+    }
+
+    int id = 0;
+    if(level == 0)
+        id = own_id();
+    else {
+        int radix = 1, l;
+        for(l = 1; l <= level; l++) {
+            id += radix * omp_get_ancestor_thread_num(l);
+            radix *= omp_get_team_size(l);
+        }
+        assert(id < FI_THREAD_FOREIGN && "Logical thread ID out of range, FI_THREAD_FOREIGN\n");
+    }
+    update_max(id);
+
+    cache_id = id;
+    // XXX: Nested levels may change ancestors under the same thread number, look them up every time
+    cache_level = ( level <= 1 ? level : -1 );
+    cache_num = num;
+    in_lookup = 0;
+    return id;
+}
+
+int fi_thread_count(void)
+{
+    return atomic_load(&max_id);
+}
+
+void fi_thread_on_exit(void (*fn)(int id))
+{
+    int ret = pthread_key_create(&exit_key, thread_exit);
+    assert(ret == 0 && "Error creating the thread exit key\n");
+    (void)ret;
+    exit_fn = fn;
+}
+
+void fi_thread_unreachable(int thread, uint64_t fi_index, uint64_t count, int status)
+{
+    fprintf(stderr, "UNREACHABLE thread=%d, fi_index=%"PRIu64", count=%"PRIu64", status=%d\n", thread, fi_index, count, status);
+    FILE *fp = fopen(FI_UNREACHABLE_FNAME, "w");
+    if(fp) {
+        fprintf(fp, "thread=%d, fi_index=%"PRIu64", count=%"PRIu64", status=%d\n", thread, fi_index, count, status);
+        fclose(fp);
+    }
+    // XXX: A failing app keeps its status, run.py classifies the trial by it
+    if(status != 0)
+        return;
+    fflush(NULL);
+    _exit(FI_EXIT_UNREACHABLE);
+}
@@ -0,0 +1,52 @@
+#ifndef _FI_THREAD_H
+#define _FI_THREAD_H
+
+#include <stdint.h>
+
+/* Logical thread IDs of the OpenMP runtimes, the same in profiling and FI runs regardless of the order
+ * threads arrive at their first block. The initial thread is 0, a thread of a level 1 team its
+ * omp_get_thread_num(). Nested teams number in mixed radix of the ancestor thread numbers, outermost
+ * least significant, so thread 0 of a nested team keeps the ID of its parent and the others follow the
+ * IDs of the outer team. Threads not created by OpenMP get IDs from FI_THREAD_FOREIGN in arrival order,
+ * those are not stable. Assumes a single level 1 team at a time */
+#define FI_THREAD_MAX 256
+#define FI_THREAD_FOREIGN (FI_THREAD_MAX/2)
+
+/* A trial whose target (thread, fi_index) was not reached exits with FI_EXIT_UNREACHABLE after writing
+ * FI_UNREACHABLE_FNAME, run.py records it as unreachable and analysis counts it as missing. Checked when
+ * the app exits 0, and when a thread whose ID no other thread takes later, a foreign one, exits */
+#define FI_EXIT_UNREACHABLE 99
+#define FI_UNREACHABLE_FNAME "fi-unreachable.txt"
+
+/* Logical ID of the calling thread, -1 while unknown. With an OMPT capable OpenMP runtime, e.g., libomp,
+ * the implicit task callbacks set it at the start and end of every implicit task, so the hooks read it
+ * with a single TLS load. Without OMPT, e.g., libgomp, it stays -1 in OpenMP threads and every call
+ * takes fi_thread_lookup(). Initial exec, the hooks load it without __tls_get_addr, a dlopen of the
+ * runtime (safire-jit) takes it from the static TLS surplus */
+extern __thread int fi_thread_cur __attribute__((visibility("hidden"), tls_model("initial-exec")));
+
+/* returns the logical ID of the calling thread from omp_get_*(), cached per (level, thread number).
+ * Returns -1 if called from the lookup itself, i.e., blocks of an instrumented OpenMP runtime run by
+ * omp_get_*(), not to be counted */
+int fi_thread_lookup(void);
+
+/* returns the logical ID of the calling thread */
+static inline int fi_thread_id(void)
+{
+    int id = fi_thread_cur;
+    return ( id >= 0 ? id : fi_thread_lookup() );
+}
+
+/* returns one past the largest logical ID returned so far */
+int fi_thread_count(void);
+
+/* calls fn with the ID of a foreign thread when it exits. OpenMP threads are not reported, a later team
+ * may reuse their IDs */
+void fi_thread_on_exit(void (*fn)(int id));
+
+/* writes thread=<t>, fi_index=<n>, count=<c>, status=<s> of the unreached target, c is the count of the
+ * thread and s the exit status of the app, 0 if it has not exited. Exits with FI_EXIT_UNREACHABLE if s
+ * is 0, returns otherwise so the app keeps its status */
+void fi_thread_unreachable(int thread, uint64_t fi_index, uint64_t count, int status);
+
+#endif
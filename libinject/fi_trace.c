@@ -0,0 +1,222 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <inttypes.h>
+#include <string.h>
+#include <assert.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include "fi_trace.h"
+
+#define FI_TRACE_THREADS 256
+#define FI_TRACE_BUFSIZE (1 << 20)
+// XXX: max LEB128 length of a uint64_t
+#define FI_TRACE_TOKEN_MAX 10
+
+// XXX: Double buffered, the thread fills one buffer while the writer thread writes the other.
+// The thread waits only if it fills a buffer before the writer is done with the previous one
+typedef struct {
+    uint64_t hist[FI_TRACE_HIST];
+    uint64_t run_len;
+    unsigned run_period;
+    uint8_t *buf[2];
+    atomic_int busy[2];
+    int cur;
+    size_t len;
+    FILE *fp;
+} fi_trace_t;
+
+static fi_trace_t *traces[FI_TRACE_THREADS];
+
+// Writer queue, each thread has at most 2 buffers in flight
+#define FI_TRACE_QSIZE (2 * FI_TRACE_THREADS)
+static struct {
+    fi_trace_t *t;
+    int b;
+    size_t len;
+} queue[FI_TRACE_QSIZE];
+static unsigned qhead = 0, qtail = 0;
+static int writer_exit = 0;
+// Rank of the process, -1 if not ranked
+static int trace_rank = -1;
+static pthread_t writer;
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t job_cond = PTHREAD_COND_INITIALIZER;
+static pthread_cond_t done_cond = PTHREAD_COND_INITIALIZER;
+
+static void *writer_main(void *arg)
+{
+    (void)arg;
+    pthread_mutex_lock(&lock);
+    for(;;) {
+        while(qhead == qtail && !writer_exit)
+            pthread_cond_wait(&job_cond, &lock);
+        if(qhead == qtail)
+            break;
+        fi_trace_t *t = queue[qhead % FI_TRACE_QSIZE].t;
+        int b = queue[qhead % FI_TRACE_QSIZE].b;
+        size_t len = queue[qhead % FI_TRACE_QSIZE].len;
+        qhead++;
+
+        pthread_mutex_unlock(&lock);
+        size_t ret = fwrite(t->buf[b], 1, len, t->fp);
+        assert(ret == len && "Error writing trace file\n");
+        pthread_mutex_lock(&lock);
+
+        atomic_store(&t->busy[b], 0);
+        pthread_cond_broadcast(&done_cond);
+    }
+    pthread_mutex_unlock(&lock);
+    return NULL;
+}
+
+// Hand the current buffer to the writer and switch to the other one
+static void flush(fi_trace_t *t)
+{
+    if(t->len == 0)
+        return;
+
+    pthread_mutex_lock(&lock);
+    assert(qtail - qhead < FI_TRACE_QSIZE && "Trace writer queue is full\n");
+    atomic_store(&t->busy[t->cur], 1);
+    queue[qtail % FI_TRACE_QSIZE].t = t;
+    queue[qtail % FI_TRACE_QSIZE].b = t->cur;
+    queue[qtail % FI_TRACE_QSIZE].len = t->len;
+    qtail++;
+    pthread_cond_signal(&job_cond);
+
+    t->cur ^= 1;
+    t->len = 0;
+    while(atomic_load(&t->busy[t->cur]))
+        pthread_cond_wait(&done_cond, &lock);
+    pthread_mutex_unlock(&lock);
+}
+
+static inline void put_token(fi_trace_t *t, uint64_t v)
+{
+    if(t->len + FI_TRACE_TOKEN_MAX > FI_TRACE_BUFSIZE)
+        flush(t);
+    uint8_t *p = t->buf[t->cur] + t->len;
+    while(v >= 0x80) {
+        *p++ = (uint8_t)(v | 0x80);
+        v >>= 7;
+    }
+    *p++ = (uint8_t)v;
+    t->len = p - t->buf[t->cur];
+}
+
+static inline void push_hist(fi_trace_t *t, uint64_t site)
+{
+    memmove(&t->hist[1], &t->hist[0], (FI_TRACE_HIST - 1) * sizeof(uint64_t));
+    t->hist[0] = site;
+}
+
+static void put_run(fi_trace_t *t)
+{
+    put_token(t, ( t->run_len << 3 ) | ( (uint64_t)( t->run_period - 1 ) << 1 ) | 1);
+    t->run_len = 0;
+}
+
+static fi_trace_t *new_trace(int tid)
+{
+    fi_trace_t *t = calloc(1, sizeof(fi_trace_t));
+    assert(t != NULL && "Error allocating trace\n");
+    t->buf[0] = malloc(FI_TRACE_BUFSIZE);
+    t->buf[1] = malloc(FI_TRACE_BUFSIZE);
+    assert(t->buf[0] != NULL && t->buf[1] != NULL && "Error allocating trace buffers\n");
+
+    char fname[64];
+    if(trace_rank >= 0)
+        sprintf(fname, FI_TRACE_RANK_FNAME, trace_rank, tid);
+    else
+        sprintf(fname, FI_TRACE_FNAME, tid);
+    t->fp = fopen(fname, "w");
+    assert(t->fp != NULL && "Error opening trace file\n");
+    fi_trace_hdr_t hdr = { FI_TRACE_MAGIC, tid };
+    fwrite(&hdr, sizeof(hdr), 1, t->fp);
+    return t;
+}
+
+int fi_trace_enabled(void)
+{
+    const char *s = getenv("FI_TRACE");
+    return ( s != NULL && strcmp(s, "1") == 0 );
+}
+
+void fi_trace_init(int rank)
+{
+    trace_rank = rank;
+    int ret = pthread_create(&writer, NULL, writer_main, NULL);
+    assert(ret == 0 && "Error creating trace writer thread\n");
+}
+
+void fi_trace_add(int tid, uint64_t site)
+{
+    assert(site != 0 && "site ID is 0, binary not compiled with -fi-sites?\n");
+    assert( ( tid >= 0 && tid < FI_TRACE_THREADS ) && "tid out of range\n");
+
+    fi_trace_t *t = traces[tid];
+    if(!t)
+        t = traces[tid] = new_trace(tid);
+
+    // Loop repetition, extend the run
+    if(t->run_len > 0 && t->hist[t->run_period - 1] == site) {
+        t->run_len++;
+        push_hist(t, site);
+        return;
+    }
+    if(t->run_len > 0)
+        put_run(t);
+
+    // Start a run at the shortest period site repeats
+    unsigned p;
+    for(p = 1; p <= FI_TRACE_HIST; p++) {
+        if(t->hist[p - 1] == site) {
+            t->run_period = p;
+            t->run_len = 1;
+            push_hist(t, site);
+            return;
+        }
+    }
+
+    // Literal, zigzag delta from the previous site, the site itself if the delta needs more than 62 bits
+    int64_t delta = (int64_t)( site - t->hist[0] );
+    uint64_t zigzag = ( (uint64_t)delta << 1 ) ^ (uint64_t)( delta >> 63 );
+    if(zigzag < ( UINT64_C(1) << 62 ))
+        put_token(t, zigzag << 2);
+    else {
+        put_token(t, 2);
+        put_token(t, site);
+    }
+    push_hist(t, site);
+}
+
+void fi_trace_fini(void)
+{
+    int i;
+    for(i = 0; i < FI_TRACE_THREADS; i++) {
+        fi_trace_t *t = traces[i];
+        if(!t)
+            continue;
+        if(t->run_len > 0)
+            put_run(t);
+        flush(t);
+    }
+
+    pthread_mutex_lock(&lock);
+    writer_exit = 1;
+    pthread_cond_signal(&job_cond);
+    pthread_mutex_unlock(&lock);
+    pthread_join(writer, NULL);
+
+    for(i = 0; i < FI_TRACE_THREADS; i++) {
+        fi_trace_t *t = traces[i];
+        if(!t)
+            continue;
+        fclose(t->fp);
+        free(t->buf[0]);
+        free(t->buf[1]);
+        free(t);
+        traces[i] = NULL;
+    }
+}
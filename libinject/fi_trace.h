@@ -0,0 +1,37 @@
+#ifndef _FI_TRACE_H
+#define _FI_TRACE_H
+
+#include <stdint.h>
+
+/* Per thread trace of executed sites, for resolving (thread, fi_index) to a static instruction
+ * offline (fi-trace-resolve). Recorded in the profiling run of binaries built with -fi-ff -fi-sites
+ * when FI_TRACE=1, each thread writes FI_TRACE_FNAME: a fi_trace_hdr_t followed by a stream of
+ * LEB128 tokens. The decoder keeps the last FI_TRACE_HIST sites, hist[0] the most recent:
+ *   bits 1:0 = 00, literal:  site = hist[0] + zigzag(token >> 2)
+ *   bits 1:0 = 10, literal:  site = the next token, deltas over 62 bits
+ *   bit 0 = 1, run:          (token >> 3) times, site = hist[(token >> 1) & 3], a loop repeating with period 1..4
+ * Every decoded site is pushed to hist */
+#define FI_TRACE_FNAME "fi-trace.%d.bin"
+/* Ranked runtimes prefix the name with the rank of the process */
+#define FI_TRACE_RANK_FNAME "%d.fi-trace.%d.bin"
+#define FI_TRACE_MAGIC UINT32_C(0x46495452) /* "FITR" */
+#define FI_TRACE_HIST 4
+
+typedef struct {
+    uint32_t magic;
+    int32_t thread;
+} fi_trace_hdr_t;
+
+/* returns non-zero if the trace is requested, FI_TRACE=1 */
+int fi_trace_enabled(void);
+
+/* starts the writer thread, rank >= 0 names the traces FI_TRACE_RANK_FNAME */
+void fi_trace_init(int rank);
+
+/* appends site to the trace of thread tid, called only by that thread */
+void fi_trace_add(int tid, uint64_t site);
+
+/* flushes the traces of all threads and stops the writer thread */
+void fi_trace_fini(void);
+
+#endif
@@ -0,0 +1,261 @@
+// Resolves FI targets to static instructions from the per thread site traces (fi-trace.<tid>.bin) of a
+// FI_TRACE=1 profiling run, without re-executing the program. The static site maps give the number of
+// target instructions of each site and the function, opcode and source location of each one. Traces of
+// the MPI runtimes are <rank>.fi-trace.<tid>.bin, selected by the rank= of a target or by -r.
+//
+// usage: fi-trace-resolve -s <module>-fi-sites.txt [-s ...] [-d tracedir] [-r rank] [-i fi-inject.txt | thread fi_index ...]
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstdint>
+#include <cinttypes>
+#include <cstring>
+#include <cassert>
+#include <vector>
+#include <string>
+#include <map>
+#include <unordered_map>
+#include <algorithm>
+#include <unistd.h>
+
+extern "C" {
+#include "fi_trace.h"
+}
+
+struct SiteInst {
+    std::string func;
+    std::string opcode;
+    std::string loc;
+};
+
+struct Target {
+    int rank;
+    int thread;
+    uint64_t fi_index;
+};
+
+// Reads the static site maps, site=0x..., inst=N, func=F, class=C, width=W, opcode=O[, loc=L]
+static void parse_sites(const char *fname, std::unordered_map< uint64_t, std::vector<SiteInst> > &sites)
+{
+    FILE *fp = fopen(fname, "r");
+    if(!fp) {
+        perror(fname);
+        exit(1);
+    }
+    char line[4096];
+    while(fgets(line, sizeof(line), fp)) {
+        uint64_t site, inst;
+        if(sscanf(line, "site=%" SCNx64 ", inst=%" SCNu64, &site, &inst) != 2) {
+            fprintf(stderr, "Invalid site map line: %s", line);
+            exit(1);
+        }
+        line[strcspn(line, "\n")] = '\0';
+        auto field = [&line](const char *key) {
+            const char *p = strstr(line, key);
+            if(!p)
+                return std::string("??");
+            p += strlen(key);
+            return std::string(p, strcspn(p, ","));
+        };
+        std::vector<SiteInst> &insts = sites[site];
+        if(insts.size() < inst)
+            insts.resize(inst);
+        insts[inst-1] = SiteInst{ field(", func="), field(", opcode="), field(", loc=") };
+    }
+    fclose(fp);
+}
+
+// Reads [rank=R, ][thread=T, ]fi_index=N lines, e.g., fi-target.txt or fi-inject.txt. Thread 0 and
+// the rank of -r if missing
+static void parse_targets(const char *fname, int rank, std::vector<Target> &targets)
+{
+    FILE *fp = fopen(fname, "r");
+    if(!fp) {
+        perror(fname);
+        exit(1);
+    }
+    char line[4096];
+    while(fgets(line, sizeof(line), fp)) {
+        Target t = { rank, 0, 0 };
+        int n = 0;
+        if(sscanf(line, "rank=%d, %n", &t.rank, &n) != 1)
+            n = 0;
+        const char *p = line + n;
+        if(sscanf(p, "thread=%d, fi_index=%" SCNu64, &t.thread, &t.fi_index) != 2 &&
+                sscanf(p, "fi_index=%" SCNu64, &t.fi_index) != 1) {
+            fprintf(stderr, "Invalid target line: %s", line);
+            exit(1);
+        }
+        targets.push_back(t);
+    }
+    fclose(fp);
+}
+
+class TraceReader {
+    public:
+        TraceReader(FILE *fp) : fp(fp), run_len(0), run_period(0) {
+            memset(hist, 0, sizeof(hist));
+        }
+
+        // Next site of the trace, 0 at the end
+        uint64_t next() {
+            if(run_len == 0) {
+                uint64_t token;
+                if(!get(token))
+                    return 0;
+                if(token & 1) {
+                    run_len = token >> 3;
+                    run_period = ( ( token >> 1 ) & 3 ) + 1;
+                }
+                else {
+                    uint64_t site;
+                    if(token & 2) {
+                        bool ok = get(site);
+                        assert(ok && "Truncated trace\n");
+                    }
+                    else {
+                        uint64_t zigzag = token >> 2;
+                        int64_t delta = (int64_t)( zigzag >> 1 ) ^ -(int64_t)( zigzag & 1 );
+                        site = hist[0] + (uint64_t)delta;
+                    }
+                    push(site);
+                    return site;
+                }
+            }
+            run_len--;
+            uint64_t site = hist[run_period - 1];
+            push(site);
+            return site;
+        }
+
+    private:
+        bool get(uint64_t &v) {
+            v = 0;
+            int c;
+            for(unsigned shift = 0; ( c = getc_unlocked(fp) ) != EOF; shift += 7) {
+                v |= (uint64_t)( c & 0x7f ) << shift;
+                if(!( c & 0x80 ))
+                    return true;
+            }
+            return false;
+        }
+
+        void push(uint64_t site) {
+            memmove(&hist[1], &hist[0], ( FI_TRACE_HIST - 1 ) * sizeof(uint64_t));
+            hist[0] = site;
+        }
+
+        FILE *fp;
+        uint64_t hist[FI_TRACE_HIST];
+        uint64_t run_len;
+        unsigned run_period;
+};
+
+static void usage(const char *prog)
+{
+    fprintf(stderr, "usage: %s -s <module>-fi-sites.txt [-s ...] [-d tracedir] [-r rank] [-i targets.txt | thread fi_index ...]\n", prog);
+    exit(1);
+}
+
+int main(int argc, char *argv[])
+{
+    std::vector<const char *> mapfnames;
+    std::string tracedir = ".";
+    std::vector<const char *> targetfnames;
+    std::vector<Target> targets;
+    int rank = -1;
+
+    int opt;
+    while( ( opt = getopt(argc, argv, "s:d:r:i:") ) != -1 ) {
+        switch(opt) {
+            case 's': mapfnames.push_back(optarg); break;
+            case 'd': tracedir = optarg; break;
+            case 'r': rank = atoi(optarg); break;
+            case 'i': targetfnames.push_back(optarg); break;
+            default: usage(argv[0]);
+        }
+    }
+    if( ( argc - optind ) % 2 != 0 )
+        usage(argv[0]);
+    for(const char *fname : targetfnames)
+        parse_targets(fname, rank, targets);
+    for(int i = optind; i < argc; i += 2)
+        targets.push_back(Target{ rank, atoi(argv[i]), strtoull(argv[i+1], nullptr, 10) });
+    if(mapfnames.empty() || targets.empty())
+        usage(argv[0]);
+    for(const Target &t : targets) {
+        if(t.fi_index == 0) {
+            fprintf(stderr, "fi_index must be > 0\n");
+            return 1;
+        }
+    }
+
+    std::unordered_map< uint64_t, std::vector<SiteInst> > sites;
+    for(const char *fname : mapfnames)
+        parse_sites(fname, sites);
+
+    // One pass over each thread's trace, targets in fi_index order
+    std::map< std::pair<int, int>, std::vector<uint64_t> > bythread;
+    for(const Target &t : targets)
+        bythread[std::make_pair(t.rank, t.thread)].push_back(t.fi_index);
+
+    int ret = 0;
+    for(auto &tt : bythread) {
+        int trank = tt.first.first;
+        int thread = tt.first.second;
+        std::vector<uint64_t> &fi_indexes = tt.second;
+        std::sort(fi_indexes.begin(), fi_indexes.end());
+
+        char fname[64];
+        if(trank >= 0)
+            sprintf(fname, FI_TRACE_RANK_FNAME, trank, thread);
+        else
+            sprintf(fname, FI_TRACE_FNAME, thread);
+        std::string path = tracedir + "/" + fname;
+        FILE *fp = fopen(path.c_str(), "r");
+        if(!fp) {
+            perror(path.c_str());
+            return 1;
+        }
+        fi_trace_hdr_t hdr;
+        if(fread(&hdr, sizeof(hdr), 1, fp) != 1 || hdr.magic != FI_TRACE_MAGIC || hdr.thread != thread) {
+            fprintf(stderr, "Invalid trace file %s\n", path.c_str());
+            return 1;
+        }
+
+        TraceReader reader(fp);
+        std::unordered_map<uint64_t, uint64_t> occurrences;
+        uint64_t fi_iterator = 0;
+        size_t i = 0;
+        while(i < fi_indexes.size()) {
+            uint64_t site = reader.next();
+            if(site == 0)
+                break;
+            auto it = sites.find(site);
+            if(it == sites.end()) {
+                fprintf(stderr, "Site 0x%016" PRIx64 " missing from the site maps\n", site);
+                return 1;
+            }
+            const std::vector<SiteInst> &insts = it->second;
+            uint64_t occurrence = ++occurrences[site];
+            for(; i < fi_indexes.size() && fi_indexes[i] <= fi_iterator + insts.size(); i++) {
+                uint64_t inst = fi_indexes[i] - fi_iterator;
+                const SiteInst &si = insts[inst-1];
+                if(trank >= 0)
+                    printf("rank=%d, ", trank);
+                printf("thread=%d, fi_index=%" PRIu64 ", site=0x%016" PRIx64 ", inst=%" PRIu64 ", occurrence=%" PRIu64 ", func=%s, opcode=%s, loc=%s\n",
+                        thread, fi_indexes[i], site, inst, occurrence, si.func.c_str(), si.opcode.c_str(), si.loc.c_str());
+            }
+            fi_iterator += insts.size();
+        }
+        for(; i < fi_indexes.size(); i++) {
+            if(trank >= 0)
+                fprintf(stderr, "rank=%d, ", trank);
+            fprintf(stderr, "thread=%d, fi_index=%" PRIu64 " beyond the trace, %" PRIu64 " target instructions\n", thread, fi_indexes[i], fi_iterator);
+            ret = 1;
+        }
+        fclose(fp);
+    }
+
+    return ret;
+}
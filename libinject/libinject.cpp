@@ -0,0 +1,62 @@
+// The hooks of one runtime of the matrix, see fi_runtime.h. CMakeLists.txt compiles this file once per
+// libinject_*.so, the policies are given by FI_OMP, FI_MPI, FI_FF (0 or 1) and FI_FAULTS (a fault model).
+// FI_STATS=1 adds the hook accounting of HookStats
+
+#include <type_traits>
+#include "fi_runtime.h"
+
+#if !defined(FI_OMP) || !defined(FI_MPI) || !defined(FI_FF) || !defined(FI_FAULTS)
+#error "FI_OMP, FI_MPI, FI_FF and FI_FAULTS must be defined"
+#endif
+#ifndef FI_STATS
+#define FI_STATS 0
+#endif
+
+typedef fi::Runtime<
+    std::conditional<FI_OMP, fi::OpenMP, fi::Serial>::type,
+    std::conditional<FI_MPI, fi::Mpi, fi::Single>::type,
+    std::conditional<FI_FF, fi::Blocks, fi::Insts>::type,
+    fi::FI_FAULTS,
+    std::conditional<FI_STATS, fi::HookStats, fi::NoStats>::type> runtime;
+
+double fi::BitDistFault::weights[fi::BitDistFault::kMaxBits];
+fi::HookStats::thread_stats fi::HookStats::stats[FI_THREAD_MAX];
+double fi::HookStats::t_init;
+uint64_t fi::HookStats::tsc_init;
+
+extern "C" {
+
+const int safire_hook_abi_v2 = FI_HOOK_ABI_VERSION;
+
+// XXX: Without -fi-ff binaries call only selInst, a runtime without selMBB fails to link with a -fi-ff binary
+#if FI_FF
+uint64_t selMBB(uint64_t num_insts, uint64_t site)
+{
+    return runtime::selMBB(num_insts, site, __builtin_return_address(0));
+}
+#endif
+
+uint64_t selInst(uint64_t site, uint64_t inst)
+{
+    return runtime::selInst(site, inst);
+}
+
+uint64_t doInject(uint64_t num_ops, const uint64_t *size, uint8_t *bitmask)
+{
+    return runtime::doInject(num_ops, size, bitmask);
+}
+
+}
+
+static void init() __attribute__((constructor));
+static void fini() __attribute__((destructor));
+
+static void init()
+{
+    runtime::init();
+}
+
+static void fini()
+{
+    runtime::fini();
+}
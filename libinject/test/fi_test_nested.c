@@ -0,0 +1,129 @@
+// Replays K adjacent targets across a call with the hook calls of -fi-ff code. Each iteration runs a
+// caller block of 3 targets whose call, after its first target, runs a callee block of 2 targets, so
+// the profile numbers the caller 1..3 and the callee 4..5 from the count before the iteration. The
+// callee targets fire before the pending ones of the caller. The targets are drawn (fi-target.txt) and
+// then reproduced (fi-inject.txt), each run in a child process since the runtime reads them at init.
+// Exits non-zero if a target is missed or hit at the wrong instruction
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <inttypes.h>
+#include <unistd.h>
+#include <sys/wait.h>
+#include "../fi_hooks.h"
+
+#define ITERS 4
+#define CALLER_SITE 0x10
+#define CALLER_INSTS 3
+#define CALLEE_SITE 0x20
+#define CALLEE_INSTS 2
+#define ITER_INSTS ( CALLER_INSTS + CALLEE_INSTS )
+
+// fi_index of the targets: caller insts 2, 3 and callee insts 1, 2 of iteration 1, caller inst 3 of
+// iteration 2
+static const uint64_t targets[] = { 7, 8, 9, 10, 13 };
+#define NTARGETS ( sizeof(targets) / sizeof(targets[0]) )
+
+static const uint64_t sizes[1] = { 8 };
+static uint64_t hits[NTARGETS];
+static unsigned nhits = 0;
+
+static void step(uint64_t site, uint64_t inst, uint64_t fi_index)
+{
+    uint8_t bitmask[8];
+    if(selInst(site, inst)) {
+        doInject(1, sizes, bitmask);
+        if(nhits < NTARGETS)
+            hits[nhits] = fi_index;
+        nhits++;
+    }
+}
+
+static void callee(uint64_t base)
+{
+    uint64_t inst;
+    if(selMBB(CALLEE_INSTS, CALLEE_SITE) != 1)
+        return;
+    for(inst = 1; inst <= CALLEE_INSTS; inst++)
+        step(CALLEE_SITE, inst, base + CALLER_INSTS + inst);
+}
+
+// XXX: The blocks of a detached caller run the uninstrumented clone, which still calls the callee
+static void caller(uint64_t base)
+{
+    uint64_t inst;
+    if(selMBB(CALLER_INSTS, CALLER_SITE) != 1) {
+        callee(base);
+        return;
+    }
+    for(inst = 1; inst <= CALLER_INSTS; inst++) {
+        step(CALLER_SITE, inst, base + inst);
+        if(inst == 1)
+            callee(base);
+    }
+}
+
+static int run(void)
+{
+    uint64_t expect[NTARGETS] = { 9, 10, 7, 8, 13 };
+    unsigned i;
+    int it;
+    for(it = 0; it < ITERS; it++)
+        caller((uint64_t)it * ITER_INSTS);
+
+    int ok = ( nhits == NTARGETS );
+    for(i = 0; ok && i < NTARGETS; i++)
+        ok = ( hits[i] == expect[i] );
+    if(!ok) {
+        fprintf(stderr, "nested: %u hits of %zu:", nhits, NTARGETS);
+        for(i = 0; i < nhits && i < NTARGETS; i++)
+            fprintf(stderr, " %" PRIu64, hits[i]);
+        fprintf(stderr, "\n");
+    }
+    return ( ok ? 0 : 1 );
+}
+
+static int spawn(const char *prog, const char *stage)
+{
+    int status;
+    pid_t pid = fork();
+    if(pid == 0) {
+        execl(prog, prog, stage, (char *)NULL);
+        _exit(127);
+    }
+    if(pid < 0 || waitpid(pid, &status, 0) != pid)
+        return -1;
+    return ( WIFEXITED(status) ? WEXITSTATUS(status) : -1 );
+}
+
+int main(int argc, char *argv[])
+{
+    if(argc > 1)
+        return run();
+
+    unlink("fi-inject.txt");
+    unlink("fi-unreachable.txt");
+    FILE *fp = fopen("fi-target.txt", "w");
+    if(!fp) {
+        perror("fi-target.txt");
+        _exit(1);
+    }
+    unsigned i;
+    for(i = 0; i < NTARGETS; i++)
+        fprintf(fp, "fi_index=%" PRIu64 "\n", targets[i]);
+    fclose(fp);
+
+    int ret = spawn(argv[0], "random");
+    printf("nested random: %d\n", ret);
+    unlink("fi-target.txt");
+    if(ret == 0) {
+        ret = spawn(argv[0], "replay");
+        printf("nested replay: %d\n", ret);
+    }
+    unlink("fi-inject.txt");
+    // XXX: This process has no target, skip the profile the runtime writes at exit
+    fflush(stdout);
+    _exit(ret == 0 ? 0 : 1);
+}
@@ -56,6 +56,10 @@ namespace llvm {
   /* ggeorgak */
   /// MCFaultInjection pass
   MachineFunctionPass *createMCFaultInjectionPass();
+
+  /// isMCFaultInjectionEnabled - True if the MCFaultInjection pass instruments
+  /// code (-fi or -fi-mbb-liveins)
+  bool isMCFaultInjectionEnabled();
   /* ggeorgak */
 
   /// createCodeGenPreparePass - Transform the code to expose more pattern
@@ -26,20 +26,33 @@ namespace llvm {
         public:
             TargetFaultInjection();
             virtual ~TargetFaultInjection();
+            // ResumeMBB, if not null, holds the instructions after MI when PostFIMBB holds MI alone
+            // (INJECT_BEFORE), FIMBBs undo the source fault after MI and resume there.
+            // SiteID and InstIdx (1-based, in selInst order) identify MI to selInst, SiteID is 0 without FF
             virtual void injectFault(MachineFunction &MF,
                     MachineInstr &MI,
                     std::vector<MCPhysReg> const &FIRegs,
+                    unsigned MemSize,
+                    uint64_t SiteID,
+                    unsigned InstIdx,
                     MachineBasicBlock &InstSelMBB,
                     MachineBasicBlock &PreFIMBB,
                     SmallVector<MachineBasicBlock *, 4> &OpSelMBBs,
                     SmallVector<MachineBasicBlock *, 4> &FIMBBs,
-                    MachineBasicBlock &PostFIMBB) const = 0;
+                    MachineBasicBlock &PostFIMBB,
+                    MachineBasicBlock *ResumeMBB) const = 0;
             virtual void injectMachineBasicBlock(MachineBasicBlock &SelMBB,
                     MachineBasicBlock &JmpDetachMBB,
                     MachineBasicBlock &JmpFIMBB,
                     MachineBasicBlock &MBB,
                     MachineBasicBlock &CopyMBB,
-                    uint64_t TargetInstrCount) const = 0;
+                    uint64_t TargetInstrCount,
+                    uint64_t SiteID) const = 0;
+            // Access size in bytes of the destination memory operand of MI if the target can
+            // inject faults to it, 0 otherwise
+            virtual unsigned getStoreFISize(const MachineInstr &MI) const = 0;
+            // True if the target can inject faults to Reg as a source operand
+            virtual bool isSrcFIReg(MCPhysReg Reg) const = 0;
     };
 } // end namespace llvm
 
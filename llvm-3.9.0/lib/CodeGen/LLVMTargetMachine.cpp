@@ -285,6 +285,11 @@ bool LLVMTargetMachine::addPassesToEmitMC(PassManagerBase &PM, MCContext *&Ctx,
   if (!Ctx)
     return true;
 
+  /* SAFIRE */
+  // Same as addPassesToEmitFile, JIT-compiled code (safire-jit) is fault injected
+  PM.add(createMCFaultInjectionPass());
+  /* SAFIRe */
+
   if (Options.MCOptions.MCSaveTempLabels)
     Ctx->setAllowTemporaryLabels(false);
 
@@ -15,9 +15,11 @@
 
 #include "llvm/CodeGen/Passes.h"
 #include "llvm/CodeGen/MachineFunctionPass.h"
+#include "llvm/ADT/DenseMap.h"
 
 #include "llvm/Target/TargetInstrInfo.h"
 #include "llvm/CodeGen/MachineRegisterInfo.h"
+#include "llvm/CodeGen/LivePhysRegs.h"
 
 #include "llvm/Target/TargetSubtargetInfo.h"
 #include "llvm/Target/TargetMachine.h"
@@ -33,8 +35,12 @@
 #include "llvm/CodeGen/MachineFunctionAnalysis.h"
 #include "llvm/CodeGen/MachineModuleInfo.h"
 #include "llvm/CodeGen/TargetPassConfig.h"
+#include "llvm/IR/Constants.h"
+#include "llvm/IR/DebugInfoMetadata.h"
 #include "llvm/IR/IRPrintingPasses.h"
 #include "llvm/IR/LegacyPassManager.h"
+#include "llvm/IR/Metadata.h"
+#include "llvm/IR/Module.h"
 #include "llvm/IR/Verifier.h"
 #include "llvm/MC/MCAsmInfo.h"
 #include "llvm/MC/MCContext.h"
@@ -50,6 +56,8 @@
 #include "llvm/Transforms/Scalar.h"
 #include "llvm/MC/MCRegisterInfo.h"
 #include "llvm/Support/RandomNumberGenerator.h"
+#include "llvm/Support/MD5.h"
+#include "llvm/Support/Format.h"
 
 #include <fstream>
 
@@ -69,6 +77,9 @@ FILiveinsMBBEnable("fi-mbb-liveins", cl::desc("Enable fault injection at the liv
 cl::opt<bool>
 FFEnable("fi-ff", cl::desc("Enable basic block instrumentation and detaching for fast-forwarding instruction level FI"), cl::init(false));
 
+cl::opt<bool>
+FISitesEnable("fi-sites", cl::desc("Save the map of the static site IDs passed to selMBB: <module>-fi-sites.txt (requires -fi-ff)"), cl::init(false));
+
 cl::list<std::string>
 FuncInclList("fi-funcs", cl::CommaSeparated, cl::desc("Fault injected functions"), cl::value_desc("foo1, foo2, foo3, ..."));
 
@@ -82,7 +93,7 @@ cl::list<std::string>
 FIInstTypes("fi-inst-types", cl::CommaSeparated, cl::desc("Fault injected instruction types"), cl::value_desc("data,control,frame"));
 
 cl::list<std::string>
-FIRegTypes("fi-reg-types", cl::CommaSeparated, cl::desc("Fault injected registers"), cl::value_desc("dst, src"));
+FIRegTypes("fi-reg-types", cl::CommaSeparated, cl::desc("Fault injected registers, mem is the destination memory operand of stores"), cl::value_desc("dst, src, mem"));
 
 namespace {
   struct MCFaultInjectionPass : public MachineFunctionPass {
@@ -96,6 +107,21 @@ namespace {
     uint64_t TotalTargetInstrCount;
     std::ofstream InstrumentFile;
 
+    // Prefix of the instrumentation and site maps, <module>[.part<N>]
+    std::string MapPrefix;
+
+    // Static site IDs of instrumented MBBs, passed to selMBB and selInst in FF: hash of module and
+    // function (high 40 bits) | MBB counter in the function (low 24 bits). IDs depend only on the
+    // function, not on how parallel or ThinLTO codegen partitions the code, so they are the same across builds
+    uint64_t SiteFuncHash;
+    uint64_t SiteCount;
+    std::ofstream SitesFile;
+
+    // Access size of the destination memory operand of target instructions, -fi-reg-types=mem
+    DenseMap<MachineInstr *, unsigned> MemFISize;
+    // ResumeMBB of the source target of an instruction, its destination target is instrumented next
+    DenseMap<MachineInstr *, MachineBasicBlock *> SrcResumeMBB;
+
     Module *M;
   public:
     static char ID;
@@ -103,6 +129,7 @@ namespace {
     MCFaultInjectionPass() : MachineFunctionPass(ID) {
       if(FIEnable) dbgs() << "==== MCFAULTINJECTIONPASS ====\n"; //DBG_SAFIRE
       TotalInstrCount = 0; TotalTargetInstrCount = 0;
+      SiteFuncHash = 0; SiteCount = 0;
     }
 
     ~MCFaultInjectionPass() {
@@ -114,8 +141,25 @@ namespace {
 
     bool doInitialization(Module &M) override {
       this->M = &M;
+      // XXX: partitions of parallel codegen (ParallelCG.cpp) keep the module identifier and are
+      // numbered by the fi-partition module flag, each writes its own maps, the linker merges them
+      MapPrefix = M.getName();
+      if(auto *Part = mdconst::extract_or_null<ConstantInt>(M.getModuleFlag("fi-partition")))
+        MapPrefix += ".part" + std::to_string(Part->getZExtValue());
       if(SaveInstrEnable)
-        InstrumentFile.open((M.getName() + "-instrument.txt").str(), std::fstream::out);
+        InstrumentFile.open(MapPrefix + "-instrument.txt", std::fstream::out);
+      if(FISitesEnable) {
+        assert(FFEnable && "-fi-sites requires -fi-ff, selMBB passes the site ID\n");
+        SitesFile.open(MapPrefix + "-fi-sites.txt", std::fstream::out);
+      }
+      // Hook ABI v2: the instrumented code references the version symbol of the runtime, linking or
+      // loading against a libinject of the earlier ABI fails on the undefined symbol
+      // XXX: the private pointer is never read, it only carries the relocation
+      if(FIEnable || FILiveinsMBBEnable) {
+        Constant *ABI = M.getOrInsertGlobal("safire_hook_abi_v2", Type::getInt32Ty(M.getContext()));
+        if(!M.getNamedGlobal("safire.hook.abi"))
+          new GlobalVariable(M, ABI->getType(), true, GlobalValue::PrivateLinkage, ABI, "safire.hook.abi");
+      }
       return false;
     }
 
@@ -123,6 +167,8 @@ namespace {
       //dbgs() << "MCFIPass finalize!" << "\n";
       if(SaveInstrEnable)
         InstrumentFile.close();
+      if(FISitesEnable)
+        SitesFile.close();
       return false;
     }
 
@@ -137,7 +183,8 @@ namespace {
         printMachineBasicBlock(MBB);
     }
 
-    void instrumentRegs(MachineInstr &MI, std::vector<MCPhysReg> const &FIRegs, InjectPoint IT) {
+    void instrumentRegs(MachineInstr &MI, std::vector<MCPhysReg> const &FIRegs, InjectPoint IT, uint64_t SiteID, unsigned InstIdx,
+        unsigned MemSize = 0, bool RestoreSrc = false) {
       MachineBasicBlock &MBB = *MI.getParent();
       MachineFunction &MF = *MBB.getParent();
       MachineBasicBlock::instr_iterator Iter = MI.getIterator();
@@ -148,7 +195,8 @@ namespace {
       MachineBasicBlock *PreFIMBB = MF.CreateMachineBasicBlock(nullptr);
       SmallVector<MachineBasicBlock *, 4> OpSelMBBs;
       SmallVector<MachineBasicBlock *, 4> FIMBBs;
-      for(unsigned i = 0; i < FIRegs.size(); i++) {
+      // The memory operand, if any, is the last operand after the registers
+      for(unsigned i = 0; i < FIRegs.size() + (MemSize ? 1 : 0); i++) {
         OpSelMBBs.push_back(MF.CreateMachineBasicBlock(nullptr));
         FIMBBs.push_back(MF.CreateMachineBasicBlock(nullptr));
       }
@@ -176,7 +224,31 @@ namespace {
       MBBI = FIMBBs.back()->getIterator();
       MF.insert(++MBBI, PostFIMBB);
 
-      TFI->injectFault(MF, MI, FIRegs, *InstSelMBB, *PreFIMBB, OpSelMBBs, FIMBBs, *PostFIMBB);
+      // XXX: to undo a source fault after MI, PostFIMBB holds MI alone and the rest of the block
+      // goes to ResumeMBB. Terminators cannot be followed by the restore, their faults persist
+      MachineBasicBlock *ResumeMBB = nullptr;
+      if(IT == INJECT_BEFORE && RestoreSrc && !MI.isTerminator()) {
+        ResumeMBB = MF.CreateMachineBasicBlock(nullptr);
+        MBBI = PostFIMBB->getIterator();
+        MF.insert(++MBBI, ResumeMBB);
+        // XXX: Live-ins of ResumeMBB, the registers live after MI. The destination target of MI is
+        // instrumented in the block falling through to it and finds its live registers from here
+        const TargetRegisterInfo &TRI = *MF.getSubtarget().getRegisterInfo();
+        LivePhysRegs LiveRegs(&TRI);
+        LiveRegs.addLiveOuts(MBB);
+        for(auto I = MBB.rbegin(); &*I != &MI; ++I)
+          LiveRegs.stepBackward(*I);
+        for(MCPhysReg Reg : LiveRegs) {
+          bool ContainsSuperReg = false;
+          for(MCSuperRegIterator SReg(Reg, &TRI); SReg.isValid(); ++SReg)
+            ContainsSuperReg |= LiveRegs.contains(*SReg);
+          if(!ContainsSuperReg)
+            ResumeMBB->addLiveIn(Reg);
+        }
+        SrcResumeMBB[&MI] = ResumeMBB;
+      }
+
+      TFI->injectFault(MF, MI, FIRegs, MemSize, SiteID, InstIdx, *InstSelMBB, *PreFIMBB, OpSelMBBs, FIMBBs, *PostFIMBB, ResumeMBB);
 
       if(IT == INJECT_BEFORE)
         PostFIMBB->splice(PostFIMBB->end(), &MBB, Iter, MBB.end());
@@ -189,7 +261,29 @@ namespace {
       MachineBasicBlock *TBB = nullptr, *FBB = nullptr;
       SmallVector<MachineOperand, 4> Cond;
 
-      if(!TII.analyzeBranch(*PostFIMBB, TBB, FBB, Cond))
+      // XXX: The restore path of the source target of MI runs MI and jumps to its ResumeMBB, past this
+      // destination target. Jump to the InstSelMBB here instead, so a fired source target does not skip it
+      if(IT == INJECT_AFTER) {
+        if(MachineBasicBlock *SrcResume = SrcResumeMBB.lookup(&MI)) {
+          SmallVector<MachineBasicBlock *, 4> RestoreMBBs;
+          for(auto Pred : SrcResume->predecessors())
+            if(Pred != PostFIMBB)
+              RestoreMBBs.push_back(Pred);
+          for(auto RestoreMBB : RestoreMBBs)
+            RestoreMBB->ReplaceUsesOfBlockWith(SrcResume, InstSelMBB);
+        }
+      }
+
+      if(ResumeMBB) {
+        ResumeMBB->splice(ResumeMBB->end(), PostFIMBB, std::next(Iter), PostFIMBB->end());
+        ResumeMBB->transferSuccessors(PostFIMBB);
+        // PostFIMBB falls through to ResumeMBB
+        PostFIMBB->addSuccessor(ResumeMBB);
+
+        if(!TII.analyzeBranch(*ResumeMBB, TBB, FBB, Cond))
+          ResumeMBB->updateTerminator();
+      }
+      else if(!TII.analyzeBranch(*PostFIMBB, TBB, FBB, Cond))
         PostFIMBB->updateTerminator();
 
       MBB.addSuccessor(InstSelMBB);
@@ -207,7 +301,8 @@ namespace {
         FIMBB->updateTerminator();
     }
 
-    void instrumentInstructionOperands(MachineInstr &MI, SmallVector<MachineOperand *, 4> &EligibleOps, InjectPoint IT) {
+    void instrumentInstructionOperands(MachineInstr &MI, SmallVector<MachineOperand *, 4> &EligibleOps, InjectPoint IT,
+        uint64_t SiteID, unsigned InstIdx) {
       MachineBasicBlock &MBB = *MI.getParent();
       MachineFunction &MF = *MBB.getParent();
       const MachineRegisterInfo &MRI = MF.getRegInfo();
@@ -221,21 +316,23 @@ namespace {
             return false;
             }), EligibleOps.end());
 
-      // XXX: WARNING! CAUTION! This implementation assumes FI happens *ONLY* in DST registers, 
-      // thus it's always inserted after the instruction to instrument
-      // TODO: SRC Registers
-      //MachineOperand *MO = EligibleOps[rnd_idx];
-      //injectFault(*MI, MO->getReg(), (MO->isUse()?INJECT_BEFORE:INJECT_AFTER));
+      // XXX: DST registers (and the destination memory operand) are injected after the instruction,
+      // SRC registers before it and restored after it, see findTargetInstructionsPair
       // XXX: Convert from MO vector to MCPhysReg vector. I'm keeping old code for continuity and 
       // upgradeability
       std::vector<MCPhysReg> FIRegs;
       for(auto MO : EligibleOps)
-        if(MO->isDef()) {
+        if(IT == INJECT_AFTER ? MO->isDef() : MO->isUse()) {
           //dbgs() << TRI.getName(MO->getReg()) << ", ";
-          FIRegs.push_back(MO->getReg());
+          // A register may be read by several operands, e.g., base and index
+          if(std::find(FIRegs.begin(), FIRegs.end(), MO->getReg()) == FIRegs.end())
+            FIRegs.push_back(MO->getReg());
         }
 
-      instrumentRegs(MI, FIRegs, IT);
+      if(IT == INJECT_AFTER)
+        instrumentRegs(MI, FIRegs, IT, SiteID, InstIdx, MemFISize.lookup(&MI));
+      else
+        instrumentRegs(MI, FIRegs, IT, SiteID, InstIdx, 0, true);
     }
 
     void instrumentLiveinsMBB(MachineFunction &MF) {
@@ -284,16 +381,73 @@ namespace {
           dbgs() << "===== END   INST =====\n";*/
         //instrumentInstruction(*MBB->instr_begin(), FIRegs[rand], INJECT_BEFORE);
         assert(FIRegs.size() > 0 && "FI Regs are 0!\n");
-        instrumentRegs(*MBB->instr_begin(), FIRegs, INJECT_BEFORE);
+        instrumentRegs(*MBB->instr_begin(), FIRegs, INJECT_BEFORE, 0, 1);
+      }
+    }
+
+    void saveSite(uint64_t SiteID, unsigned Idx, MachineFunction &MF, MachineInstr *MI, const char *Class, unsigned Width) {
+      const TargetInstrInfo &TII = *MF.getSubtarget().getInstrInfo();
+
+      std::string str;
+      llvm::raw_string_ostream rso(str);
+      rso << "site=" << format_hex(SiteID, 18) << ", inst=" << Idx << ", func=" << MF.getName()
+        << ", class=" << Class << ", width=" << Width << ", opcode=" << TII.getName(MI->getOpcode());
+      // Source location for offline target resolution (fi-trace-resolve), ??:0 without debug info
+      const DebugLoc &DL = MI->getDebugLoc();
+      if(DL)
+        rso << ", loc=" << cast<DIScope>(DL.getScope())->getFilename() << ":" << DL.getLine() << "\n";
+      else
+        rso << ", loc=??:0\n";
+      SitesFile << rso.str();
+    }
+
+    // Write the static target instructions of a site, in selInst order, for stratified sampling
+    void saveSites(uint64_t SiteID, MachineFunction &MF,
+        SmallVector< std::pair< MachineInstr *, SmallVector<MachineOperand *, 4> >, 32> &vecFIInstr) {
+      const TargetRegisterInfo &TRI = *MF.getSubtarget().getRegisterInfo();
+
+      unsigned Idx = 1;
+      for(auto I : vecFIInstr) {
+        MachineInstr *MI = I.first;
+        const char *Class = "data";
+        if(MI->isBranch() || MI->isCall() || MI->isReturn())
+          Class = "control";
+        else if(MI->getFlag(MachineInstr::FrameSetup) || MI->getFlag(MachineInstr::FrameDestroy))
+          Class = "frame";
+
+        // Operand width is the widest register or memory operand the fault may hit
+        bool isSrc = !I.second.empty() && I.second.front()->isUse();
+        unsigned Width = isSrc ? 0 : 8 * MemFISize.lookup(MI);
+        for(auto MO : I.second)
+          Width = std::max(Width, 8 * TRI.getMinimalPhysRegClass(MO->getReg())->getSize());
+
+        saveSite(SiteID, Idx, MF, MI, Class, Width);
+        Idx++;
       }
     }
 
+    // Live-in registers of MBB for -fi-mbb-liveins, injected before the first duplicable instruction
+    // (the first of CopyMBB in FF). Returns that instruction, nullptr if MBB is not a target
+    MachineInstr *findLiveinTarget(MachineBasicBlock &MBB, std::vector<MCPhysReg> &FIRegs) {
+      FIRegs.clear();
+      for(auto &Reg : MBB.liveins())
+        FIRegs.push_back(Reg.PhysReg);
+      if(FIRegs.empty())
+        return nullptr;
+
+      for(MachineBasicBlock::instr_iterator Iter = MBB.instr_begin(); Iter != MBB.instr_end(); Iter++)
+        if(!Iter->isNotDuplicable())
+          return &*Iter;
+      return nullptr;
+    }
+
     std::tuple<uint64_t, uint64_t> findTargetInstructionsPair(
         SmallVector< std::pair< MachineInstr *, SmallVector<MachineOperand *, 4> >, 32> &vecFIInstr,
         MachineBasicBlock &MBB,
-        bool doDataFI, bool doControlFI, bool doFrameFI, bool injectDstRegs, bool injectSrcRegs) {
+        bool doDataFI, bool doControlFI, bool doFrameFI, bool injectDstRegs, bool injectSrcRegs, bool injectDstMem) {
 
       //const TargetInstrInfo &TII = *MBB.getParent()->getSubtarget().getInstrInfo();
+      const TargetFaultInjection *TFI = MBB.getParent()->getSubtarget().getTargetFaultInjection();
 
       uint64_t InstrCount = 0;
       uint64_t TargetInstrCount = 0;
@@ -341,21 +495,36 @@ namespace {
 
           assert((isData || isFrame || isControl) && "Instruction type is invalid!\n");
 
-          SmallVector<MachineOperand *, 4> EligibleOps;
+          SmallVector<MachineOperand *, 4> EligibleOps, EligibleSrcOps;
 
           // Find if the instruction is eligible based on the operand selection
           for(auto MOIter = MI.operands_begin(); MOIter != MI.operands_end(); MOIter++) {
             MachineOperand &MO = *MOIter;
 
             if(MO.isReg() && MO.getReg()) {
-              if(injectSrcRegs && MO.isUse())
-                EligibleOps.push_back(&MO);
+              // Includes the base and index registers of memory operands
+              if(injectSrcRegs && MO.isUse() && !MO.isUndef() && TFI->isSrcFIReg(MO.getReg()))
+                EligibleSrcOps.push_back(&MO);
               else if(injectDstRegs && MO.isDef())
                 EligibleOps.push_back(&MO);
             }
           }
 
-          if(!EligibleOps.empty()) {
+          // XXX: SRC operands are a target of their own, injected before MI, the DST target follows.
+          // Both call selInst, so TargetInstrCount counts injection points rather than instructions
+          if(!EligibleSrcOps.empty()) {
+            vecFIInstr.push_back(std::make_pair(&MI, EligibleSrcOps));
+            TargetInstrCount++;
+          }
+
+          // Destination memory operand, the target XORs the fault into memory after the store
+          unsigned MemSize = 0;
+          if(injectDstMem && MI.mayStore())
+            MemSize = TFI->getStoreFISize(MI);
+          if(MemSize)
+            MemFISize[&MI] = MemSize;
+
+          if(!EligibleOps.empty() || MemSize) {
             vecFIInstr.push_back(std::make_pair(&MI, EligibleOps));
             TargetInstrCount++;
             //dbgs() << "FOUND TARGET\n";
@@ -370,10 +539,14 @@ namespace {
       return std::make_tuple(InstrCount, TargetInstrCount);
     }
 
+    // SiteID is the site of the MBB in FF, 0 otherwise. Instructions are indexed from 1 in vecFIInstr order,
+    // the inst= of the site map
     void instrumentInstructionsInMachineBasicBlock(
         SmallVector< std::pair< MachineInstr *, SmallVector<MachineOperand *, 4> >, 32> &vecFIInstr,
-        MachineFunction &MF) {
+        MachineFunction &MF, uint64_t SiteID) {
+      unsigned InstIdx = 0;
       for(auto I : vecFIInstr) {
+        InstIdx++;
         MachineInstr *MI = I.first;
         SmallVector<MachineOperand *, 4> &EligibleOps = I.second;
 
@@ -381,10 +554,11 @@ namespace {
         //dbgs() << "FI-MI: ";
         //MI->dump(); //DBG_SAFIRE
 
-        assert(!EligibleOps.empty() && "EligibleOps cannot be empty!\n");
+        assert((!EligibleOps.empty() || MemFISize.count(MI)) && "EligibleOps cannot be empty!\n");
 
-        // XXX: only INJECT_AFTER, DST registers for now
-        instrumentInstructionOperands(*MI, EligibleOps, INJECT_AFTER);
+        // SRC operands are injected before, DST registers and memory after MI
+        bool isSrc = !EligibleOps.empty() && EligibleOps.front()->isUse();
+        instrumentInstructionOperands(*MI, EligibleOps, isSrc ? INJECT_BEFORE : INJECT_AFTER, SiteID, InstIdx);
       }
     }
 
@@ -396,6 +570,9 @@ namespace {
       if(!FIEnable && !FILiveinsMBBEnable)
         return false;
 
+      MemFISize.clear();
+      SrcResumeMBB.clear();
+
       if(!FuncInclList.empty())
         if(std::find(FuncInclList.begin(), FuncInclList.end(), "*") == FuncInclList.end())
           if(std::find(FuncInclList.begin(), FuncInclList.end(), MF.getName()) == FuncInclList.end()) {
@@ -416,11 +593,13 @@ namespace {
         }
       }
 
-      if(FILiveinsMBBEnable) {
+      // XXX: without FF every live-in block calls selInst, with FF live-in blocks are FF sites
+      // of a single target, the live-in set, see findLiveinTarget
+      if(FILiveinsMBBEnable && !FFEnable) {
         //dbgs() << "<<<<<<< Using function call for instrumentMBB >>>>>>>>>\n";
         instrumentLiveinsMBB(MF);
       }
-      else if(FIEnable) {
+      else {
         // TODO: Think whether error checking should be better, i.e., an invalid option at the
         // moment is ignored, perhaps reporting back an error is better
         bool doDataFI = false, doControlFI = false, doFrameFI = false;
@@ -442,7 +621,7 @@ namespace {
           assert((doDataFI || doControlFI || doFrameFI) && "FI instruction types is invalid!");
         }
 
-        bool injectDstRegs = false, injectSrcRegs = false;
+        bool injectDstRegs = false, injectSrcRegs = false, injectDstMem = false;
         if(!FIInstTypes.empty()) {
           if(std::find(FIRegTypes.begin(), FIRegTypes.end(), "dst") != FIRegTypes.end())
             injectDstRegs = true;
@@ -450,7 +629,10 @@ namespace {
           if(std::find(FIRegTypes.begin(), FIRegTypes.end(), "src") != FIRegTypes.end())
             injectSrcRegs = true;
 
-          assert((injectDstRegs || injectSrcRegs) && "FI register types is invalid!");
+          if(std::find(FIRegTypes.begin(), FIRegTypes.end(), "mem") != FIRegTypes.end())
+            injectDstMem = true;
+
+          assert((injectDstRegs || injectSrcRegs || injectDstMem) && "FI register types is invalid!");
         }
 
         if(FFEnable) {
@@ -458,6 +640,12 @@ namespace {
           const TargetFaultInjection *TFI = MF.getSubtarget().getTargetFaultInjection();
           const TargetInstrInfo &TII = *MF.getSubtarget().getInstrInfo();
           //const TargetInstrInfo &TII = *MF.getSubtarget().getInstrInfo();
+          {
+            // XXX: Site IDs must be unique across the modules linked in a binary, hash the module
+            // and function names, local functions may share a name across modules
+            SiteFuncHash = MD5Hash((M->getModuleIdentifier() + ":" + MF.getName()).str()) << 24;
+            SiteCount = 0;
+          }
           {
             /*dbgs() << "============== MF code =============\n";
             for(auto &MBB: MF) { //DBG_SAFIRE
@@ -588,7 +776,12 @@ namespace {
               // XXX: If no target instructions, skip from instrumentation
               uint64_t InstrCount;
               uint64_t TargetInstrCount;
-              std::tie( InstrCount, TargetInstrCount ) = findTargetInstructionsPair(vecFIInstr, *MBB, doDataFI, doControlFI, doFrameFI, injectDstRegs, injectSrcRegs);
+              if(FILiveinsMBBEnable) {
+                std::vector<MCPhysReg> FIRegs;
+                TargetInstrCount = findLiveinTarget(*MBB, FIRegs) ? 1 : 0;
+              }
+              else
+                std::tie( InstrCount, TargetInstrCount ) = findTargetInstructionsPair(vecFIInstr, *MBB, doDataFI, doControlFI, doFrameFI, injectDstRegs, injectSrcRegs, injectDstMem);
               // Skip non-fi targeted blocks
               if( TargetInstrCount > 0)
                 TargetMBBs.push_back(MBBPair);
@@ -620,6 +813,14 @@ namespace {
               // If CopyMBB at function's end we save a jump from OriginalMBB (common case), CopyMBB jumps back
               MF.insert(MF.end(), CopyMBB);
 
+              // XXX: Live-ins of the target block, read before its instructions move to OriginalMBB
+              std::vector<MCPhysReg> LiveinRegs;
+              if(FILiveinsMBBEnable) {
+                bool isTarget = findLiveinTarget(*MBB, LiveinRegs) != nullptr;
+                assert(isTarget && "Live-in target block without live-ins!\n");
+                (void)isTarget;
+              }
+
               OriginalMBB->splice(OriginalMBB->end(), MBB, MBB->begin(), MBB->end());
               OriginalMBB->transferSuccessors(MBB);
 
@@ -651,13 +852,30 @@ namespace {
               uint64_t TargetInstrCount;
               // XXX: Run again on the CopyMBB this same. Result is the same but on the copied instruction stream
               // TODO: analyze CopyMBB before the updateTerminators()!
-              std::tie( InstrCount, TargetInstrCount ) = findTargetInstructionsPair(vecFIInstr, *CopyMBB, doDataFI, doControlFI, doFrameFI, injectDstRegs, injectSrcRegs);
+              // XXX: CopyMBB has no live-in list, the live-ins are those of the original block read above.
+              // CopyMBB holds only duplicable instructions, its first one is the target
+              MachineInstr *LiveinMI = nullptr;
+              if(FILiveinsMBBEnable) {
+                assert(!CopyMBB->empty() && "Live-in target block without duplicable instructions!\n");
+                LiveinMI = &*CopyMBB->instr_begin();
+                InstrCount = std::count_if(CopyMBB->instr_begin(), CopyMBB->instr_end(),
+                    [](const MachineInstr &MI) { return !MI.isPseudo(); });
+                TargetInstrCount = 1;
+              }
+              else
+                std::tie( InstrCount, TargetInstrCount ) = findTargetInstructionsPair(vecFIInstr, *CopyMBB, doDataFI, doControlFI, doFrameFI, injectDstRegs, injectSrcRegs, injectDstMem);
               // XXX: Note TotalInstrCount might not be the same in FF because not all blocks are considered
               FuncInstrCount += InstrCount;
               FuncTargetInstrCount += TargetInstrCount;
 
               assert(TargetInstrCount > 0 && "TargetInstrCount cannot be 0!\n");
 
+              if(SaveInstrEnable && LiveinMI) {
+                std::string str;
+                llvm::raw_string_ostream rso(str);
+                LiveinMI->print(rso);
+                InstrumentFile << rso.str();
+              }
               if(SaveInstrEnable) {
                 for(auto I : vecFIInstr) {
                   MachineInstr *MI = I.first;
@@ -672,12 +890,32 @@ namespace {
               dbgs() << "MBB: " << MBB->getSymbol()->getName() << " InstrCount: " << InstrCount << ", TargetInstrCount:" << TargetInstrCount << "\n";
               dbgs() << "=============================================\n";*/ //DBG_SAFIRE
 
+              SiteCount++;
+              assert(SiteCount < (UINT64_C(1) << 24) && "Site ID overflow\n");
+              uint64_t SiteID = SiteFuncHash | SiteCount;
+              if(FISitesEnable) {
+                if(LiveinMI) {
+                  // Width is the widest live-in register
+                  const TargetRegisterInfo &TRI = *MF.getSubtarget().getRegisterInfo();
+                  unsigned Width = 0;
+                  for(auto Reg : LiveinRegs)
+                    Width = std::max(Width, 8 * TRI.getMinimalPhysRegClass(Reg)->getSize());
+                  saveSite(SiteID, 1, MF, LiveinMI, "livein", Width);
+                }
+                else
+                  saveSites(SiteID, MF, vecFIInstr);
+              }
+
               // XXX: instrument instrutions before injectMBB
-              instrumentInstructionsInMachineBasicBlock(vecFIInstr, MF);
+              // Live-in faults persist, the registers are corrupted at the block entry
+              if(LiveinMI)
+                instrumentRegs(*LiveinMI, LiveinRegs, INJECT_BEFORE, SiteID, 1);
+              else
+                instrumentInstructionsInMachineBasicBlock(vecFIInstr, MF, SiteID);
 
               // XXX: injectMachineBlock after OriginalMBB and CopyMBB have their instructions populated
               // because it needs to add a preamble for restoring the context state after selMBB
-              TFI->injectMachineBasicBlock(*MBB, *JmpDetachMBB, *JmpFIMBB, *OriginalMBB, *CopyMBB, TargetInstrCount);
+              TFI->injectMachineBasicBlock(*MBB, *JmpDetachMBB, *JmpFIMBB, *OriginalMBB, *CopyMBB, TargetInstrCount, SiteID);
 
               // Insert the branch since JmpDetachMBB jumps unconditionally, hence no target specific codegen
               // XXX: MUST happen after injectMachineBasicBlock to be added as the terminator
@@ -723,7 +961,7 @@ namespace {
               SmallVector< std::pair< MachineInstr *, SmallVector< MachineOperand *, 4 > >, 32> vecFIInstr;
               uint64_t InstrCount;
               uint64_t TargetInstrCount;
-              std::tie( InstrCount, TargetInstrCount ) = findTargetInstructionsPair(vecFIInstr, *MBB, doDataFI, doControlFI, doFrameFI, injectDstRegs, injectSrcRegs);
+              std::tie( InstrCount, TargetInstrCount ) = findTargetInstructionsPair(vecFIInstr, *MBB, doDataFI, doControlFI, doFrameFI, injectDstRegs, injectSrcRegs, injectDstMem);
               //dbgs() << "TargetInstrCount: " << TargetInstrCount << "\n"; //DBG_SAFIRE
               //MBB->dump(); // DBG_SAFIRE
               FuncInstrCount += InstrCount;
@@ -733,7 +971,7 @@ namespace {
               dbgs() << "MBB: " << MBB->getSymbol()->getName() << " InstrCount: " << InstrCount << ", TargetInstrCount:" << TargetInstrCount << "\n";
               dbgs() << "=============================================\n";*/
 
-              instrumentInstructionsInMachineBasicBlock(vecFIInstr, MF);
+              instrumentInstructionsInMachineBasicBlock(vecFIInstr, MF, 0);
             }
 
             dbgs() << "=============================================\n";
@@ -762,5 +1000,9 @@ namespace llvm {
     return new MCFaultInjectionPass();
   }
 
+  bool isMCFaultInjectionEnabled() {
+    return FIEnable || FILiveinsMBBEnable;
+  }
+
 }
 
@@ -17,6 +17,7 @@
 #include "llvm/IR/LegacyPassManager.h"
 #include "llvm/IR/Module.h"
 #include "llvm/Support/ErrorOr.h"
+#include "llvm/Support/FileSystem.h"
 #include "llvm/Support/MemoryBuffer.h"
 #include "llvm/Support/TargetRegistry.h"
 #include "llvm/Support/ThreadPool.h"
@@ -35,6 +36,33 @@ static void codegen(Module *M, llvm::raw_pwrite_stream &OS,
   CodeGenPasses.run(*M);
 }
 
+/* SAFIRE */
+// Concatenate the FI maps of the partitions, in partition order, to the maps
+// of the module as if it was compiled in one piece
+static void mergeFaultInjectionMaps(const std::string &ModuleId,
+                                    unsigned NumParts) {
+  for (const char *Map : {"-instrument.txt", "-fi-sites.txt"}) {
+    std::unique_ptr<raw_fd_ostream> Out;
+    for (unsigned I = 0; I != NumParts; ++I) {
+      std::string PartName = ModuleId + ".part" + std::to_string(I) + Map;
+      ErrorOr<std::unique_ptr<MemoryBuffer>> BufOrErr =
+          MemoryBuffer::getFile(PartName);
+      if (!BufOrErr)
+        continue;
+      if (!Out) {
+        std::error_code EC;
+        Out.reset(new raw_fd_ostream(ModuleId + Map, EC, sys::fs::F_Text));
+        if (EC)
+          report_fatal_error("Failed to open " + ModuleId + Map + ": " +
+                             EC.message());
+      }
+      *Out << (*BufOrErr)->getBuffer();
+      sys::fs::remove(PartName);
+    }
+  }
+}
+/* SAFIRE */
+
 std::unique_ptr<Module> llvm::splitCodeGen(
     std::unique_ptr<Module> M, ArrayRef<llvm::raw_pwrite_stream *> OSs,
     ArrayRef<llvm::raw_pwrite_stream *> BCOSs,
@@ -49,6 +77,12 @@ std::unique_ptr<Module> llvm::splitCodeGen(
     return M;
   }
 
+  /* SAFIRE */
+  // The partitions keep the module identifier, FI site IDs do not depend on
+  // the partitioning
+  std::string ModuleId = M->getModuleIdentifier();
+  /* SAFIRE */
+
   // Create ThreadPool in nested scope so that threads will be joined
   // on destruction.
   {
@@ -64,6 +98,10 @@ std::unique_ptr<Module> llvm::splitCodeGen(
           // spinning up new threads which deserialize the partitions into
           // separate contexts.
           // FIXME: Provide a more direct way to do this in LLVM.
+          /* SAFIRE */
+          // Number the partition, the FI pass writes per partition maps
+          MPart->addModuleFlag(Module::Warning, "fi-partition", ThreadCount);
+          /* SAFIRE */
           SmallString<0> BC;
           raw_svector_ostream BCOS(BC);
           WriteBitcodeToFile(MPart.get(), BCOS);
@@ -76,7 +114,7 @@ std::unique_ptr<Module> llvm::splitCodeGen(
           llvm::raw_pwrite_stream *ThreadOS = OSs[ThreadCount++];
           // Enqueue the task
           CodegenThreadPool.async(
-              [TMFactory, FileType, ThreadOS](const SmallString<0> &BC) {
+              [TMFactory, FileType, ThreadOS, ModuleId](const SmallString<0> &BC) {
                 LLVMContext Ctx;
                 ErrorOr<std::unique_ptr<Module>> MOrErr = parseBitcodeFile(
                     MemoryBufferRef(StringRef(BC.data(), BC.size()),
@@ -85,6 +123,7 @@ std::unique_ptr<Module> llvm::splitCodeGen(
                 if (!MOrErr)
                   report_fatal_error("Failed to read bitcode");
                 std::unique_ptr<Module> MPartInCtx = std::move(MOrErr.get());
+                MPartInCtx->setModuleIdentifier(ModuleId);
 
                 codegen(MPartInCtx.get(), *ThreadOS, TMFactory, FileType);
               },
@@ -95,5 +134,7 @@ std::unique_ptr<Module> llvm::splitCodeGen(
         PreserveLocals);
   }
 
+  mergeFaultInjectionMaps(ModuleId, OSs.size());
+
   return {};
 }
@@ -25,6 +25,7 @@
 #include "llvm/Analysis/TargetTransformInfo.h"
 #include "llvm/Bitcode/BitcodeWriterPass.h"
 #include "llvm/Bitcode/ReaderWriter.h"
+#include "llvm/CodeGen/Passes.h"
 #include "llvm/ExecutionEngine/ObjectMemoryBuffer.h"
 #include "llvm/IR/DiagnosticPrinter.h"
 #include "llvm/IR/LLVMContext.h"
@@ -233,6 +234,13 @@ public:
     if (CachePath.empty())
       return;
 
+    /* SAFIRE */
+    // A cached object skips codegen, the FI pass would not write the module's
+    // instrumentation and site maps, and the FI options are not in the hash
+    if (isMCFaultInjectionEnabled())
+      return;
+    /* SAFIRE */
+
     // Compute the unique hash for this entry
     // This is based on the current compiler version, the module itself, the
     // export list, the hash for every single module in the import list, the
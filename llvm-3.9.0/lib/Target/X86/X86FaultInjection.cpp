@@ -9,6 +9,16 @@
 #include "X86InstrBuilder.h"
 
 #include "llvm/CodeGen/LivePhysRegs.h"
+#include "llvm/IR/Constants.h"
+#include "llvm/IR/DebugInfoMetadata.h"
+#include "llvm/IR/GlobalVariable.h"
+#include "llvm/IR/Module.h"
+#include "llvm/MC/MCAsmInfo.h"
+#include "llvm/MC/MCDwarf.h"
+#include "llvm/Support/CommandLine.h"
+#include "llvm/Support/Dwarf.h"
+#include "llvm/Support/LEB128.h"
+#include "llvm/Target/TargetMachine.h"
 
 using namespace llvm;
 
@@ -18,13 +28,207 @@ using namespace llvm;
  *    b. Reduce alignment depending on spilled regs
  */
 
-// XXX: slowdown for storing string
-//#define INSTR_PRINT
+static cl::opt<bool>
+FIHookDirect("fi-hook-direct", cl::desc("Call the libinject hooks directly, not through the PLT (link the executable with libinject_*.a)"), cl::init(false));
 
 // Offset globals
 int RSPOffset = 0, RBPOffset = -8, RAXOffset = -16;
 int StackOffset = 0;
 
+// Location of inserted instructions, line 0 of "safire-instrumentation" in the scope of the
+// instrumented function, so line tables attribute the instrumentation to SAFIRE. Empty without debug info
+DebugLoc FIDebugLoc;
+
+// CFI globals, the CFA rule at the instrumented point (DWARF register numbers). While the saved frame
+// is live the CFA is described relative to RBP, which stays fixed across pushes and stack alignment
+bool CFIEnabled = false;
+int CFIReg = 0;
+int64_t CFIOffset = 0;
+bool CFIRBPSaved = false;
+
+// Frame save globals, whether EFLAGS and RBP must be restored at the instrumented point. EFLAGS are saved
+// only if live or an FI target, the original RBP is reloaded only if live, reserved or an FI target
+bool SaveFlags = true;
+bool RestoreRBP = true;
+
+// Target flags of the calls to selMBB, selInst and doInject. With -fi-hook-direct the hooks are linked
+// statically in the executable, so the call is PC-relative to the hidden symbol without a PLT entry
+unsigned getHookTargetFlags(MachineFunction &MF)
+{
+    if(FIHookDirect)
+        return X86II::MO_NO_FLAG;
+    const X86Subtarget &Subtarget = MF.getSubtarget<X86Subtarget>();
+    return Subtarget.classifyGlobalFunctionReference( nullptr, *MF.getMMI().getModule() );
+}
+
+void initFIDebugLoc(MachineFunction &MF)
+{
+    FIDebugLoc = DebugLoc();
+    DISubprogram *SP = MF.getFunction()->getSubprogram();
+    if(!SP)
+        return;
+
+    LLVMContext &Ctx = MF.getFunction()->getContext();
+    DIFile *File = DIFile::get(Ctx, "safire-instrumentation", SP->getDirectory());
+    DILexicalBlockFile *Scope = DILexicalBlockFile::get(Ctx, SP, File, 0);
+    FIDebugLoc = DILocation::get(Ctx, 0, 0, Scope);
+}
+
+// Set the CFI globals to the rule in effect before Point in PointMBB, walking the CFI_INSTRUCTIONs of the
+// function in layout order from the CIE rule (CFA = RSP+8, RBP unchanged)
+// XXX: CFI_INSTRUCTION is not duplicable, FF copies and clones are described by the preceding layout
+void initFrameCFI(MachineBasicBlock &PointMBB, MachineBasicBlock::iterator Point)
+{
+    MachineFunction &MF = *PointMBB.getParent();
+    MachineModuleInfo &MMI = MF.getMMI();
+    const TargetRegisterInfo &TRI = *MF.getSubtarget().getRegisterInfo();
+    int DwarfRSP = TRI.getDwarfRegNum(X86::RSP, true);
+    int DwarfRBP = TRI.getDwarfRegNum(X86::RBP, true);
+
+    // Same condition as X86FrameLowering::emitPrologue
+    CFIEnabled = !MF.getTarget().getMCAsmInfo()->usesWindowsCFI() &&
+        ( MMI.hasDebugInfo() || MF.getFunction()->needsUnwindTableEntry() );
+    CFIReg = DwarfRSP;
+    CFIOffset = 8;
+    CFIRBPSaved = false;
+    if(!CFIEnabled)
+        return;
+
+    const std::vector<MCCFIInstruction> &FrameInsts = MMI.getFrameInstructions();
+    for(MachineBasicBlock &MBB : MF) {
+        for(MachineBasicBlock::iterator I = MBB.begin(); I != MBB.end(); ++I) {
+            if(&MBB == &PointMBB && I == Point)
+                break;
+            MachineInstr &MI = *I;
+            if(!MI.isCFIInstruction())
+                continue;
+            const MCCFIInstruction &CFI = FrameInsts[MI.getOperand(0).getCFIIndex()];
+            // XXX: getOffset() of def_cfa, def_cfa_offset is the CFA offset, createDefCfa* take it negated
+            switch(CFI.getOperation()) {
+                case MCCFIInstruction::OpDefCfa:
+                    CFIReg = CFI.getRegister();
+                    CFIOffset = CFI.getOffset();
+                    break;
+                case MCCFIInstruction::OpDefCfaRegister:
+                    CFIReg = CFI.getRegister();
+                    break;
+                case MCCFIInstruction::OpDefCfaOffset:
+                    CFIOffset = CFI.getOffset();
+                    break;
+                case MCCFIInstruction::OpAdjustCfaOffset:
+                    CFIOffset += CFI.getOffset();
+                    break;
+                case MCCFIInstruction::OpOffset:
+                case MCCFIInstruction::OpRelOffset:
+                    if((int)CFI.getRegister() == DwarfRBP)
+                        CFIRBPSaved = true;
+                    break;
+                case MCCFIInstruction::OpSameValue:
+                case MCCFIInstruction::OpRestore:
+                    if((int)CFI.getRegister() == DwarfRBP)
+                        CFIRBPSaved = false;
+                    break;
+                default:
+                    break;
+            }
+        }
+        if(&MBB == &PointMBB)
+            break;
+    }
+
+    // XXX: CFA on another register (stack realignment through a scratch register) is left undescribed
+    if(CFIReg != DwarfRSP && CFIReg != DwarfRBP)
+        CFIEnabled = false;
+}
+
+void emitCFI(MachineBasicBlock &MBB, MachineBasicBlock::iterator I, const MCCFIInstruction &CFIInst)
+{
+    MachineFunction &MF = *MBB.getParent();
+    const TargetInstrInfo &TII = *MF.getSubtarget().getInstrInfo();
+
+    unsigned CFIIndex = MF.getMMI().addFrameInst(CFIInst);
+    BuildMI(MBB, I, FIDebugLoc, TII.get(TargetOpcode::CFI_INSTRUCTION)).addCFIIndex(CFIIndex);
+}
+
+// RSP-relative CFA moved by Size bytes, before RBP takes over
+void emitAdjustCFI(MachineBasicBlock &MBB, MachineBasicBlock::iterator I, int64_t Size)
+{
+    if(!CFIEnabled)
+        return;
+    const TargetRegisterInfo &TRI = *MBB.getParent()->getSubtarget().getRegisterInfo();
+    if(CFIReg == TRI.getDwarfRegNum(X86::RSP, true))
+        emitCFI(MBB, I, MCCFIInstruction::createAdjustCfaOffset(nullptr, Size));
+}
+
+// CFA and RBP rules while the saved frame is live, RBP points at the saved RSP and the original RBP
+// is at RBPOffset. Emitted after the frame is set up and at the start of blocks in the frame whose layout
+// predecessor has left it
+void emitFrameCFI(MachineBasicBlock &MBB, MachineBasicBlock::iterator I)
+{
+    if(!CFIEnabled)
+        return;
+    MachineFunction &MF = *MBB.getParent();
+    const TargetRegisterInfo &TRI = *MF.getSubtarget().getRegisterInfo();
+    X86MachineFunctionInfo *X86MFI = MF.getInfo<X86MachineFunctionInfo>();
+    int DwarfRBP = TRI.getDwarfRegNum(X86::RBP, true);
+    int64_t RedZone = X86MFI->getUsesRedZone() ? 128 : 0;
+
+    if(CFIReg == TRI.getDwarfRegNum(X86::RSP, true))
+        // CFA = RSP + CFIOffset, RBP = RSP - RedZone + RBPOffset
+        emitCFI(MBB, I, MCCFIInstruction::createDefCfa(nullptr, DwarfRBP, -(CFIOffset + RedZone - RBPOffset)));
+    else {
+        // CFA = [RBP + RBPOffset] + CFIOffset
+        std::string Expr, Esc;
+        raw_string_ostream ExprOS(Expr), EscOS(Esc);
+        ExprOS << (uint8_t)(dwarf::DW_OP_breg0 + DwarfRBP);
+        encodeSLEB128(RBPOffset, ExprOS);
+        ExprOS << (uint8_t)dwarf::DW_OP_deref << (uint8_t)dwarf::DW_OP_plus_uconst;
+        encodeULEB128(CFIOffset, ExprOS);
+        ExprOS.flush();
+        EscOS << (uint8_t)dwarf::DW_CFA_def_cfa_expression;
+        encodeULEB128(Expr.size(), EscOS);
+        EscOS << Expr;
+        EscOS.flush();
+        emitCFI(MBB, I, MCCFIInstruction::createEscape(nullptr, Esc));
+    }
+
+    // The original RBP is at RBP + RBPOffset, unless the function saved it already
+    if(!CFIRBPSaved) {
+        std::string Expr, Esc;
+        raw_string_ostream ExprOS(Expr), EscOS(Esc);
+        ExprOS << (uint8_t)(dwarf::DW_OP_breg0 + DwarfRBP);
+        encodeSLEB128(RBPOffset, ExprOS);
+        ExprOS.flush();
+        EscOS << (uint8_t)dwarf::DW_CFA_expression;
+        encodeULEB128(DwarfRBP, EscOS);
+        encodeULEB128(Expr.size(), EscOS);
+        EscOS << Expr;
+        EscOS.flush();
+        emitCFI(MBB, I, MCCFIInstruction::createEscape(nullptr, Esc));
+    }
+}
+
+// CFA and RBP rules back to the instrumented point, RSP is still below the red zone
+void emitLeaveFrameCFI(MachineBasicBlock &MBB, MachineBasicBlock::iterator I)
+{
+    if(!CFIEnabled)
+        return;
+    MachineFunction &MF = *MBB.getParent();
+    const TargetRegisterInfo &TRI = *MF.getSubtarget().getRegisterInfo();
+    X86MachineFunctionInfo *X86MFI = MF.getInfo<X86MachineFunctionInfo>();
+    int DwarfRSP = TRI.getDwarfRegNum(X86::RSP, true);
+    int DwarfRBP = TRI.getDwarfRegNum(X86::RBP, true);
+    int64_t RedZone = X86MFI->getUsesRedZone() ? 128 : 0;
+
+    if(CFIReg == DwarfRSP)
+        emitCFI(MBB, I, MCCFIInstruction::createDefCfa(nullptr, DwarfRSP, -(CFIOffset + RedZone)));
+    else
+        emitCFI(MBB, I, MCCFIInstruction::createDefCfa(nullptr, DwarfRBP, -CFIOffset));
+
+    if(!CFIRBPSaved)
+        emitCFI(MBB, I, MCCFIInstruction::createSameValue(nullptr, DwarfRBP));
+}
+
 int64_t emitAllocateStackAlign(MachineBasicBlock &MBB, MachineBasicBlock::iterator I, int64_t size, int64_t Alignment)
 {
     MachineFunction &MF = *MBB.getParent();
@@ -35,7 +239,7 @@ int64_t emitAllocateStackAlign(MachineBasicBlock &MBB, MachineBasicBlock::iterat
 
     int64_t AlignedStackSize = size + ( (Offset%Alignment) > 0 ? (Alignment - (Offset%Alignment)) : 0 );
 
-    addRegOffset(BuildMI(MBB, I, DebugLoc(), TII.get(X86::LEA64r), X86::RSP), X86::RSP, false, -AlignedStackSize);
+    addRegOffset(BuildMI(MBB, I, FIDebugLoc, TII.get(X86::LEA64r), X86::RSP), X86::RSP, false, -AlignedStackSize);
 
     StackOffset -= AlignedStackSize;
     //dbgs() << "emitAllocStack StackOffset: " << StackOffset << "\n"; //DBG_SAFIRE
@@ -49,12 +253,21 @@ void emitDeallocateStack(MachineBasicBlock &MBB, MachineBasicBlock::iterator I,
     MachineFunction &MF = *MBB.getParent();
     const TargetInstrInfo &TII = *MF.getSubtarget().getInstrInfo();
 
-    addRegOffset(BuildMI(MBB, I, DebugLoc(), TII.get(X86::LEA64r), X86::RSP), X86::RSP, false, size);
+    addRegOffset(BuildMI(MBB, I, FIDebugLoc, TII.get(X86::LEA64r), X86::RSP), X86::RSP, false, size);
 
     StackOffset += size;
     //dbgs() << "emitFreeStack StackOffset: " << StackOffset << "\n"; //DBG_SAFIRE
 }
 
+// Align RSP to 16B for a hook call with register arguments only, the pushed context may leave it
+// 8B off. Returns the size to deallocate after the call, 0 if RSP is aligned already
+int64_t emitAlignCall(MachineBasicBlock &MBB, MachineBasicBlock::iterator I)
+{
+    if(StackOffset % 16 == 0)
+        return 0;
+    return emitAllocateStackAlign( MBB, I, 0, 16 );
+}
+
 
 // XXX: emitPushReg and others assume starting from a 16B aligned stack
 void emitPushReg(MachineBasicBlock &MBB, MachineBasicBlock::iterator I, const MCPhysReg Reg)
@@ -62,7 +275,7 @@ void emitPushReg(MachineBasicBlock &MBB, MachineBasicBlock::iterator I, const MC
     MachineFunction &MF = *MBB.getParent();
     const TargetInstrInfo &TII = *MF.getSubtarget().getInstrInfo();
 
-    BuildMI(MBB, I, DebugLoc(), TII.get(X86::PUSH64r)).addReg(Reg);
+    BuildMI(MBB, I, FIDebugLoc, TII.get(X86::PUSH64r)).addReg(Reg);
     StackOffset -= 8;
     //dbgs() << "emitPushReg StackOffset: " << StackOffset << "\n"; //DBG_SAFIRE
 }
@@ -72,7 +285,7 @@ void emitPopReg(MachineBasicBlock &MBB, MachineBasicBlock::iterator I, const MCP
     MachineFunction &MF = *MBB.getParent();
     const TargetInstrInfo &TII = *MF.getSubtarget().getInstrInfo();
 
-    BuildMI(MBB, I, DebugLoc(), TII.get(X86::POP64r)).addReg(Reg);
+    BuildMI(MBB, I, FIDebugLoc, TII.get(X86::POP64r)).addReg(Reg);
     StackOffset += 8;
     //dbgs() << "emitPushReg StackOffset: " << StackOffset << "\n"; //DBG_SAFIRE
 }
@@ -119,15 +332,15 @@ void emitPushContextRegList(std::vector<MCPhysReg> &saveRegs, MachineBasicBlock
                 const TargetRegisterClass *TRC = TRI.getMinimalPhysRegClass(Reg);
                 switch( TRC->getSize() ) {
                     case 16:
-                        addRegOffset(BuildMI(MBB, I, DebugLoc(), TII.get( X86::MOVAPSmr )), X86::RSP, false, RegStackOffset).addReg(Reg);
+                        addRegOffset(BuildMI(MBB, I, FIDebugLoc, TII.get( X86::MOVAPSmr )), X86::RSP, false, RegStackOffset).addReg(Reg);
                         RegStackOffset += 16;
                         break;
                     case 32:
-                        addRegOffset(BuildMI(MBB, I, DebugLoc(), TII.get(X86::VMOVAPSYmr)), X86::RSP, false, RegStackOffset).addReg(Reg);
+                        addRegOffset(BuildMI(MBB, I, FIDebugLoc, TII.get(X86::VMOVAPSYmr)), X86::RSP, false, RegStackOffset).addReg(Reg);
                         RegStackOffset += 32;
                         break;
                     case 64:
-                        addRegOffset(BuildMI(MBB, I, DebugLoc(), TII.get(X86::VMOVAPSZmr)), X86::RSP, false, RegStackOffset).addReg(Reg);
+                        addRegOffset(BuildMI(MBB, I, FIDebugLoc, TII.get(X86::VMOVAPSZmr)), X86::RSP, false, RegStackOffset).addReg(Reg);
                         RegStackOffset += 64;
                         break;
                         //return load ? X86::VMOVAPSZrm : X86::VMOVAPSZmr;
@@ -141,7 +354,7 @@ void emitPushContextRegList(std::vector<MCPhysReg> &saveRegs, MachineBasicBlock
     // store GR64 registers
     for(MCPhysReg Reg : saveRegs) {
         if( X86::GR64RegClass.contains(Reg) ) {
-            BuildMI(MBB, I, DebugLoc(), TII.get(X86::PUSH64r)).addReg(Reg);
+            BuildMI(MBB, I, FIDebugLoc, TII.get(X86::PUSH64r)).addReg(Reg);
             StackOffset -= 8;
         }
     }
@@ -158,7 +371,7 @@ void emitPopContextRegList(std::vector<MCPhysReg> &saveRegs, MachineBasicBlock &
     for( auto it = saveRegs.rbegin(); it != saveRegs.rend(); it++ ) {
         MCPhysReg Reg = *it;
         if( X86::GR64RegClass.contains(Reg) ) {
-            BuildMI(MBB, I, DebugLoc(), TII.get(X86::POP64r)).addReg(Reg);
+            BuildMI(MBB, I, FIDebugLoc, TII.get(X86::POP64r)).addReg(Reg);
             StackOffset += 8;
         }
     }
@@ -193,15 +406,15 @@ void emitPopContextRegList(std::vector<MCPhysReg> &saveRegs, MachineBasicBlock &
                 const TargetRegisterClass *TRC = TRI.getMinimalPhysRegClass(Reg);
                 switch( TRC->getSize() ) {
                     case 16:
-                        addRegOffset(BuildMI(MBB, I, DebugLoc(), TII.get( X86::MOVAPSrm ), Reg), X86::RSP, false, RegStackOffset);
+                        addRegOffset(BuildMI(MBB, I, FIDebugLoc, TII.get( X86::MOVAPSrm ), Reg), X86::RSP, false, RegStackOffset);
                         RegStackOffset += 16;
                         break;
                     case 32:
-                        addRegOffset(BuildMI(MBB, I, DebugLoc(), TII.get( X86::VMOVAPSYrm ), Reg), X86::RSP, false, RegStackOffset);
+                        addRegOffset(BuildMI(MBB, I, FIDebugLoc, TII.get( X86::VMOVAPSYrm ), Reg), X86::RSP, false, RegStackOffset);
                         RegStackOffset += 32;
                         break;
                     case 64:
-                        addRegOffset(BuildMI(MBB, I, DebugLoc(), TII.get( X86::VMOVAPSZrm ), Reg), X86::RSP, false, RegStackOffset);
+                        addRegOffset(BuildMI(MBB, I, FIDebugLoc, TII.get( X86::VMOVAPSZrm ), Reg), X86::RSP, false, RegStackOffset);
                         RegStackOffset += 64;
                         break;
                         //return load ? X86::VMOVAPSZrm : X86::VMOVAPSZmr;
@@ -225,7 +438,7 @@ void emitAlignStack(MachineBasicBlock &MBB, MachineBasicBlock::iterator I, int64
     MachineFunction &MF = *MBB.getParent();
     const TargetInstrInfo &TII = *MF.getSubtarget().getInstrInfo();
 
-    BuildMI(MBB, I, DebugLoc(), TII.get(X86::AND64ri8), X86::RSP).addReg(X86::RSP).addImm(-Alignment);
+    BuildMI(MBB, I, FIDebugLoc, TII.get(X86::AND64ri8), X86::RSP).addReg(X86::RSP).addImm(-Alignment);
 }
 
 void emitSaveFrameFlags(MachineBasicBlock &MBB, MachineBasicBlock::iterator I)
@@ -236,23 +449,31 @@ void emitSaveFrameFlags(MachineBasicBlock &MBB, MachineBasicBlock::iterator I)
 
     // Stay clear of the red zone, 128 bytes
     // XXX: This MUST be done even FI in RSP, it will be adjusted anyway at PostFIMBB
-    if(X86MFI->getUsesRedZone())
+    if(X86MFI->getUsesRedZone()) {
         // LEA to adjust RSP (does not clobber flags)
-        addRegOffset(BuildMI(MBB, I, DebugLoc(), TII.get(X86::LEA64r), X86::RSP), X86::RSP, false, -128);
+        addRegOffset(BuildMI(MBB, I, FIDebugLoc, TII.get(X86::LEA64r), X86::RSP), X86::RSP, false, -128);
+        emitAdjustCFI(MBB, I, 128);
+    }
 
     // PUSH RSP
-    BuildMI(MBB, I, DebugLoc(), TII.get(X86::PUSH64r)).addReg(X86::RSP);
+    BuildMI(MBB, I, FIDebugLoc, TII.get(X86::PUSH64r)).addReg(X86::RSP);
+    emitAdjustCFI(MBB, I, 8);
     // PUSH RBP
-    BuildMI(MBB, I, DebugLoc(), TII.get(X86::PUSH64r)).addReg(X86::RBP);
+    BuildMI(MBB, I, FIDebugLoc, TII.get(X86::PUSH64r)).addReg(X86::RBP);
+    emitAdjustCFI(MBB, I, 8);
     // RBP <- original RSP 
-    addRegOffset(BuildMI(MBB, I, DebugLoc(), TII.get(X86::LEA64r), X86::RBP), X86::RSP, false, -RBPOffset);
+    addRegOffset(BuildMI(MBB, I, FIDebugLoc, TII.get(X86::LEA64r), X86::RBP), X86::RSP, false, -RBPOffset);
+    // CFA is RBP-relative from here on, pushes and stack alignment need no CFI
+    emitFrameCFI(MBB, I);
 
     // XXX: We have to store EFLAGS, they may be live during the execution of this BB
     // PUSH RAX used for saving flags, required by LAHF/SAHF instructions
-    BuildMI(MBB, I, DebugLoc(), TII.get(X86::PUSH64r)).addReg(X86::RAX);
+    BuildMI(MBB, I, FIDebugLoc, TII.get(X86::PUSH64r)).addReg(X86::RAX);
     // STORE flags
-    BuildMI(MBB, I, DebugLoc(), TII.get(X86::SETOr), X86::AL);
-    BuildMI(MBB, I, DebugLoc(), TII.get(X86::LAHF));
+    if(SaveFlags) {
+        BuildMI(MBB, I, FIDebugLoc, TII.get(X86::SETOr), X86::AL);
+        BuildMI(MBB, I, FIDebugLoc, TII.get(X86::LAHF));
+    }
 }
 
 void emitRestoreFrameFlags(MachineBasicBlock &MBB, MachineBasicBlock::iterator I)
@@ -262,15 +483,51 @@ void emitRestoreFrameFlags(MachineBasicBlock &MBB, MachineBasicBlock::iterator I
     X86MachineFunctionInfo *X86MFI = MF.getInfo<X86MachineFunctionInfo>();
 
     // Restore EFLAGS
-    BuildMI(MBB, I, DebugLoc(), TII.get(X86::ADD8ri), X86::AL).addReg(X86::AL).addImm(INT8_MAX);
-    BuildMI(MBB, I, DebugLoc(), TII.get(X86::SAHF));
-    addRegOffset(BuildMI(MBB, I, DebugLoc(), TII.get(X86::MOV64rm), X86::RAX), X86::RBP, false, RAXOffset);
-    addRegOffset(BuildMI(MBB, I, DebugLoc(), TII.get(X86::MOV64rm), X86::RSP), X86::RBP, false, RSPOffset);
-    // Restore RBP last 
-    addRegOffset(BuildMI(MBB, I, DebugLoc(), TII.get(X86::MOV64rm), X86::RBP), X86::RBP, false, RBPOffset);
-    if(X86MFI->getUsesRedZone())
+    if(SaveFlags) {
+        BuildMI(MBB, I, FIDebugLoc, TII.get(X86::ADD8ri), X86::AL).addReg(X86::AL).addImm(INT8_MAX);
+        BuildMI(MBB, I, FIDebugLoc, TII.get(X86::SAHF));
+    }
+    addRegOffset(BuildMI(MBB, I, FIDebugLoc, TII.get(X86::MOV64rm), X86::RAX), X86::RBP, false, RAXOffset);
+    addRegOffset(BuildMI(MBB, I, FIDebugLoc, TII.get(X86::MOV64rm), X86::RSP), X86::RBP, false, RSPOffset);
+    // Restore RBP last, a dead RBP keeps the frame address
+    if(RestoreRBP)
+        addRegOffset(BuildMI(MBB, I, FIDebugLoc, TII.get(X86::MOV64rm), X86::RBP), X86::RBP, false, RBPOffset);
+    emitLeaveFrameCFI(MBB, I);
+    if(X86MFI->getUsesRedZone()) {
         // LEA adjust SP
-        addRegOffset(BuildMI(MBB, I, DebugLoc(), TII.get(X86::LEA64r), X86::RSP), X86::RSP, false, 128);
+        addRegOffset(BuildMI(MBB, I, FIDebugLoc, TII.get(X86::LEA64r), X86::RSP), X86::RSP, false, 128);
+        emitAdjustCFI(MBB, I, -128);
+    }
+}
+
+// Set SaveFlags and RestoreRBP from the liveness at the instrumented point, LiveRegs after MI. With MI, the
+// liveness before MI counts too, MI may run between frame restore and save. Steps LiveRegs over MI
+void initFrameSave(MachineFunction &MF, LivePhysRegs &LiveRegs, const MachineInstr *MI, std::vector<MCPhysReg> const &FIRegs)
+{
+    const MachineRegisterInfo &MRI = MF.getRegInfo();
+    const TargetRegisterInfo &TRI = *MRI.getTargetRegisterInfo();
+
+    SaveFlags = false;
+    RestoreRBP = false;
+    for(int Step = 0; Step < 2; Step++) {
+        SaveFlags |= LiveRegs.contains(X86::EFLAGS);
+        // Not available if reserved (frame pointer) or any alias is live
+        RestoreRBP |= !LiveRegs.available(MRI, X86::RBP);
+        if(!MI)
+            break;
+        LiveRegs.stepBackward(*MI);
+    }
+
+    for(auto FIReg : FIRegs) {
+        SaveFlags |= (FIReg == X86::EFLAGS);
+        RestoreRBP |= TRI.regsOverlap(FIReg, X86::RBP);
+    }
+
+    // XXX: Pristine callee saved registers are live only with valid callee saved info, without it or a CFI
+    // rule for the caller's RBP, a dead RBP may still be the caller's
+    if(!MF.getFrameInfo()->isCalleeSavedInfoValid() || (CFIEnabled && !CFIRBPSaved))
+        RestoreRBP = true;
+    //dbgs() << "SaveFlags:" << SaveFlags << ", RestoreRBP:" << RestoreRBP << "\n"; //DBG_SAFIRE
 }
 
 // Fill saveRegs with LiveRegs
@@ -326,16 +583,20 @@ void X86FaultInjection::injectMachineBasicBlock(
         MachineBasicBlock &JmpFIMBB,
         MachineBasicBlock &OriginalMBB,
         MachineBasicBlock &CopyMBB,
-        uint64_t TargetInstrCount) const
+        uint64_t TargetInstrCount,
+        uint64_t SiteID) const
 {
     MachineFunction &MF = *SelMBB.getParent();
     const TargetInstrInfo &TII = *MF.getSubtarget().getInstrInfo();
-    const X86Subtarget &Subtarget = MF.getSubtarget<X86Subtarget>();
     const MachineRegisterInfo &MRI = MF.getRegInfo();
     const TargetRegisterInfo &TRI = *MRI.getTargetRegisterInfo();
 
     std::vector<MCPhysReg> saveRegs;
 
+    initFIDebugLoc(MF);
+    // XXX: OriginalMBB and CopyMBB start at the CFI state of SelMBB
+    initFrameCFI(SelMBB, SelMBB.end());
+
     LivePhysRegs LiveRegs;
     LiveRegs.init(&TRI);
     LiveRegs.clear();
@@ -351,6 +612,7 @@ void X86FaultInjection::injectMachineBasicBlock(
     //SelMBB.dump();
     fillSaveRegs(saveRegs, LiveRegs, &TRI);
     //dbgs() << "==== END SELMBB ====\n";
+    initFrameSave(MF, LiveRegs, nullptr, {});
 
     /* ============================================================= CREATE SelMBB ========================================================== */
 
@@ -372,32 +634,31 @@ void X86FaultInjection::injectMachineBasicBlock(
     {
         emitPushContextRegList( saveRegs, SelMBB, SelMBB.end(), 64 );
 
-        // MOV RSI <= MBB.size(), selMBB arg2 (uint64_t, number of instructions)
-        BuildMI(SelMBB, SelMBB.end(), DebugLoc(), TII.get(X86::MOV64ri), X86::RSI).addImm(TargetInstrCount);
-        // Allocate stack space for out arg1
-        int64_t AlignedStackSize = emitAllocateStackAlign(SelMBB, SelMBB.end(), 8, 64 );
-        //dbgs() << "AlignedStackSize:" << AlignedStackSize << "\n"; //DBG_SAFIRE
-        // MOV RDI <= RSP, selMBB arg1
-        addRegOffset(BuildMI(SelMBB, SelMBB.end(), DebugLoc(), TII.get(X86::LEA64r), X86::RDI), X86::RSP, false, 0);
-        int64_t RetOffset = StackOffset;
+        // MOV RDI <= MBB.size(), selMBB arg1 (uint64_t, number of instructions)
+        BuildMI(SelMBB, SelMBB.end(), FIDebugLoc, TII.get(X86::MOV64ri), X86::RDI).addImm(TargetInstrCount);
+        // MOV RSI <= SiteID, selMBB arg2 (uint64_t, static site ID of the MBB)
+        BuildMI(SelMBB, SelMBB.end(), FIDebugLoc, TII.get(X86::MOV64ri), X86::RSI).addImm(SiteID);
+        int64_t AlignedStackSize = emitAlignCall( SelMBB, SelMBB.end() );
 
         // XXX: Create the external symbol and get target flags (e.g, X86II::MO_PLT) for linking
         MachineOperand MO = MachineOperand::CreateES("selMBB");
-        MO.setTargetFlags( Subtarget.classifyGlobalFunctionReference( nullptr, *MF.getMMI().getModule() ) );
-        BuildMI(SelMBB, SelMBB.end(), DebugLoc(), TII.get(X86::CALL64pcrel32)).addOperand( MO );
+        MO.setTargetFlags( getHookTargetFlags(MF) );
+        BuildMI(SelMBB, SelMBB.end(), FIDebugLoc, TII.get(X86::CALL64pcrel32)).addOperand( MO );
 
-        // TEST for jump (see code later), XXX: THIS SETS FLAGS FOR THE JMP, be careful not to mess with them until the branch
-        addDirectMem(BuildMI(SelMBB, SelMBB.end(), DebugLoc(), TII.get(X86::TEST8mi)), X86::RSP).addImm(0x2);
+        // CMP the decision in AL with INST: A for DETACH, E for INST, B for BB. XXX: THIS SETS FLAGS FOR BOTH
+        // JMPs (see code later), deallocation and the context pops (LEA, POP, MOVAPS) preserve them
+        BuildMI(SelMBB, SelMBB.end(), FIDebugLoc, TII.get(X86::CMP8ri)).addReg(X86::AL).addImm(0x1);
 
-        emitDeallocateStack( SelMBB, SelMBB.end(), AlignedStackSize );
+        if(AlignedStackSize)
+            emitDeallocateStack( SelMBB, SelMBB.end(), AlignedStackSize );
 
         emitPopContextRegList( saveRegs, SelMBB, SelMBB.end(), 64 );
 
         SmallVector<MachineOperand, 1> Cond;
-        Cond.push_back(MachineOperand::CreateImm(X86::COND_NE));
+        Cond.push_back(MachineOperand::CreateImm(X86::COND_A));
         // XXX: "The CFG information in MBB.Predecessors and MBB.Successors must be valid before calling this function."
         // Successors added in MCFaultInjectionPass
-        TII.InsertBranch(SelMBB, &JmpDetachMBB, &JmpFIMBB, Cond, DebugLoc());
+        TII.InsertBranch(SelMBB, &JmpDetachMBB, &JmpFIMBB, Cond, FIDebugLoc);
 
         /*dbgs() << "SelMBB\n";
           SelMBB.dump();
@@ -416,14 +677,15 @@ void X86FaultInjection::injectMachineBasicBlock(
 
         // JmpFIMBB
         {
-            // add test for FI
-            addRegOffset(BuildMI(JmpFIMBB, JmpFIMBB.end(), DebugLoc(), TII.get(X86::TEST8mi)), X86::RSP, false, RetOffset).addImm(0x1);
+            // JmpDetachMBB has left the frame
+            emitFrameCFI(JmpFIMBB, JmpFIMBB.end());
+            // Flags still hold the CMP of SelMBB, no re-test of the decision
 
             SmallVector<MachineOperand, 1> Cond;
-            Cond.push_back(MachineOperand::CreateImm(X86::COND_E));
+            Cond.push_back(MachineOperand::CreateImm(X86::COND_NE));
             // XXX: "The CFG information in MBB.Predecessors and MBB.Successors must be valid before calling this function."
             // Successors added in target-indep MCFaultInjectionPass
-            TII.InsertBranch(JmpFIMBB, &OriginalMBB, &CopyMBB, Cond, DebugLoc());
+            TII.InsertBranch(JmpFIMBB, &OriginalMBB, &CopyMBB, Cond, FIDebugLoc);
 
             /*dbgs() << "JmpFIMBB\n";
               JmpFIMBB.dump();
@@ -438,6 +700,8 @@ void X86FaultInjection::injectMachineBasicBlock(
         // CopyMBB, jump from JmpFIMBB
         {
             emitRestoreFrameFlags(CopyMBB, CopyMBB.begin());
+            // CopyMBB is at the function's end, its layout predecessor is outside the frame
+            emitFrameCFI(CopyMBB, CopyMBB.begin());
         }
     }
 
@@ -446,16 +710,318 @@ void X86FaultInjection::injectMachineBasicBlock(
     //assert(false && "CHECK!\n");
 }
 
+// XOR the bitmask at BitmaskOffset into FIReg. RSP, RBP, RAX are XORed through the saved frame,
+// EFLAGS through RAX (AL, AH hold the saved flags)
+void emitFIReg(MachineBasicBlock &MBB, MachineBasicBlock::iterator I, unsigned FIReg, int64_t BitmaskOffset)
+{
+    MachineFunction &MF = *MBB.getParent();
+    const TargetInstrInfo &TII = *MF.getSubtarget().getInstrInfo();
+    const TargetRegisterInfo &TRI = *MF.getSubtarget().getRegisterInfo();
+
+    const TargetRegisterClass *TRC = TRI.getMinimalPhysRegClass(FIReg);
+    unsigned RegSize = TRC->getSize();
+    unsigned RegSizeBits = RegSize * 8;
+
+    // ProxyFIReg defaults to the register itself. It can be set to a different 
+    // registers if FIReg = FLAGS | SP | RAX. FI operates on ProxyFIReg, and it 
+    // is later copied to FIReg, if needed.
+    unsigned ProxyFIReg = FIReg;
+
+    if(RegSizeBits <= 32) {
+        // If it's one of the workhorse registers, used a different register as a proxy
+        if(TRI.getSubRegIndex(X86::RSP, FIReg) || TRI.getSubRegIndex(X86::RBP, FIReg) || TRI.getSubRegIndex(X86::RAX, FIReg)) {
+            ProxyFIReg = X86::RBX;
+
+            unsigned RegStackOffset = 0;
+            // Set the right offset in the stack
+            if(TRI.getSubRegIndex(X86::RSP, FIReg))
+                RegStackOffset = RSPOffset;
+            else if(TRI.getSubRegIndex(X86::RBP, FIReg))
+                RegStackOffset = RBPOffset;
+            else if(TRI.getSubRegIndex(X86::RAX, FIReg))
+                RegStackOffset = RAXOffset;
+
+            // PUSH Proxy to use for FI
+            BuildMI(MBB, I, FIDebugLoc, TII.get(X86::PUSH64r)).addReg(ProxyFIReg);
+            BitmaskOffset += 8;
+            addRegOffset(BuildMI(MBB, I, FIDebugLoc, TII.get(X86::MOV64rm), ProxyFIReg), X86::RBP, false, RegStackOffset);
+        }
+        // RAX is already the proxy for EFLAGS 
+        else if(FIReg == X86::EFLAGS)
+            ProxyFIReg = X86::RAX;
+
+        addRegOffset(BuildMI(MBB, I, FIDebugLoc, TII.get(X86::XOR32rm), ProxyFIReg).addReg(ProxyFIReg), X86::RSP, false, BitmaskOffset);
+
+        if(TRI.getSubRegIndex(X86::RSP, FIReg) || TRI.getSubRegIndex(X86::RBP, FIReg) || TRI.getSubRegIndex(X86::RAX, FIReg)) {
+            unsigned RegStackOffset = 0;
+            // Set the right offset in the stack
+            if(TRI.getSubRegIndex(X86::RSP, FIReg))
+                RegStackOffset = RSPOffset;
+            else if(TRI.getSubRegIndex(X86::RBP, FIReg))
+                RegStackOffset = RBPOffset;
+            else if(TRI.getSubRegIndex(X86::RAX, FIReg))
+                RegStackOffset = RAXOffset;
+
+            // Store XOR result to stack
+            addRegOffset(BuildMI(MBB, I, FIDebugLoc, TII.get(X86::MOV64mr)), X86::RBP, false, RegStackOffset).addReg(ProxyFIReg);
+            // POP Proxy
+            BuildMI(MBB, I, FIDebugLoc, TII.get(X86::POP64r)).addReg(ProxyFIReg);
+        }
+    }
+    else if(RegSizeBits <= 64) {
+        if(FIReg == X86::RSP || FIReg == X86::RBP || FIReg == X86::RAX) {
+            ProxyFIReg = X86::RBX;
+
+            unsigned RegStackOffset = 0;
+            // Set the right offset in the stack
+            if(FIReg == X86::RSP)
+                RegStackOffset = RSPOffset;
+            else if(FIReg == X86::RBP)
+                RegStackOffset = RBPOffset;
+            else if(FIReg == X86::RAX)
+                RegStackOffset = RAXOffset;
+
+            // PUSH Proxy to use for FI
+            BuildMI(MBB, I, FIDebugLoc, TII.get(X86::PUSH64r)).addReg(ProxyFIReg);
+            BitmaskOffset += 8;
+            addRegOffset(BuildMI(MBB, I, FIDebugLoc, TII.get(X86::MOV64rm), ProxyFIReg), X86::RBP, false, RegStackOffset);
+        }
+
+        addRegOffset(BuildMI(MBB, I, FIDebugLoc, TII.get(X86::XOR64rm), ProxyFIReg).addReg(ProxyFIReg), X86::RSP, false, BitmaskOffset);
+
+        if(FIReg == X86::RSP || FIReg == X86::RBP || FIReg == X86::RAX) {
+            unsigned RegStackOffset = 0;
+            // Set the right offset in the stack
+            if(FIReg == X86::RSP)
+                RegStackOffset = RSPOffset;
+            else if(FIReg == X86::RBP)
+                RegStackOffset = RBPOffset;
+            else if(FIReg == X86::RAX)
+                RegStackOffset = RAXOffset;
+
+            // Store XOR result to stack
+            addRegOffset(BuildMI(MBB, I, FIDebugLoc, TII.get(X86::MOV64mr)), X86::RBP, false, RegStackOffset).addReg(ProxyFIReg);
+            // POP Proxy
+            BuildMI(MBB, I, FIDebugLoc, TII.get(X86::POP64r)).addReg(ProxyFIReg);
+        }
+    }
+    // XMM registers
+    else if(RegSizeBits <= 128) {
+        addRegOffset(BuildMI(MBB, I, FIDebugLoc, TII.get(X86::PXORrm), ProxyFIReg).addReg(ProxyFIReg), X86::RSP, false, BitmaskOffset);
+        /*std::string str;
+        llvm::raw_string_ostream rso(str);
+        MI2->print(rso);
+        dbgs() << "XMM " << PrintReg(FIReg, &TRI) << " MaxRegSize:" << MaxRegSize << " FIXOR: " << rso.str(); //DBG_SAFIRE*/
+    }
+    // YMM registers
+    else if(RegSizeBits <= 256) {
+        
+        addRegOffset(BuildMI(MBB, I, FIDebugLoc, TII.get(X86::VXORPSYrm), ProxyFIReg).addReg(ProxyFIReg), X86::RSP, false, BitmaskOffset);
+        /*std::string str;
+        llvm::raw_string_ostream rso(str);
+        MI2->print(rso);
+        dbgs() << "YMM " << PrintReg(FIReg, &TRI) << " MaxRegSize:" << MaxRegSize << " FIXOR: " << rso.str(); //DBG_SAFIRE*/
+
+    }
+    // ZMM registers
+    //TODO: CHECK!
+    else if(RegSizeBits <= 512) {
+        addRegOffset(BuildMI(MBB, I, FIDebugLoc, TII.get(X86::VXORPSZrm), ProxyFIReg).addReg(ProxyFIReg), X86::RSP, false, BitmaskOffset);
+        /*std::string str;
+        llvm::raw_string_ostream rso(str);
+        MI2->print(rso);
+        dbgs() << "ZMM " << PrintReg(FIReg, &TRI) << " MaxRegSize:" << MaxRegSize << " FIXOR: " << rso.str(); //DBG_SAFIRE*/
+    }
+    else
+        assert(false && "RegSizeBits is invalid!\n");
+}
+
+// Memory operand of a store, index of the base register operand or -1
+static int getStoreMemOperandNo(const MachineInstr &MI)
+{
+    const MCInstrDesc &Desc = MI.getDesc();
+    int MemOpNo = X86II::getMemoryOperandNo(Desc.TSFlags);
+    if(MemOpNo < 0)
+        return -1;
+    return MemOpNo + X86II::getOperandBias(Desc);
+}
+
+bool X86FaultInjection::isSrcFIReg(MCPhysReg Reg) const
+{
+    // XXX: high byte registers encode as SP, BP, SI, DI in the 32-bit XOR
+    if(Reg == X86::RIP || X86::GR8_ABCD_HRegClass.contains(Reg))
+        return false;
+    return Reg == X86::EFLAGS ||
+        X86::GR8RegClass.contains(Reg) || X86::GR16RegClass.contains(Reg) || X86::GR32RegClass.contains(Reg) || X86::GR64RegClass.contains(Reg) ||
+        X86::VR128XRegClass.contains(Reg) || X86::VR256XRegClass.contains(Reg) || X86::VR512RegClass.contains(Reg);
+}
+
+unsigned X86FaultInjection::getStoreFISize(const MachineInstr &MI) const
+{
+    if(!MI.mayStore())
+        return 0;
+
+    int MemOpNo = getStoreMemOperandNo(MI);
+    if(MemOpNo < 0)
+        return 0;
+
+    const MachineOperand &Base = MI.getOperand(MemOpNo + X86::AddrBaseReg);
+    const MachineOperand &Index = MI.getOperand(MemOpNo + X86::AddrIndexReg);
+    const MachineOperand &Disp = MI.getOperand(MemOpNo + X86::AddrDisp);
+    const MachineOperand &Segment = MI.getOperand(MemOpNo + X86::AddrSegmentReg);
+    if(!Base.isReg() || !Index.isReg() || !Segment.isReg())
+        return 0;
+    // XXX: FS/GS relative (TLS) addresses are not recomputed
+    if(Segment.getReg())
+        return 0;
+
+    unsigned BaseReg = Base.getReg(), IndexReg = Index.getReg();
+    if(BaseReg && BaseReg != X86::RIP && !X86::GR64RegClass.contains(BaseReg))
+        return 0;
+    if(IndexReg && !X86::GR64RegClass.contains(IndexReg))
+        return 0;
+    // RIP relative with an immediate displacement is relative to MI itself
+    if(BaseReg == X86::RIP && Disp.isImm())
+        return 0;
+
+    // The address is recomputed after MI, it must not change the base or index (PUSH, CALL, post-increments)
+    const TargetRegisterInfo *TRI = MI.getParent()->getParent()->getSubtarget().getRegisterInfo();
+    if(MI.modifiesRegister(X86::RSP, TRI))
+        return 0;
+    for(const MachineOperand &MO : MI.operands()) {
+        if(!MO.isReg() || !MO.isDef() || !MO.getReg())
+            continue;
+        if((BaseReg && TRI->regsOverlap(MO.getReg(), BaseReg)) || (IndexReg && TRI->regsOverlap(MO.getReg(), IndexReg)))
+            return 0;
+    }
+
+    for(const MachineMemOperand *MMO : MI.memoperands()) {
+        if(!MMO->isStore())
+            continue;
+        unsigned Size = MMO->getSize();
+        if(Size == 1 || Size == 2 || Size == 4 || Size == 8 || Size == 16 || Size == 32 || Size == 64)
+            return Size;
+        return 0;
+    }
+
+    return 0;
+}
+
+// XOR the bitmask at BitmaskOffset into the MemSize bytes stored by MI. Runs in a FIMBB: RSP, RBP, RAX
+// are saved at RBP-relative offsets, every other register holds its value after MI.
+void emitFIMem(MachineBasicBlock &MBB, MachineBasicBlock::iterator I, MachineInstr &MI, unsigned MemSize, int64_t BitmaskOffset)
+{
+    MachineFunction &MF = *MBB.getParent();
+    const TargetInstrInfo &TII = *MF.getSubtarget().getInstrInfo();
+    const TargetRegisterInfo &TRI = *MF.getSubtarget().getRegisterInfo();
+    X86MachineFunctionInfo *X86MFI = MF.getInfo<X86MachineFunctionInfo>();
+
+    int MemOpNo = getStoreMemOperandNo(MI);
+    assert(MemOpNo >= 0 && "MI has no memory operand!\n");
+    unsigned BaseReg = MI.getOperand(MemOpNo + X86::AddrBaseReg).getReg();
+    int64_t Scale = MI.getOperand(MemOpNo + X86::AddrScaleAmt).getImm();
+    unsigned IndexReg = MI.getOperand(MemOpNo + X86::AddrIndexReg).getReg();
+    const MachineOperand &Disp = MI.getOperand(MemOpNo + X86::AddrDisp);
+
+    // Scratch registers for the address and the bitmask, distinct from base and index
+    unsigned AddrReg = 0, ValReg = 0;
+    for(unsigned Reg : { X86::RBX, X86::RCX, X86::RDX, X86::RSI, X86::RDI, X86::R8, X86::R9, X86::R10, X86::R11 }) {
+        if(Reg == BaseReg || Reg == IndexReg)
+            continue;
+        if(!AddrReg)
+            AddrReg = Reg;
+        else if(!ValReg) {
+            ValReg = Reg;
+            break;
+        }
+    }
+
+    BuildMI(MBB, I, FIDebugLoc, TII.get(X86::PUSH64r)).addReg(AddrReg);
+    BuildMI(MBB, I, FIDebugLoc, TII.get(X86::PUSH64r)).addReg(ValReg);
+    BitmaskOffset += 16;
+
+    // Reload the workhorse registers to their original values
+    if(BaseReg == X86::RSP || BaseReg == X86::RBP || BaseReg == X86::RAX) {
+        int RegStackOffset = ( BaseReg == X86::RSP ? RSPOffset : ( BaseReg == X86::RBP ? RBPOffset : RAXOffset ) );
+        addRegOffset(BuildMI(MBB, I, FIDebugLoc, TII.get(X86::MOV64rm), AddrReg), X86::RBP, false, RegStackOffset);
+        // The saved RSP is below the red zone
+        if(BaseReg == X86::RSP && X86MFI->getUsesRedZone())
+            addRegOffset(BuildMI(MBB, I, FIDebugLoc, TII.get(X86::LEA64r), AddrReg), AddrReg, false, 128);
+        BaseReg = AddrReg;
+    }
+    if(IndexReg == X86::RBP || IndexReg == X86::RAX) {
+        int RegStackOffset = ( IndexReg == X86::RBP ? RBPOffset : RAXOffset );
+        addRegOffset(BuildMI(MBB, I, FIDebugLoc, TII.get(X86::MOV64rm), ValReg), X86::RBP, false, RegStackOffset);
+        IndexReg = ValReg;
+    }
+
+    // LEA AddrReg <= effective address of MI
+    BuildMI(MBB, I, FIDebugLoc, TII.get(X86::LEA64r), AddrReg)
+        .addReg(BaseReg).addImm(Scale).addReg(IndexReg).addOperand(Disp).addReg(0);
+
+    // XOR the bitmask into memory, 8B at a time
+    for(unsigned Off = 0; Off < MemSize; Off += 8) {
+        addRegOffset(BuildMI(MBB, I, FIDebugLoc, TII.get(X86::MOV64rm), ValReg), X86::RSP, false, BitmaskOffset + Off);
+        switch(MemSize) {
+            case 1:
+                addDirectMem(BuildMI(MBB, I, FIDebugLoc, TII.get(X86::XOR8mr)), AddrReg).addReg(TRI.getSubReg(ValReg, X86::sub_8bit));
+                break;
+            case 2:
+                addDirectMem(BuildMI(MBB, I, FIDebugLoc, TII.get(X86::XOR16mr)), AddrReg).addReg(TRI.getSubReg(ValReg, X86::sub_16bit));
+                break;
+            case 4:
+                addDirectMem(BuildMI(MBB, I, FIDebugLoc, TII.get(X86::XOR32mr)), AddrReg).addReg(TRI.getSubReg(ValReg, X86::sub_32bit));
+                break;
+            default:
+                addRegOffset(BuildMI(MBB, I, FIDebugLoc, TII.get(X86::XOR64mr)), AddrReg, false, Off).addReg(ValReg);
+        }
+    }
+
+    BuildMI(MBB, I, FIDebugLoc, TII.get(X86::POP64r)).addReg(ValReg);
+    BuildMI(MBB, I, FIDebugLoc, TII.get(X86::POP64r)).addReg(AddrReg);
+}
+
+// Static table of the op sizes in bytes, doInject arg2: FIRegs, then the destination memory operand.
+// Private constant named by the sizes, e.g., safire.opsizes.8.8, one table per distinct list in the module
+GlobalVariable *getOpSizeTable(MachineFunction &MF, std::vector<MCPhysReg> const &FIRegs, unsigned MemSize)
+{
+    const TargetRegisterInfo &TRI = *MF.getSubtarget().getRegisterInfo();
+    // XXX: codegen sees the module const, the table is emitted with the globals at AsmPrinter::doFinalization
+    Module &M = *const_cast<Module *>( MF.getFunction()->getParent() );
+
+    SmallVector<uint64_t, 4> Sizes;
+    for(auto FIReg : FIRegs)
+        Sizes.push_back( TRI.getMinimalPhysRegClass(FIReg)->getSize() );
+    if(MemSize)
+        Sizes.push_back(MemSize);
+
+    std::string Name = "safire.opsizes";
+    for(uint64_t Size : Sizes)
+        Name += "." + std::to_string(Size);
+
+    if(GlobalVariable *GV = M.getNamedGlobal(Name))
+        return GV;
+
+    Constant *Init = ConstantDataArray::get(M.getContext(), Sizes);
+    GlobalVariable *GV = new GlobalVariable(M, Init->getType(), true, GlobalValue::PrivateLinkage, Init, Name);
+    GV->setUnnamedAddr(GlobalValue::UnnamedAddr::Global);
+    GV->setAlignment(8);
+    return GV;
+}
+
 void X86FaultInjection::injectFault(MachineFunction &MF,
         MachineInstr &MI,
         std::vector<MCPhysReg> const &FIRegs,
+        unsigned MemSize,
+        uint64_t SiteID,
+        unsigned InstIdx,
         MachineBasicBlock &InstSelMBB,
         MachineBasicBlock &PreFIMBB,
         SmallVector<MachineBasicBlock *, 4> &OpSelMBBs,
         SmallVector<MachineBasicBlock *, 4> &FIMBBs,
-        MachineBasicBlock &PostFIMBB) const
+        MachineBasicBlock &PostFIMBB,
+        MachineBasicBlock *ResumeMBB) const
 {
-    const X86Subtarget &Subtarget = MF.getSubtarget<X86Subtarget>();
     const TargetInstrInfo &TII = *MF.getSubtarget().getInstrInfo();
     const MachineRegisterInfo &MRI = MF.getRegInfo();
     const TargetRegisterInfo &TRI = *MRI.getTargetRegisterInfo();
@@ -471,8 +1037,11 @@ void X86FaultInjection::injectFault(MachineFunction &MF,
     saveRegs.push_back(X86::RDI);
     saveRegs.push_back(X86::RSI);
     saveRegs.push_back(X86::RDX);
-    saveRegs.push_back(X86::RCX);
     
+    initFIDebugLoc(MF);
+    // XXX: MI is not a CFI_INSTRUCTION, the rule before MI holds after it too
+    initFrameCFI(*MI.getParent(), MI.getIterator());
+
     LiveRegs.clear();
     MachineBasicBlock *MBB = MI.getParent();
     LiveRegs.addLiveOuts(*MBB);
@@ -488,6 +1057,7 @@ void X86FaultInjection::injectFault(MachineFunction &MF,
     //MBB->dump();
     fillSaveRegs(saveRegs, LiveRegs, &TRI);
     //dbgs() << "==== END MBB ====\n";
+    initFrameSave(MF, LiveRegs, &MI, FIRegs);
     
     unsigned MaxRegSize = 0;
     // Find maximum size of target register to allocate stack space for the bitmask
@@ -501,6 +1071,10 @@ void X86FaultInjection::injectFault(MachineFunction &MF,
     }
     //dbgs() << "\n";
 
+    // The destination memory operand, if any, is the last operand after the registers
+    unsigned NumOps = FIRegs.size() + (MemSize ? 1 : 0);
+    MaxRegSize = MemSize > MaxRegSize ? MemSize : MaxRegSize;
+
     assert(MaxRegSize > 0 && "MaxRegSize must be > 0\n");
 
     /* ============================================================= CREATE InstSelMBB ========================================================== */
@@ -518,44 +1092,22 @@ void X86FaultInjection::injectFault(MachineFunction &MF,
     {
         emitPushContextRegList( saveRegs, InstSelMBB, InstSelMBB.end(), 64 );
 
-#ifdef INSTR_PRINT
-        std::string instr_str;
-        llvm::raw_string_ostream rso(instr_str);
-        //MI.print(rso, true); //skip operands
-        MI.print(rso); //include operands
-        //dbgs() << rso.str() << "size:" << rso.str().size() << "c_str size:" << strlen(rso.str().c_str())+1 << "\n";
-#endif
-#ifdef INSTR_PRINT
-        // out arg1 + in arg str
-        int64_t size = 8 + rso.str().size()+1/*str size + 1 for NUL char*/;
-#else
-        // out arg1
-        int64_t size = 8;
-#endif
-        int64_t AlignedStackSize = emitAllocateStackAlign( InstSelMBB, InstSelMBB.end(), size, 64 );
-        // MOV RDI <= RSP, selInst out arg1
-        addRegOffset(BuildMI(InstSelMBB, InstSelMBB.end(), DebugLoc(), TII.get(X86::LEA64r), X86::RDI), X86::RSP, false, 0);
-#ifdef INSTR_PRINT
-        // LEA RSI <= &op, doInject arg2 (uint64_t *, &op, 8B), 8 is the offset from arg1
-        addRegOffset(BuildMI(InstSelMBB, InstSelMBB.end(), DebugLoc(), TII.get(X86::LEA64r), X86::RSI), X86::RSP, false, 8);
-        int i = 0;
-        for(char c : rso.str()) {
-            addRegOffset(BuildMI(InstSelMBB, InstSelMBB.end(), DebugLoc(), TII.get(X86::MOV8mi)), X86::RSI, false, i*sizeof(char)).addImm(c);
-            i++;
-        }
-        // Add terminating NUL character
-        addRegOffset(BuildMI(InstSelMBB, InstSelMBB.end(), DebugLoc(), TII.get(X86::MOV8mi)), X86::RSI, false, i*sizeof(char)).addImm(0);
-#endif
+        // MOV RDI <= SiteID, selInst arg1 (uint64_t, static site ID of the MBB, 0 without FF)
+        BuildMI(InstSelMBB, InstSelMBB.end(), FIDebugLoc, TII.get(X86::MOV64ri), X86::RDI).addImm(SiteID);
+        // MOV RSI <= InstIdx, selInst arg2 (uint64_t, index of MI in the MBB, from 1)
+        BuildMI(InstSelMBB, InstSelMBB.end(), FIDebugLoc, TII.get(X86::MOV64ri), X86::RSI).addImm(InstIdx);
+        int64_t AlignedStackSize = emitAlignCall( InstSelMBB, InstSelMBB.end() );
 
         // XXX: Create the external symbol and get target flags (e.g, X86II::MO_PLT) for linking
         MachineOperand MO = MachineOperand::CreateES("selInst");
-        MO.setTargetFlags( Subtarget.classifyGlobalFunctionReference( nullptr, *MF.getMMI().getModule() ) );
-        BuildMI(InstSelMBB, InstSelMBB.end(), DebugLoc(), TII.get(X86::CALL64pcrel32)).addOperand( MO );
+        MO.setTargetFlags( getHookTargetFlags(MF) );
+        BuildMI(InstSelMBB, InstSelMBB.end(), FIDebugLoc, TII.get(X86::CALL64pcrel32)).addOperand( MO );
 
-        // TEST for jump (see code later), XXX: THIS SETS FLAGS FOR THE JMP, be careful not to mess with them until the branch
-        addDirectMem(BuildMI(InstSelMBB, InstSelMBB.end(), DebugLoc(), TII.get(X86::TEST8mi)), X86::RSP).addImm(0x1);
+        // TEST the decision in AL for jump (see code later), XXX: THIS SETS FLAGS FOR THE JMP, be careful not to mess with them until the branch
+        BuildMI(InstSelMBB, InstSelMBB.end(), FIDebugLoc, TII.get(X86::TEST8ri)).addReg(X86::AL).addImm(0x1);
 
-        emitDeallocateStack( InstSelMBB, InstSelMBB.end(), AlignedStackSize );
+        if(AlignedStackSize)
+            emitDeallocateStack( InstSelMBB, InstSelMBB.end(), AlignedStackSize );
 
         emitPopContextRegList( saveRegs, InstSelMBB, InstSelMBB.end(), 64 );
 
@@ -563,7 +1115,7 @@ void X86FaultInjection::injectFault(MachineFunction &MF,
         Cond.push_back(MachineOperand::CreateImm(X86::COND_E));
         InstSelMBB.addSuccessor(&PostFIMBB);
         InstSelMBB.addSuccessor(&PreFIMBB);
-        TII.InsertBranch(InstSelMBB, &PostFIMBB, &PreFIMBB, Cond, DebugLoc());
+        TII.InsertBranch(InstSelMBB, &PostFIMBB, &PreFIMBB, Cond, FIDebugLoc);
     }
 
     /* ============================================================= END OF InstSelMBB ========================================================== */
@@ -574,67 +1126,55 @@ void X86FaultInjection::injectFault(MachineFunction &MF,
 
     emitPushContextRegList( saveRegs, PreFIMBB, PreFIMBB.end(), 64 );
 
-    // The size and number of pointer arguments other than the bitmask
-    unsigned PointerDataSize = 8;
-    // SUB to create stack space for doInject arg2, arg3, arg4
-    // TODO: Reduce stack space, ops, size array fit in uint16_t types
-    // XXX: Align to 16-bytes
-    int64_t size = (PointerDataSize + FIRegs.size() * PointerDataSize + MaxRegSize);
-    int64_t AlignedStackSize = emitAllocateStackAlign( PreFIMBB, PreFIMBB.end(), size, 64 );
+    // SUB to create stack space for the bitmask, doInject arg3, and the selected op
+    // XXX: Align to 64-bytes, the bitmask is XORed into vector registers
+    int64_t OpSize = 8;
+    int64_t AlignedStackSize = emitAllocateStackAlign( PreFIMBB, PreFIMBB.end(), MaxRegSize + OpSize, 64 );
     // MOV RDI <= FIRegs.size(), doInject arg1 (uint64_t, number of ops)
-    BuildMI(PreFIMBB, PreFIMBB.end(), DebugLoc(), TII.get(X86::MOV64ri), X86::RDI).addImm(FIRegs.size());
-    // LEA RSI <= &op, doInject arg2 (uint64_t *, &op, 8B)
-    addRegOffset(BuildMI(PreFIMBB, PreFIMBB.end(), DebugLoc(), TII.get(X86::LEA64r), X86::RSI), X86::RSP, false, MaxRegSize + PointerDataSize * FIRegs.size());
-    // LEA RDX <= &size, doInject arg3 (uint64_t *, &size, number of ops * 8B)
-    addRegOffset(BuildMI(PreFIMBB, PreFIMBB.end(), DebugLoc(), TII.get(X86::LEA64r), X86::RDX), X86::RSP, false, MaxRegSize);
-    // MOV RDX <= RSP, doInject arg4 (uint8_t *, &bitmask, MaxRegSize B)
-    addRegOffset(BuildMI(PreFIMBB, PreFIMBB.end(), DebugLoc(), TII.get(X86::LEA64r), X86::RCX), X86::RSP, false, 0);
+    BuildMI(PreFIMBB, PreFIMBB.end(), FIDebugLoc, TII.get(X86::MOV64ri), X86::RDI).addImm(NumOps);
+    // LEA RSI <= &size, doInject arg2 (const uint64_t *, static table of the op sizes, RIP-relative)
+    BuildMI(PreFIMBB, PreFIMBB.end(), FIDebugLoc, TII.get(X86::LEA64r), X86::RSI)
+        .addReg(X86::RIP).addImm(1).addReg(0).addGlobalAddress(getOpSizeTable(MF, FIRegs, MemSize)).addReg(0);
+    // LEA RDX <= RSP, doInject arg3 (uint8_t *, &bitmask, MaxRegSize B)
+    addRegOffset(BuildMI(PreFIMBB, PreFIMBB.end(), FIDebugLoc, TII.get(X86::LEA64r), X86::RDX), X86::RSP, false, 0);
     int64_t BitmaskStackOffset = StackOffset;
     // XXX: Beward of type casts, signed integers needed
-    int64_t OpSelStackOffset = StackOffset + (int64_t)MaxRegSize + (int64_t)PointerDataSize * FIRegs.size();
-    // Fill in size array
-    for(unsigned i = 0; i < FIRegs.size(); i++) {
-        unsigned FIReg = FIRegs[i];
-        const TargetRegisterClass *TRC = TRI.getMinimalPhysRegClass(FIReg);
-        // Size is in bytes
-        unsigned RegSize = TRC->getSize();
-        MaxRegSize = RegSize > MaxRegSize ? RegSize : MaxRegSize;
-        addRegOffset(BuildMI(PreFIMBB, PreFIMBB.end(), DebugLoc(), TII.get(X86::MOV64mi32)), X86::RDX, false, i * PointerDataSize).addImm(RegSize);
-    }
-
-    //addDirectMem(BuildMI(PreFIMBB, PreFIMBB.end(), DebugLoc(), TII.get(X86::MOV64mi32)), X86::RDI).addImm(0x0);
+    int64_t OpSelStackOffset = StackOffset + (int64_t)MaxRegSize;
 
     // XXX: Create the external symbol and get target flags (e.g, X86II::MO_PLT) for linking
     MachineOperand MO = MachineOperand::CreateES("doInject");
-    MO.setTargetFlags( Subtarget.classifyGlobalFunctionReference( nullptr, *MF.getMMI().getModule() ) );
-    BuildMI(PreFIMBB, PreFIMBB.end(), DebugLoc(), TII.get(X86::CALL64pcrel32)).addOperand( MO );
+    MO.setTargetFlags( getHookTargetFlags(MF) );
+    BuildMI(PreFIMBB, PreFIMBB.end(), FIDebugLoc, TII.get(X86::CALL64pcrel32)).addOperand( MO );
+
+    // MOV [RSP + MaxRegSize] <= RAX, the selected op returned by doInject, read by OpSelMBBs
+    addRegOffset(BuildMI(PreFIMBB, PreFIMBB.end(), FIDebugLoc, TII.get(X86::MOV64mr)), X86::RSP, false, MaxRegSize).addReg(X86::RAX);
 
-    // POP doInject arg2, arg3, ar4
+    // POP the bitmask and the selected op, they are read below RSP by OpSelMBBs and FIMBBs
     emitDeallocateStack( PreFIMBB, PreFIMBB.end(), AlignedStackSize );
 
     emitPopContextRegList( saveRegs, PreFIMBB, PreFIMBB.end(), 64 );
 
     PreFIMBB.addSuccessor(OpSelMBBs.front()); 
-    TII.InsertBranch(PreFIMBB, OpSelMBBs.front(), nullptr, None, DebugLoc());
+    TII.InsertBranch(PreFIMBB, OpSelMBBs.front(), nullptr, None, FIDebugLoc);
 
     /* ============================================================= END OF PreFIMBB ============================================================= */
 
     /* ============================================================== CREATE OpSelMBBs =============================================================== */
 
     // Jump tables to selected op
-    for(int OpIdx = FIRegs.size()-1, OpSelIdx = 0; OpIdx > 0; OpIdx--, OpSelIdx++) { //no need to jump to 0th operand, fall through
+    for(int OpIdx = NumOps-1, OpSelIdx = 0; OpIdx > 0; OpIdx--, OpSelIdx++) { //no need to jump to 0th operand, fall through
         MachineBasicBlock &OpSelMBB = *OpSelMBBs[OpSelIdx];
         MachineBasicBlock *NextOpSelMBB = OpSelMBBs[OpSelIdx+1];
-        addRegOffset(BuildMI(OpSelMBB, OpSelMBB.end(), DebugLoc(), TII.get(X86::CMP64mi8)), X86::RSP, false, OpSelStackOffset).addImm(OpIdx);
+        addRegOffset(BuildMI(OpSelMBB, OpSelMBB.end(), FIDebugLoc, TII.get(X86::CMP64mi8)), X86::RSP, false, OpSelStackOffset).addImm(OpIdx);
         SmallVector<MachineOperand, 1> Cond;
         Cond.push_back(MachineOperand::CreateImm(X86::COND_E));
         OpSelMBB.addSuccessor(FIMBBs[OpIdx]);
         OpSelMBB.addSuccessor(NextOpSelMBB);
-        TII.InsertBranch(OpSelMBB, FIMBBs[OpIdx], NextOpSelMBB, Cond, DebugLoc());
+        TII.InsertBranch(OpSelMBB, FIMBBs[OpIdx], NextOpSelMBB, Cond, FIDebugLoc);
     }
     // Add the fall through OpSelMBB
     OpSelMBBs.back()->addSuccessor(FIMBBs[0]);
-    TII.InsertBranch(*(OpSelMBBs.back()), FIMBBs[0], nullptr, None, DebugLoc());
+    TII.InsertBranch(*(OpSelMBBs.back()), FIMBBs[0], nullptr, None, FIDebugLoc);
 
     /* ============================================================== END OF OpSelMBBs =============================================================== */
 
@@ -643,126 +1183,39 @@ void X86FaultInjection::injectFault(MachineFunction &MF,
     for(unsigned idx = 0; idx < FIRegs.size(); idx++) {
         unsigned FIReg = FIRegs[idx];
         MachineBasicBlock &FIMBB = *FIMBBs[idx];
-
-        const TargetRegisterClass *TRC = TRI.getMinimalPhysRegClass(FIReg);
-        unsigned RegSize = TRC->getSize();
-        unsigned RegSizeBits = RegSize * 8;
-
-        // ProxyFIReg defaults to the register itself. It can be set to a different 
-        // registers if FIReg = FLAGS | SP | RAX. FI operates on ProxyFIReg, and it 
-        // is later copied to FIReg, if needed.
-        unsigned ProxyFIReg = FIReg;
-
-        if(RegSizeBits <= 32) {
-            // If it's one of the workhorse registers, used a different register as a proxy
-            if(TRI.getSubRegIndex(X86::RSP, FIReg) || TRI.getSubRegIndex(X86::RBP, FIReg) || TRI.getSubRegIndex(X86::RAX, FIReg)) {
-                ProxyFIReg = X86::RBX;
-
-                unsigned RegStackOffset = 0;
-                // Set the right offset in the stack
-                if(TRI.getSubRegIndex(X86::RSP, FIReg))
-                    RegStackOffset = RSPOffset;
-                else if(TRI.getSubRegIndex(X86::RBP, FIReg))
-                    RegStackOffset = RBPOffset;
-                else if(TRI.getSubRegIndex(X86::RAX, FIReg))
-                    RegStackOffset = RAXOffset;
-
-                // PUSH Proxy to use for FI
-                BuildMI(FIMBB, FIMBB.end(), DebugLoc(), TII.get(X86::PUSH64r)).addReg(ProxyFIReg);
-                BitmaskStackOffset += 8;
-                addRegOffset(BuildMI(FIMBB, FIMBB.end(), DebugLoc(), TII.get(X86::MOV64rm), ProxyFIReg), X86::RBP, false, RegStackOffset);
-            }
-            // RAX is already the proxy for EFLAGS 
-            else if(FIReg == X86::EFLAGS)
-                ProxyFIReg = X86::RAX;
-
-            addRegOffset(BuildMI(FIMBB, FIMBB.end(), DebugLoc(), TII.get(X86::XOR32rm), ProxyFIReg).addReg(ProxyFIReg), X86::RSP, false, BitmaskStackOffset);
-
-            if(TRI.getSubRegIndex(X86::RSP, FIReg) || TRI.getSubRegIndex(X86::RBP, FIReg) || TRI.getSubRegIndex(X86::RAX, FIReg)) {
-                unsigned RegStackOffset = 0;
-                // Set the right offset in the stack
-                if(TRI.getSubRegIndex(X86::RSP, FIReg))
-                    RegStackOffset = RSPOffset;
-                else if(TRI.getSubRegIndex(X86::RBP, FIReg))
-                    RegStackOffset = RBPOffset;
-                else if(TRI.getSubRegIndex(X86::RAX, FIReg))
-                    RegStackOffset = RAXOffset;
-
-                // Store XOR result to stack
-                addRegOffset(BuildMI(FIMBB, FIMBB.end(), DebugLoc(), TII.get(X86::MOV64mr)), X86::RBP, false, RegStackOffset).addReg(ProxyFIReg);
-                // POP Proxy
-                BuildMI(FIMBB, FIMBB.end(), DebugLoc(), TII.get(X86::POP64r)).addReg(ProxyFIReg);
-            }
-        }
-        else if(RegSizeBits <= 64) {
-            if(FIReg == X86::RSP || FIReg == X86::RBP || FIReg == X86::RAX) {
-                ProxyFIReg = X86::RBX;
-
-                unsigned RegStackOffset = 0;
-                // Set the right offset in the stack
-                if(FIReg == X86::RSP)
-                    RegStackOffset = RSPOffset;
-                else if(FIReg == X86::RBP)
-                    RegStackOffset = RBPOffset;
-                else if(FIReg == X86::RAX)
-                    RegStackOffset = RAXOffset;
-
-                // PUSH Proxy to use for FI
-                BuildMI(FIMBB, FIMBB.end(), DebugLoc(), TII.get(X86::PUSH64r)).addReg(ProxyFIReg);
-                BitmaskStackOffset += 8;
-                addRegOffset(BuildMI(FIMBB, FIMBB.end(), DebugLoc(), TII.get(X86::MOV64rm), ProxyFIReg), X86::RBP, false, RegStackOffset);
-            }
-
-            addRegOffset(BuildMI(FIMBB, FIMBB.end(), DebugLoc(), TII.get(X86::XOR64rm), ProxyFIReg).addReg(ProxyFIReg), X86::RSP, false, BitmaskStackOffset);
-
-            if(FIReg == X86::RSP || FIReg == X86::RBP || FIReg == X86::RAX) {
-                unsigned RegStackOffset = 0;
-                // Set the right offset in the stack
-                if(FIReg == X86::RSP)
-                    RegStackOffset = RSPOffset;
-                else if(FIReg == X86::RBP)
-                    RegStackOffset = RBPOffset;
-                else if(FIReg == X86::RAX)
-                    RegStackOffset = RAXOffset;
-
-                // Store XOR result to stack
-                addRegOffset(BuildMI(FIMBB, FIMBB.end(), DebugLoc(), TII.get(X86::MOV64mr)), X86::RBP, false, RegStackOffset).addReg(ProxyFIReg);
-                // POP Proxy
-                BuildMI(FIMBB, FIMBB.end(), DebugLoc(), TII.get(X86::POP64r)).addReg(ProxyFIReg);
-            }
-        }
-        // XMM registers
-        else if(RegSizeBits <= 128) {
-            addRegOffset(BuildMI(FIMBB, FIMBB.end(), DebugLoc(), TII.get(X86::PXORrm), ProxyFIReg).addReg(ProxyFIReg), X86::RSP, false, BitmaskStackOffset);
-            /*std::string str;
-            llvm::raw_string_ostream rso(str);
-            MI2->print(rso);
-            dbgs() << "XMM " << PrintReg(FIReg, &TRI) << " MaxRegSize:" << MaxRegSize << " FIXOR: " << rso.str(); //DBG_SAFIRE*/
+        // The previous FIMBB may have left the frame to resume after MI
+        if(ResumeMBB)
+            emitFrameCFI(FIMBB, FIMBB.end());
+        emitFIReg(FIMBB, FIMBB.end(), FIReg, BitmaskStackOffset);
+
+        // Undo a source fault after MI, unless MI overwrites the register, so the fault hits only this read.
+        // MI runs in FIMBB between frame restore and save, the stack is re-aligned to the same RSP so the
+        // bitmask is at the same offset.
+        // XXX: the copy of MI is not instrumented again, FI has already happened on this path
+        if(ResumeMBB && !MI.modifiesRegister(FIReg, &TRI) && !MI.modifiesRegister(X86::RSP, &TRI) && !MI.isNotDuplicable()) {
+            emitRestoreFrameFlags( FIMBB, FIMBB.end() );
+            FIMBB.push_back( MF.CloneMachineInstr(&MI) );
+            emitSaveFrameFlags( FIMBB, FIMBB.end() );
+            emitAlignStack( FIMBB, FIMBB.end(), 64 );
+            emitFIReg(FIMBB, FIMBB.end(), FIReg, BitmaskStackOffset);
+            emitRestoreFrameFlags( FIMBB, FIMBB.end() );
+            FIMBB.addSuccessor(ResumeMBB);
+            TII.InsertBranch(FIMBB, ResumeMBB, nullptr, None, FIDebugLoc);
+            continue;
         }
-        // YMM registers
-        else if(RegSizeBits <= 256) {
-            
-            addRegOffset(BuildMI(FIMBB, FIMBB.end(), DebugLoc(), TII.get(X86::VXORPSYrm), ProxyFIReg).addReg(ProxyFIReg), X86::RSP, false, BitmaskStackOffset);
-            /*std::string str;
-            llvm::raw_string_ostream rso(str);
-            MI2->print(rso);
-            dbgs() << "YMM " << PrintReg(FIReg, &TRI) << " MaxRegSize:" << MaxRegSize << " FIXOR: " << rso.str(); //DBG_SAFIRE*/
 
-        }
-        // ZMM registers
-        //TODO: CHECK!
-        else if(RegSizeBits <= 512) {
-            addRegOffset(BuildMI(FIMBB, FIMBB.end(), DebugLoc(), TII.get(X86::VXORPSZrm), ProxyFIReg).addReg(ProxyFIReg), X86::RSP, false, BitmaskStackOffset);
-            /*std::string str;
-            llvm::raw_string_ostream rso(str);
-            MI2->print(rso);
-            dbgs() << "ZMM " << PrintReg(FIReg, &TRI) << " MaxRegSize:" << MaxRegSize << " FIXOR: " << rso.str(); //DBG_SAFIRE*/
-        }
-        else
-            assert(false && "RegSizeBits is invalid!\n");
+        FIMBB.addSuccessor(&PostFIMBB);
+        TII.InsertBranch(FIMBB, &PostFIMBB, nullptr, None, FIDebugLoc);
+    }
 
+    // Destination memory operand
+    if(MemSize) {
+        MachineBasicBlock &FIMBB = *FIMBBs.back();
+        if(ResumeMBB)
+            emitFrameCFI(FIMBB, FIMBB.end());
+        emitFIMem(FIMBB, FIMBB.end(), MI, MemSize, BitmaskStackOffset);
         FIMBB.addSuccessor(&PostFIMBB);
-        TII.InsertBranch(FIMBB, &PostFIMBB, nullptr, None, DebugLoc());
+        TII.InsertBranch(FIMBB, &PostFIMBB, nullptr, None, FIDebugLoc);
     }
 
     /* ============================================================== END OF FIMBB =============================================================== */
@@ -770,6 +1223,8 @@ void X86FaultInjection::injectFault(MachineFunction &MF,
     /* ============================================================ CREATE PostFIMBB ============================================================= */
 
     {
+        if(ResumeMBB)
+            emitFrameCFI( PostFIMBB, PostFIMBB.end() );
         emitRestoreFrameFlags( PostFIMBB, PostFIMBB.end() );
     }
 
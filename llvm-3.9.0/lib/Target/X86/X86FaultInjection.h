@@ -11,17 +11,24 @@ namespace llvm {
             void injectFault(MachineFunction &MF,
                     MachineInstr &MI,
                     std::vector<MCPhysReg> const &FIRegs,
+                    unsigned MemSize,
+                    uint64_t SiteID,
+                    unsigned InstIdx,
                     MachineBasicBlock &InstSelMBB,
                     MachineBasicBlock &PreFIMBB,
                     SmallVector<MachineBasicBlock *, 4> &OpSelMBBs,
                     SmallVector<MachineBasicBlock *, 4> &FIMBBs,
-                    MachineBasicBlock &PostFIMBB) const override;
+                    MachineBasicBlock &PostFIMBB,
+                    MachineBasicBlock *ResumeMBB) const override;
             void injectMachineBasicBlock(MachineBasicBlock &SelMBB,
                     MachineBasicBlock &JmpDetachMBB,
                     MachineBasicBlock &JmpFIMBB,
                     MachineBasicBlock &MBB,
                     MachineBasicBlock &CopyMBB,
-                    uint64_t TargetInstrCount) const override;
+                    uint64_t TargetInstrCount,
+                    uint64_t SiteID) const override;
+            unsigned getStoreFISize(const MachineInstr &MI) const override;
+            bool isSrcFIReg(MCPhysReg Reg) const override;
     };
 } // end namespace llvm
 
@@ -0,0 +1,82 @@
+; RUN: llc < %s -mtriple=x86_64-unknown-linux-gnu -verify-machineinstrs -fi -fi-ff -fi-funcs=csr,live -fi-inst-types=* -fi-reg-types=dst | FileCheck %s
+
+; Frame save around the selMBB hook from the live-ins of the block: EFLAGS is saved (SETO+LAHF) and
+; restored (ADD+SAHF) only if live across the block start, the caller's RBP is reloaded only if RBP
+; is live or pristine. The exit block of csr has dead EFLAGS and RBP, saved by the prologue and popped
+; by the epilogue, the select sink of live has EFLAGS live-in for the CMOV and a pristine RBP
+
+; CHECK-LABEL: csr:
+; CHECK: # %exit
+; CHECK-NEXT: pushq %rsp
+; CHECK-NEXT: pushq %rbp
+; CHECK-NEXT: leaq 8(%rsp), %rbp
+; CHECK-NEXT: pushq %rax
+; CHECK-NEXT: andq $-64, %rsp
+; CHECK: callq selMBB
+; CHECK-NEXT: cmpb $1, %al
+; CHECK-NOT: {{seto|lahf|sahf}}
+; CHECK: movq -16(%rbp), %rax
+; CHECK-NEXT: movq (%rbp), %rsp
+; CHECK-NEXT: jmp
+; CHECK-NOT: {{seto|lahf|sahf}}
+; CHECK: movq -16(%rbp), %rax
+; CHECK-NEXT: movq (%rbp), %rsp
+; CHECK-NEXT: addq $8, %rsp
+; CHECK: popq %rbp
+; CHECK-NEXT: retq
+
+; CHECK-LABEL: live:
+; CHECK: pushq %rax
+; CHECK-NEXT: andq $-64, %rsp
+; CHECK: callq selMBB
+; CHECK-NOT: {{seto|lahf|sahf}}
+; CHECK: cmpl %esi, %edi
+; CHECK-NEXT: jl
+; CHECK: # %entry
+; CHECK-NEXT: pushq %rsp
+; CHECK-NEXT: pushq %rbp
+; CHECK-NEXT: leaq 8(%rsp), %rbp
+; CHECK-NEXT: pushq %rax
+; CHECK-NEXT: seto %al
+; CHECK-NEXT: lahf
+; CHECK-NEXT: andq $-64, %rsp
+; CHECK: callq selMBB
+; CHECK-NEXT: cmpb $1, %al
+; CHECK: addb $127, %al
+; CHECK-NEXT: sahf
+; CHECK-NEXT: movq -16(%rbp), %rax
+; CHECK-NEXT: movq (%rbp), %rsp
+; CHECK-NEXT: movq -8(%rbp), %rbp
+; CHECK-NEXT: jmp
+; CHECK: addb $127, %al
+; CHECK-NEXT: sahf
+; CHECK-NEXT: movq -16(%rbp), %rax
+; CHECK-NEXT: movq (%rbp), %rsp
+; CHECK-NEXT: movq -8(%rbp), %rbp
+; CHECK-NEXT: movb %cl, %dl
+
+declare void @g()
+declare void @h(i64, i64, i64, i64, i64, i64)
+
+define void @csr(i64 %a, i64 %b, i64 %c, i64 %d, i64 %e, i64 %f, i1 %t) nounwind {
+entry:
+  call void @g()
+  call void @h(i64 %a, i64 %b, i64 %c, i64 %d, i64 %e, i64 %f)
+  br i1 %t, label %then, label %exit
+
+then:
+  call void @g()
+  br label %exit
+
+exit:
+  ret void
+}
+
+define i32 @live(i32 %a, i32 %b, i8 %x, i8 %y, i32 %w) nounwind {
+entry:
+  %c = icmp slt i32 %a, %b
+  %s1 = select i1 %c, i8 %x, i8 %y
+  %z = zext i8 %s1 to i32
+  %s2 = select i1 %c, i32 %z, i32 %w
+  ret i32 %s2
+}
@@ -0,0 +1,68 @@
+; RUN: llc < %s -mtriple=x86_64-unknown-linux-gnu -verify-machineinstrs -fi -fi-funcs=sum -fi-inst-types=* -fi-reg-types=dst | FileCheck %s --check-prefix=CHECK --check-prefix=NOFF
+; RUN: llc < %s -mtriple=x86_64-unknown-linux-gnu -verify-machineinstrs -fi -fi-ff -fi-funcs=sum -fi-inst-types=* -fi-reg-types=dst | FileCheck %s --check-prefix=CHECK --check-prefix=FF
+
+; Hook ABI v2: selMBB(num_insts, site), selInst(site, inst) and doInject(num_ops, sizes, bitmask), the
+; decision returned in AL and tested in the register, the op sizes in a private table per distinct
+; list, and a reference to the version symbol of the runtime. Without FF the site of selInst is 0,
+; with FF it is the site of the block passed to selMBB
+
+; CHECK-LABEL: sum:
+; NOFF-NOT: selMBB
+; NOFF: movabsq $0, %rdi
+; NOFF-NEXT: movabsq $1, %rsi
+; NOFF: callq selInst
+; NOFF-NEXT: testb $1, %al
+; NOFF: movabsq $2, %rdi
+; NOFF-NEXT: leaq .Lsafire.opsizes.4.8(%rip), %rsi
+; NOFF: callq doInject
+
+; FF: movabsq $2, %rdi
+; FF-NEXT: movabsq $[[ENTRY:[0-9]+]], %rsi
+; FF: callq selMBB
+; FF-NEXT: cmpb $1, %al
+; FF: # %loop
+; FF: movabsq $3, %rdi
+; FF-NEXT: movabsq $[[LOOP:[0-9]+]], %rsi
+; FF: callq selMBB
+; FF-NEXT: cmpb $1, %al
+; FF: movabsq $[[ENTRY]], %rdi
+; FF-NEXT: movabsq $1, %rsi
+; FF: callq selInst
+; FF-NEXT: testb $1, %al
+; FF: movabsq $2, %rdi
+; FF-NEXT: leaq .Lsafire.opsizes.4.8(%rip), %rsi
+; FF: callq doInject
+; FF: movabsq $[[LOOP]], %rdi
+; FF-NEXT: movabsq $1, %rsi
+; FF: callq selInst
+; FF-NEXT: testb $1, %al
+; FF: movabsq $2, %rdi
+; FF-NEXT: leaq .Lsafire.opsizes.8.4(%rip), %rsi
+; FF: callq doInject
+
+; CHECK: .Lsafire.hook.abi:
+; CHECK-NEXT: .quad safire_hook_abi_v2
+; CHECK: .Lsafire.opsizes.4.8:
+; CHECK-NEXT: .quad 4
+; CHECK-NEXT: .quad 8
+; CHECK: .Lsafire.opsizes.8.4:
+; CHECK-NEXT: .quad 8
+; CHECK-NEXT: .quad 4
+
+define i64 @sum(i64* %a, i64 %n) nounwind {
+entry:
+  br label %loop
+
+loop:
+  %i = phi i64 [ 0, %entry ], [ %i.next, %loop ]
+  %s = phi i64 [ 0, %entry ], [ %s.next, %loop ]
+  %p = getelementptr i64, i64* %a, i64 %i
+  %v = load i64, i64* %p
+  %s.next = add i64 %s, %v
+  %i.next = add i64 %i, 1
+  %c = icmp slt i64 %i.next, %n
+  br i1 %c, label %loop, label %exit
+
+exit:
+  ret i64 %s.next
+}
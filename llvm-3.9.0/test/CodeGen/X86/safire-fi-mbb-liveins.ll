@@ -0,0 +1,31 @@
+; RUN: llc < %s -mtriple=x86_64-unknown-linux-gnu -verify-machineinstrs -fi -fi-ff -fi-mbb-liveins -fi-funcs=sum -fi-inst-types=* -fi-reg-types=dst | FileCheck %s
+
+; Live-in targets with fast-forwarding: the loop block has live-ins, it is an FF site of a single
+; target (selMBB num_insts 1), the live-in set injected before the first instruction of its copy
+
+; CHECK-LABEL: sum:
+; CHECK: # %loop
+; CHECK: movabsq $1, %rdi
+; CHECK-NEXT: movabsq ${{[0-9]+}}, %rsi
+; CHECK-NEXT: callq selMBB
+; CHECK: movabsq $1, %rsi
+; CHECK: callq selInst
+; CHECK: callq doInject
+
+define i64 @sum(i64* %a, i64 %n) {
+entry:
+  br label %loop
+
+loop:
+  %i = phi i64 [ 0, %entry ], [ %i.next, %loop ]
+  %s = phi i64 [ 0, %entry ], [ %s.next, %loop ]
+  %p = getelementptr i64, i64* %a, i64 %i
+  %v = load i64, i64* %p
+  %s.next = add i64 %s, %v
+  %i.next = add i64 %i, 1
+  %c = icmp slt i64 %i.next, %n
+  br i1 %c, label %loop, label %exit
+
+exit:
+  ret i64 %s.next
+}
@@ -0,0 +1,42 @@
+; RUN: llc < %s -mtriple=x86_64-unknown-linux-gnu -verify-machineinstrs -fi -fi-funcs=store -fi-inst-types=data -fi-reg-types=mem | FileCheck %s --check-prefix=CHECK --check-prefix=NOFF
+; RUN: llc < %s -mtriple=x86_64-unknown-linux-gnu -verify-machineinstrs -fi -fi-ff -fi-funcs=store -fi-inst-types=data -fi-reg-types=mem | FileCheck %s --check-prefix=CHECK --check-prefix=FF
+
+; Destination memory targets are injected after the store: the address is recomputed into a scratch
+; register distinct from the base and index, and the bitmask is XORed into the stored bytes at the
+; width of the store, the op size in the table of doInject
+
+; CHECK-LABEL: store:
+; NOFF-NOT: selMBB
+; FF: callq selMBB
+; FF: cmpb $1, %al
+; CHECK: movq %rdx, (%rdi,%rsi,8)
+; CHECK: callq selInst
+; CHECK: leaq .Lsafire.opsizes.8(%rip), %rsi
+; CHECK: callq doInject
+; CHECK: pushq %rbx
+; CHECK-NEXT: pushq %rcx
+; CHECK-NEXT: leaq (%rdi,%rsi,8), %rbx
+; CHECK-NEXT: movq {{-?[0-9]+}}(%rsp), %rcx
+; CHECK-NEXT: xorq %rcx, (%rbx)
+; CHECK-NEXT: popq %rcx
+; CHECK-NEXT: popq %rbx
+; CHECK: movl %ecx, (%rdi)
+; CHECK: callq selInst
+; CHECK: leaq .Lsafire.opsizes.4(%rip), %rsi
+; CHECK: callq doInject
+; CHECK: pushq %rbx
+; CHECK-NEXT: pushq %rcx
+; CHECK-NEXT: leaq (%rdi), %rbx
+; CHECK-NEXT: movq {{-?[0-9]+}}(%rsp), %rcx
+; CHECK-NEXT: xorl %ecx, (%rbx)
+; CHECK-NEXT: popq %rcx
+; CHECK-NEXT: popq %rbx
+
+define void @store(i64* %p, i64 %i, i64 %v, i32 %w) nounwind {
+entry:
+  %q = getelementptr i64, i64* %p, i64 %i
+  store i64 %v, i64* %q
+  %r = bitcast i64* %p to i32*
+  store i32 %w, i32* %r
+  ret void
+}
@@ -0,0 +1,46 @@
+; RUN: llc < %s -mtriple=x86_64-unknown-linux-gnu -verify-machineinstrs -fi -fi-funcs=mul -fi-inst-types=data -fi-reg-types=src | FileCheck %s --check-prefix=CHECK --check-prefix=NOFF
+; RUN: llc < %s -mtriple=x86_64-unknown-linux-gnu -verify-machineinstrs -fi -fi-ff -fi-funcs=mul -fi-inst-types=data -fi-reg-types=src | FileCheck %s --check-prefix=CHECK --check-prefix=FF
+
+; Source register targets are injected before the instruction. The fault of a source that is not
+; overwritten is undone after a copy of the instruction, so it hits only this read, the fault of a
+; source that is also a def (RDI of the two-address IMUL) persists in the result
+
+; CHECK-LABEL: mul:
+; NOFF-NOT: selMBB
+; FF: callq selMBB
+; FF: cmpb $1, %al
+; CHECK: callq selInst
+; CHECK: leaq .Lsafire.opsizes.8.8(%rip), %rsi
+; CHECK: callq doInject
+; CHECK: cmpq $1, {{-?[0-9]+}}(%rsp)
+; CHECK-NEXT: je [[SRC:.LBB[0-9_]+]]
+; CHECK: xorq [[MASK:-?[0-9]+]](%rsp), %rdi
+; CHECK-NEXT: jmp [[POST:.LBB[0-9_]+]]
+; CHECK-NEXT: [[SRC]]:
+; CHECK-NEXT: xorq [[MASK]](%rsp), %rsi
+; CHECK-NEXT: movq -16(%rbp), %rax
+; CHECK-NEXT: movq (%rbp), %rsp
+; CHECK-NEXT: movq -8(%rbp), %rbp
+; CHECK-NEXT: imulq %rsi, %rdi
+; CHECK-NEXT: pushq %rsp
+; CHECK-NEXT: pushq %rbp
+; CHECK-NEXT: leaq 8(%rsp), %rbp
+; CHECK-NEXT: pushq %rax
+; CHECK-NEXT: andq $-64, %rsp
+; CHECK-NEXT: xorq [[MASK]](%rsp), %rsi
+; CHECK-NEXT: movq -16(%rbp), %rax
+; CHECK-NEXT: movq (%rbp), %rsp
+; CHECK-NEXT: movq -8(%rbp), %rbp
+; CHECK-NEXT: jmp [[RESUME:.LBB[0-9_]+]]
+; CHECK-NEXT: [[POST]]:
+; CHECK-NEXT: movq -16(%rbp), %rax
+; CHECK-NEXT: movq (%rbp), %rsp
+; CHECK-NEXT: movq -8(%rbp), %rbp
+; CHECK-NEXT: imulq %rsi, %rdi
+; CHECK-NEXT: [[RESUME]]:
+
+define i64 @mul(i64 %a, i64 %b) nounwind {
+entry:
+  %m = mul i64 %a, %b
+  ret i64 %m
+}
@@ -0,0 +1,263 @@
+//===-- safire-jit.cpp - Lazy fault injection through an Orc JIT ----------===//
+//
+//                     The LLVM Compiler Infrastructure
+//
+// This file is distributed under the University of Illinois Open Source
+// License. See LICENSE.TXT for details.
+//
+//===----------------------------------------------------------------------===//
+//
+// Runs an app's bitcode through an Orc lazy JIT: every function is compiled
+// on its first call, in its own partition. The FI pass is part of the MC
+// emission path (addPassesToEmitMC) and instruments only the functions of
+// -fi-funcs, so only the function holding the sampled target pays the
+// instrumentation cost and switching targets needs no rebuild. With -fi-ff,
+// counting happens only inside that function, the target fi_index is the
+// dynamic instance among its target instructions.
+//
+// safire-jit -fi -fi-ff -fi-funcs=foo -fi-inst-types=* -fi-reg-types=dst
+//   -lib=$HOME/usr/local/lib/libinject_ser.so app.bc <app args>
+//
+//===----------------------------------------------------------------------===//
+
+#include "llvm/ADT/Triple.h"
+#include "llvm/CodeGen/LinkAllCodegenComponents.h"
+#include "llvm/ExecutionEngine/ExecutionEngine.h"
+#include "llvm/ExecutionEngine/Orc/CompileOnDemandLayer.h"
+#include "llvm/ExecutionEngine/Orc/CompileUtils.h"
+#include "llvm/ExecutionEngine/Orc/ExecutionUtils.h"
+#include "llvm/ExecutionEngine/Orc/IRCompileLayer.h"
+#include "llvm/ExecutionEngine/Orc/LambdaResolver.h"
+#include "llvm/ExecutionEngine/Orc/ObjectLinkingLayer.h"
+#include "llvm/ExecutionEngine/Orc/OrcABISupport.h"
+#include "llvm/ExecutionEngine/RTDyldMemoryManager.h"
+#include "llvm/ExecutionEngine/SectionMemoryManager.h"
+#include "llvm/IR/LLVMContext.h"
+#include "llvm/IR/Mangler.h"
+#include "llvm/IR/Module.h"
+#include "llvm/IRReader/IRReader.h"
+#include "llvm/Support/CommandLine.h"
+#include "llvm/Support/DynamicLibrary.h"
+#include "llvm/Support/Host.h"
+#include "llvm/Support/ManagedStatic.h"
+#include "llvm/Support/PrettyStackTrace.h"
+#include "llvm/Support/Signals.h"
+#include "llvm/Support/SourceMgr.h"
+#include "llvm/Support/TargetSelect.h"
+#include "llvm/Support/raw_ostream.h"
+#include "llvm/Target/TargetMachine.h"
+
+using namespace llvm;
+
+// FI pass options, MCFaultInjectionPass.cpp
+extern cl::opt<bool> FIEnable;
+extern cl::list<std::string> FuncInclList;
+
+static cl::opt<std::string>
+InputFile(cl::desc("<input bitcode>"), cl::Positional, cl::init("-"));
+
+static cl::list<std::string>
+InputArgv(cl::ConsumeAfter, cl::desc("<program arguments>..."));
+
+static cl::list<std::string>
+Libs("lib", cl::desc("Shared libraries to load, e.g., libinject_ser.so"), cl::value_desc("path"), cl::ZeroOrMore);
+
+static cl::opt<char>
+OptLevel("O", cl::desc("Optimization level. [-O0, -O1, -O2, or -O3] (default = '-O2')"),
+         cl::Prefix, cl::ZeroOrMore, cl::init(' '));
+
+namespace {
+
+class SafireJIT {
+public:
+  typedef orc::JITCompileCallbackManager CompileCallbackMgr;
+  typedef orc::ObjectLinkingLayer<> ObjLayerT;
+  typedef orc::IRCompileLayer<ObjLayerT> CompileLayerT;
+  typedef orc::CompileOnDemandLayer<CompileLayerT, CompileCallbackMgr> CODLayerT;
+  typedef CODLayerT::IndirectStubsManagerBuilderT IndirectStubsManagerBuilder;
+  typedef CODLayerT::ModuleSetHandleT ModuleHandleT;
+
+  SafireJIT(std::unique_ptr<TargetMachine> TM,
+            std::unique_ptr<CompileCallbackMgr> CCMgr,
+            IndirectStubsManagerBuilder IndirectStubsMgrBuilder)
+      : TM(std::move(TM)), DL(this->TM->createDataLayout()),
+        CCMgr(std::move(CCMgr)),
+        CompileLayer(ObjectLayer, orc::SimpleCompiler(*this->TM)),
+        // XXX: one function per partition, the FI pass sees the target function alone
+        CODLayer(CompileLayer, extractSingleFunction, *this->CCMgr,
+                 std::move(IndirectStubsMgrBuilder), false),
+        CXXRuntimeOverrides(
+            [this](const std::string &S) { return mangle(S); }) {}
+
+  ~SafireJIT() {
+    CXXRuntimeOverrides.runDestructors();
+    for (auto &DtorRunner : IRStaticDestructorRunners)
+      DtorRunner.runViaLayer(CODLayer);
+  }
+
+  ModuleHandleT addModule(std::unique_ptr<Module> M) {
+    if (M->getDataLayout().isDefault())
+      M->setDataLayout(DL);
+
+    std::vector<std::string> CtorNames, DtorNames;
+    for (auto Ctor : orc::getConstructors(*M))
+      CtorNames.push_back(mangle(Ctor.Func->getName()));
+    for (auto Dtor : orc::getDestructors(*M))
+      DtorNames.push_back(mangle(Dtor.Func->getName()));
+
+    // Resolve JIT symbols first, then the process and the -lib libraries (selMBB, doInject, ...)
+    auto Resolver =
+      orc::createLambdaResolver(
+        [this](const std::string &Name) {
+          if (auto Sym = CODLayer.findSymbol(Name, true))
+            return Sym.toRuntimeDyldSymbol();
+          if (auto Sym = CXXRuntimeOverrides.searchOverrides(Name))
+            return Sym;
+          if (auto Addr = RTDyldMemoryManager::getSymbolAddressInProcess(Name))
+            return RuntimeDyld::SymbolInfo(Addr, JITSymbolFlags::Exported);
+          return RuntimeDyld::SymbolInfo(nullptr);
+        },
+        [](const std::string &Name) {
+          return RuntimeDyld::SymbolInfo(nullptr);
+        }
+      );
+
+    std::vector<std::unique_ptr<Module>> S;
+    S.push_back(std::move(M));
+    auto H = CODLayer.addModuleSet(std::move(S),
+                                   llvm::make_unique<SectionMemoryManager>(),
+                                   std::move(Resolver));
+
+    orc::CtorDtorRunner<CODLayerT> CtorRunner(std::move(CtorNames), H);
+    CtorRunner.runViaLayer(CODLayer);
+    IRStaticDestructorRunners.emplace_back(std::move(DtorNames), H);
+
+    return H;
+  }
+
+  orc::JITSymbol findSymbolIn(ModuleHandleT H, const std::string &Name) {
+    return CODLayer.findSymbolIn(H, mangle(Name), true);
+  }
+
+private:
+  std::string mangle(const std::string &Name) {
+    std::string MangledName;
+    {
+      raw_string_ostream MangledNameStream(MangledName);
+      Mangler::getNameWithPrefix(MangledNameStream, Name, DL);
+    }
+    return MangledName;
+  }
+
+  static std::set<Function*> extractSingleFunction(Function &F) {
+    std::set<Function*> Partition;
+    Partition.insert(&F);
+    return Partition;
+  }
+
+  std::unique_ptr<TargetMachine> TM;
+  DataLayout DL;
+
+  std::unique_ptr<CompileCallbackMgr> CCMgr;
+  ObjLayerT ObjectLayer;
+  CompileLayerT CompileLayer;
+  CODLayerT CODLayer;
+
+  orc::LocalCXXRuntimeOverrides CXXRuntimeOverrides;
+  std::vector<orc::CtorDtorRunner<CODLayerT>> IRStaticDestructorRunners;
+};
+
+} // end anonymous namespace
+
+static CodeGenOpt::Level getOptLevel() {
+  switch (OptLevel) {
+  default:
+    errs() << "safire-jit: Invalid optimization level.\n";
+    exit(1);
+  case '0': return CodeGenOpt::None;
+  case '1': return CodeGenOpt::Less;
+  case ' ':
+  case '2': return CodeGenOpt::Default;
+  case '3': return CodeGenOpt::Aggressive;
+  }
+}
+
+int main(int argc, char **argv, char * const *envp) {
+  sys::PrintStackTraceOnErrorSignal(argv[0]);
+  PrettyStackTraceProgram X(argc, argv);
+  llvm_shutdown_obj Y;
+
+  InitializeNativeTarget();
+  InitializeNativeTargetAsmPrinter();
+  InitializeNativeTargetAsmParser();
+
+  cl::ParseCommandLineOptions(argc, argv, "SAFIRE lazy fault injection JIT\n");
+
+  if(FIEnable && (FuncInclList.empty() || std::find(FuncInclList.begin(), FuncInclList.end(), "*") != FuncInclList.end()))
+    errs() << "safire-jit: WARNING: -fi without -fi-funcs=<target function> instruments every function\n";
+
+  // Add the program's symbols and the libraries (libinject) into the JIT's search space
+  if (sys::DynamicLibrary::LoadLibraryPermanently(nullptr)) {
+    errs() << "safire-jit: Error loading program symbols.\n";
+    return 1;
+  }
+  for (auto &Lib : Libs) {
+    std::string ErrMsg;
+    if (sys::DynamicLibrary::LoadLibraryPermanently(Lib.c_str(), &ErrMsg)) {
+      errs() << "safire-jit: Error loading " << Lib << ": " << ErrMsg << "\n";
+      return 1;
+    }
+  }
+
+  LLVMContext Context;
+  SMDiagnostic Err;
+  std::unique_ptr<Module> M = parseIRFile(InputFile, Err, Context);
+  if (!M) {
+    Err.print(argv[0], errs());
+    return 1;
+  }
+
+  // XXX: the instrumentation calls selMBB, selInst, doInject from the shared libinject, PIC
+  // calls them through PLT stubs, no pc-relative reach is assumed between JIT memory and the library
+  EngineBuilder EB;
+  EB.setOptLevel(getOptLevel());
+  EB.setRelocationModel(Reloc::PIC_);
+  EB.setCodeModel(CodeModel::Small);
+  EB.setMCPU(sys::getHostCPUName());
+  std::unique_ptr<TargetMachine> TM(EB.selectTarget());
+  if (!TM) {
+    errs() << "safire-jit: No target machine for the host.\n";
+    return 1;
+  }
+  Triple T(TM->getTargetTriple());
+
+  auto CompileCallbackMgr = orc::createLocalCompileCallbackManager(T, 0);
+  if (!CompileCallbackMgr) {
+    errs() << "safire-jit: No callback manager available for target '" << T.str() << "'.\n";
+    return 1;
+  }
+  auto IndirectStubsMgrBuilder = orc::createLocalIndirectStubsManagerBuilder(T);
+  if (!IndirectStubsMgrBuilder) {
+    errs() << "safire-jit: No indirect stubs manager available for target '" << T.str() << "'.\n";
+    return 1;
+  }
+
+  SafireJIT J(std::move(TM), std::move(CompileCallbackMgr), std::move(IndirectStubsMgrBuilder));
+
+  auto MainHandle = J.addModule(std::move(M));
+  auto MainSym = J.findSymbolIn(MainHandle, "main");
+  if (!MainSym) {
+    errs() << "safire-jit: Could not find main function.\n";
+    return 1;
+  }
+
+  std::vector<char *> Argv;
+  Argv.push_back(const_cast<char *>(InputFile.c_str()));
+  for (auto &Arg : InputArgv)
+    Argv.push_back(const_cast<char *>(Arg.c_str()));
+  Argv.push_back(nullptr);
+
+  typedef int (*MainFnPtr)(int, char *[], char * const *);
+  auto Main = reinterpret_cast<MainFnPtr>(static_cast<uintptr_t>(MainSym.getAddress()));
+  return Main(Argv.size() - 1, Argv.data(), envp);
+}
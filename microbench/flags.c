@@ -0,0 +1,32 @@
+// EFLAGS-live compare chains: compares feed conditional moves and branches, so EFLAGS is live
+// across the instrumented instructions and must be saved and restored
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+
+#define N 4096
+
+static int64_t v[N];
+
+int main(int argc, char *argv[])
+{
+    long reps = ( argc > 1 ? atol(argv[1]) : 20000 );
+    long r;
+    int i;
+    int64_t lo = 0, hi = 0, cnt = 0;
+
+    for(i = 0; i < N; i++)
+        v[i] = ( i * 2654435761U ) % 1000003;
+
+    for(r = 0; r < reps; r++) {
+        for(i = 0; i < N; i++) {
+            int64_t e = v[i] + r;
+            lo = ( e < lo ? e : lo );
+            hi = ( e > hi ? e : hi );
+            cnt += ( e > 1000 ) & ( e < 500000 ) & ( ( e & 7 ) != 3 );
+        }
+    }
+
+    printf("flags %lld %lld %lld\n", (long long)lo, (long long)hi, (long long)cnt);
+    return 0;
+}
@@ -0,0 +1,26 @@
+// Red-zone leaf functions: small non-inlined leaf functions keep locals in the 128B red zone
+// below RSP, which the instrumentation must skip before pushing
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+
+__attribute__((noinline)) uint64_t leaf(uint64_t a, uint64_t b)
+{
+    volatile uint64_t t[8];
+    int i;
+    for(i = 0; i < 8; i++)
+        t[i] = a + i * b;
+    return t[a & 7] ^ t[b & 7];
+}
+
+int main(int argc, char *argv[])
+{
+    uint64_t n = ( argc > 1 ? strtoull(argv[1], NULL, 10) : 20000000 );
+    uint64_t i, s = 0;
+
+    for(i = 0; i < n; i++)
+        s += leaf(i, s);
+
+    printf("leaf %llu\n", (unsigned long long)s);
+    return 0;
+}
@@ -0,0 +1,19 @@
+// Tight scalar loop: short basic blocks dominated by integer ALU instructions, the worst case for
+// per-block selMBB calls
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+
+int main(int argc, char *argv[])
+{
+    uint64_t n = ( argc > 1 ? strtoull(argv[1], NULL, 10) : 100000000 );
+    uint64_t i, a = 1, b = 3;
+
+    for(i = 0; i < n; i++) {
+        a = a * 6364136223846793005ULL + b;
+        b ^= a >> 17;
+    }
+
+    printf("loop %llu\n", (unsigned long long)(a ^ b));
+    return 0;
+}
@@ -0,0 +1,30 @@
+// OpenMP parallel loop: per-thread counters of the omp libraries, threads other than the target
+// detach immediately
+#include <stdio.h>
+#include <stdlib.h>
+#include <omp.h>
+
+#define N (1 << 20)
+
+static double x[N];
+
+int main(int argc, char *argv[])
+{
+    long reps = ( argc > 1 ? atol(argv[1]) : 100 );
+    long r;
+    int i;
+    double sum = 0;
+
+    #pragma omp parallel for
+    for(i = 0; i < N; i++)
+        x[i] = 1.0 / ( i + 1 );
+
+    for(r = 0; r < reps; r++) {
+        #pragma omp parallel for reduction(+:sum)
+        for(i = 0; i < N; i++)
+            sum += x[i] * r;
+    }
+
+    printf("omp %f threads %d\n", sum, omp_get_max_threads());
+    return 0;
+}
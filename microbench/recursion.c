@@ -0,0 +1,20 @@
+// Call-heavy recursion: every call enters a new function, selMBB runs again at the function head
+// even after detaching
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+
+__attribute__((noinline)) uint64_t fib(unsigned n)
+{
+    if(n < 2)
+        return n;
+    return fib(n - 1) + fib(n - 2);
+}
+
+int main(int argc, char *argv[])
+{
+    unsigned n = ( argc > 1 ? atoi(argv[1]) : 35 );
+
+    printf("recursion %llu\n", (unsigned long long)fib(n));
+    return 0;
+}
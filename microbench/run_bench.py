@@ -0,0 +1,110 @@
+#!/usr/bin/env python3
+
+import os
+import sys
+import argparse
+import subprocess
+import tempfile
+import time
+import json
+import re
+import numpy as np
+
+# Runs the microbenchmarks of manifest.txt (written by CMake) in every FI mode and phase:
+#   golden      uninstrumented baseline
+#   profile     no target file, counting the dynamic target instructions
+#   pre-target  a target beyond the end of the run, instrumentation never detaches
+#   detached    target the first instruction with FI_DRYRUN=1 (empty bitmask), fast-forwarding
+#               detaches right after it. Without FF (fi mode) counting continues per instruction
+# and reports the median wall time, slowdown and .text size ratio over golden as JSON. With --hugetext
+# every instrumented phase runs again with FI_HUGETEXT=app, the text remapped on huge pages
+
+phases = [ 'profile', 'pre-target', 'detached' ]
+
+# fi_index beyond any run
+FAR_TARGET = 2**62
+
+def text_size(exe):
+    out = subprocess.check_output(['size', '-A', exe]).decode()
+    m = re.search('^\.text\s+(\d+)', out, re.MULTILINE)
+    return int(m[1])
+
+def target_str(config, fi_index):
+    if config == 'omp':
+        return 'thread=0, fi_index=%d\n'%( fi_index )
+    return 'fi_index=%d\n'%( fi_index )
+
+def run(exe, config, mode, phase, reps, hugetext=False):
+    times = []
+    for r in range(0, reps):
+        # XXX: libinject reads and writes its files in the cwd, a fresh directory per run
+        with tempfile.TemporaryDirectory() as rundir:
+            runenv = os.environ.copy()
+            if phase == 'pre-target':
+                with open(rundir + '/fi-target.txt', 'w') as f:
+                    f.write( target_str(config, FAR_TARGET) )
+            elif phase == 'detached':
+                with open(rundir + '/fi-target.txt', 'w') as f:
+                    f.write( target_str(config, 1) )
+                runenv['FI_DRYRUN'] = '1'
+            elif phase == 'profile' and mode.endswith('-sites'):
+                runenv['FI_SITES'] = '1'
+            if hugetext:
+                runenv['FI_HUGETEXT'] = 'app'
+
+            start = time.perf_counter()
+            p = subprocess.run([exe], stdout=subprocess.PIPE, stderr=subprocess.PIPE, env=runenv, cwd=rundir)
+            xtime = time.perf_counter() - start
+            if p.returncode != 0:
+                print('Error %d running %s phase %s\n%s'%( p.returncode, exe, phase, p.stderr.decode() ))
+                sys.exit(1)
+            times.append(xtime)
+    return float( np.median(times) )
+
+def main():
+    parser = argparse.ArgumentParser('Run instrumentation overhead microbenchmarks')
+    parser.add_argument('-m', '--manifest', help='manifest of benchmark executables', required=True)
+    parser.add_argument('-r', '--reps', help='repetitions per run, reports the median', type=int, default=5)
+    parser.add_argument('-o', '--output', help='JSON output file', required=True)
+    parser.add_argument('--hugetext', help='run the instrumented phases also with FI_HUGETEXT=app', action='store_true')
+    args = parser.parse_args()
+
+    assert args.reps > 0, 'Repetitions must be > 0'
+
+    exps = []
+    with open(args.manifest, 'r') as f:
+        for l in f:
+            bench, config, mode, exe = l.split()
+            exps.append( ( bench, config, mode, exe ) )
+
+    golden = {}
+    for bench, config, mode, exe in exps:
+        if mode == 'golden':
+            golden[bench] = ( run(exe, config, mode, 'golden', args.reps), text_size(exe) )
+            print('%-10s %-12s %-10s %8.3fs'%( bench, mode, 'golden', golden[bench][0] ))
+
+    results = []
+    for bench, config, mode, exe in exps:
+        if mode == 'golden':
+            results.append( { 'bench': bench, 'config': config, 'mode': mode, 'phase': 'golden',
+                'time': golden[bench][0], 'slowdown': 1.0, 'text_size': golden[bench][1], 'size_ratio': 1.0 } )
+            continue
+        size = text_size(exe)
+        for phase, hugetext in [ ( p, h ) for p in phases for h in ( [ False, True ] if args.hugetext else [ False ] ) ]:
+            xtime = run(exe, config, mode, phase, args.reps, hugetext)
+            res = { 'bench': bench, 'config': config, 'mode': mode, 'phase': phase, 'hugetext': hugetext, 'time': xtime, 'text_size': size }
+            label = phase + ( '+huge' if hugetext else '' )
+            if bench in golden:
+                res['slowdown'] = xtime / golden[bench][0]
+                res['size_ratio'] = size / golden[bench][1]
+                print('%-10s %-12s %-15s %8.3fs slowdown %6.2fx size %5.2fx'%( bench, mode, label, xtime, res['slowdown'], res['size_ratio'] ))
+            else:
+                print('%-10s %-12s %-15s %8.3fs'%( bench, mode, label, xtime ))
+            results.append(res)
+
+    with open(args.output, 'w') as f:
+        json.dump( { 'reps': args.reps, 'results': results }, f, indent=2 )
+    print('Wrote ' + args.output)
+
+if __name__ == "__main__":
+    main()
@@ -0,0 +1,49 @@
+// Vector kernel with many live vector registers: 16 independent accumulators keep the whole
+// vector register file live, which the instrumentation must save around every call.
+// Compile with -mavx2 or -mavx512f (BENCH_ARCH_FLAGS) to select the register width
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define N 1024
+#define NACC 16
+
+#ifdef __AVX512F__
+#define VLEN 8
+#else
+#define VLEN 4
+#endif
+
+typedef double vd __attribute__((vector_size(8 * VLEN)));
+
+static double x[N] __attribute__((aligned(64)));
+
+int main(int argc, char *argv[])
+{
+    long reps = ( argc > 1 ? atol(argv[1]) : 1000000 );
+    long r;
+    int i, j;
+    vd acc[NACC];
+    double sum = 0;
+
+    for(i = 0; i < N; i++)
+        x[i] = 1.0 / ( i + 1 );
+
+    memset(acc, 0, sizeof(acc));
+    for(r = 0; r < reps; r++) {
+        for(i = 0; i < N; i += VLEN * NACC) {
+            for(j = 0; j < NACC; j++) {
+                vd v;
+                memcpy(&v, &x[i + VLEN * j], sizeof(v));
+                acc[j] = acc[j] * 0.999 + v;
+            }
+        }
+    }
+
+    for(j = 0; j < NACC; j++)
+        for(i = 0; i < VLEN; i++)
+            sum += acc[j][i];
+
+    printf("vector %f\n", sum);
+    return 0;
+}